@@ -1,15 +1,58 @@
 // (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
 
+#include <gflags/gflags.h>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <numeric>
+#include <random>
+#include <sstream>
+#include <thread>
 #include <vector>
 
+#include "src/torchcodec/decoders/core/FFMPEGCommon.h"
 #include "src/torchcodec/decoders/core/VideoDecoder.h"
 #include "src/torchcodec/decoders/core/VideoDecoderOps.h"
 #include "tools/cxx/Resources.h"
 
+DEFINE_bool(
+    run_resource_benchmarks,
+    true,
+    "If true, also runs the benchmarks on the checked in resource video.");
+DEFINE_string(
+    json_output,
+    "",
+    "If set, the results of the benchmark matrix are written to this path as "
+    "JSON.");
+DEFINE_string(
+    synthetic_video_dir,
+    "",
+    "The directory where the synthetic videos of the benchmark matrix are "
+    "generated and kept between runs. Defaults to a directory in the system "
+    "temporary directory.");
+DEFINE_string(
+    matrix_decoder_options,
+    "",
+    "Semicolon separated list of decoder options, e.g. "
+    "\";read_ahead_packets=64;mmap=1\". Every case of the benchmark matrix "
+    "runs once with each of them. An empty entry means the default options.");
+DEFINE_string(
+    matrix_stream_options,
+    "",
+    "The video stream options of the benchmark matrix, e.g. "
+    "\"width=240,height=135\".");
+DEFINE_int32(
+    matrix_iterations,
+    5,
+    "The number of measured iterations of each benchmark matrix case.");
+
 namespace facebook::torchcodec {
 
+constexpr unsigned kRandomSeed = 42;
+
 void printResults(
     const std::string& decoder_name,
     std::chrono::system_clock::time_point preWarmup,
@@ -47,6 +90,7 @@ void printResults(
 void runNDecodeIterations(
     const std::string& videoPath,
     std::vector<double>& ptsList,
+    const std::string& decoderName,
     int totalIterations,
     int warmupIterations) {
   assert(warmupIterations <= totalIterations);
@@ -68,7 +112,7 @@ void runNDecodeIterations(
   std::chrono::system_clock::time_point end =
       std::chrono::high_resolution_clock::now();
   printResults(
-      "Raw C++ seek+next",
+      decoderName,
       preWarmup,
       start,
       end,
@@ -109,6 +153,174 @@ void runNdecodeIterationsGrabbingConsecutiveFrames(
       totalIterations);
 }
 
+void runNdecodeIterationsGrabbingConsecutiveFramesInRange(
+    const std::string& videoPath,
+    int consecutiveFrameCount,
+    int totalIterations,
+    int warmupIterations) {
+  assert(warmupIterations <= totalIterations);
+  std::chrono::system_clock::time_point preWarmup =
+      std::chrono::high_resolution_clock::now();
+  std::chrono::system_clock::time_point start = preWarmup;
+  for (int i = 0; i < totalIterations; ++i) {
+    std::unique_ptr<VideoDecoder> decoder =
+        VideoDecoder::createFromFilePath(videoPath);
+    decoder->scanFileAndUpdateMetadataAndIndex();
+    int bestVideoStreamIndex =
+        *decoder->getContainerMetadata().bestVideoStreamIndex;
+    decoder->addVideoStreamDecoder(bestVideoStreamIndex);
+    torch::Tensor tensor =
+        decoder
+            ->getFramesInRange(bestVideoStreamIndex, 0, consecutiveFrameCount)
+            .frames;
+    if (i + 1 == warmupIterations) {
+      start = std::chrono::high_resolution_clock::now();
+    }
+  }
+  std::chrono::system_clock::time_point end =
+      std::chrono::high_resolution_clock::now();
+  printResults(
+      "Raw C++ range",
+      preWarmup,
+      start,
+      end,
+      consecutiveFrameCount,
+      warmupIterations,
+      totalIterations);
+}
+
+void runNColorConversionIterations(
+    const std::string& videoPath,
+    const VideoDecoder::VideoStreamDecoderOptions& streamOptions,
+    const std::string& decoderName,
+    int consecutiveFrameCount,
+    int totalIterations,
+    int warmupIterations) {
+  assert(warmupIterations <= totalIterations);
+  std::chrono::system_clock::time_point preWarmup =
+      std::chrono::high_resolution_clock::now();
+  std::chrono::system_clock::time_point start = preWarmup;
+  for (int i = 0; i < totalIterations; ++i) {
+    std::unique_ptr<VideoDecoder> decoder =
+        VideoDecoder::createFromFilePath(videoPath);
+    decoder->addVideoStreamDecoder(-1, streamOptions);
+    for (int j = 0; j < consecutiveFrameCount; ++j) {
+      torch::Tensor tensor = decoder->getNextDecodedOutput().frame;
+    }
+    if (i + 1 == warmupIterations) {
+      start = std::chrono::high_resolution_clock::now();
+    }
+  }
+  std::chrono::system_clock::time_point end =
+      std::chrono::high_resolution_clock::now();
+  printResults(
+      decoderName,
+      preWarmup,
+      start,
+      end,
+      consecutiveFrameCount,
+      warmupIterations,
+      totalIterations);
+}
+
+// Decodes the first frames of the same video over and over, either with a new
+// decoder per iteration or by reopening a single decoder, which keeps the open
+// codec context and filter graph.
+void runNOpenIterations(
+    const std::string& videoPath,
+    bool reopen,
+    int consecutiveFrameCount,
+    int totalIterations,
+    int warmupIterations) {
+  assert(warmupIterations <= totalIterations);
+  VideoDecoder::VideoStreamDecoderOptions streamOptions(
+      "width=240,height=135");
+  std::chrono::system_clock::time_point preWarmup =
+      std::chrono::high_resolution_clock::now();
+  std::chrono::system_clock::time_point start = preWarmup;
+  std::unique_ptr<VideoDecoder> decoder;
+  for (int i = 0; i < totalIterations; ++i) {
+    if (reopen && decoder) {
+      decoder->reopenFromFilePath(videoPath);
+    } else {
+      decoder = VideoDecoder::createFromFilePath(videoPath);
+      decoder->addVideoStreamDecoder(-1, streamOptions);
+    }
+    for (int j = 0; j < consecutiveFrameCount; ++j) {
+      torch::Tensor tensor = decoder->getNextDecodedOutput().frame;
+    }
+    if (i + 1 == warmupIterations) {
+      start = std::chrono::high_resolution_clock::now();
+    }
+  }
+  std::chrono::system_clock::time_point end =
+      std::chrono::high_resolution_clock::now();
+  printResults(
+      reopen ? "Raw C++ reopen per video" : "Raw C++ new decoder per video",
+      preWarmup,
+      start,
+      end,
+      consecutiveFrameCount,
+      warmupIterations,
+      totalIterations);
+}
+
+// Reports the decoding time of each decode quality tier together with how far
+// its frames are from the full quality ones.
+void runNDecodeQualityIterations(
+    const std::string& videoPath,
+    const std::string& sizeOptions,
+    int consecutiveFrameCount,
+    int totalIterations,
+    int warmupIterations) {
+  auto decodeFrames = [&](const std::string& quality) {
+    std::unique_ptr<VideoDecoder> decoder =
+        VideoDecoder::createFromFilePath(videoPath);
+    decoder->addVideoStreamDecoder(
+        -1,
+        VideoDecoder::VideoStreamDecoderOptions(
+            "decode_quality=" + quality + sizeOptions));
+    std::vector<torch::Tensor> frames;
+    for (int j = 0; j < consecutiveFrameCount; ++j) {
+      frames.push_back(decoder->getNextDecodedOutput().frame);
+    }
+    return torch::stack(frames).to(torch::kFloat);
+  };
+  torch::Tensor fullQualityFrames = decodeFrames("full");
+  for (std::string quality : {"full", "fast", "fastest"}) {
+    std::chrono::system_clock::time_point preWarmup =
+        std::chrono::high_resolution_clock::now();
+    std::chrono::system_clock::time_point start = preWarmup;
+    torch::Tensor frames;
+    for (int i = 0; i < totalIterations; ++i) {
+      frames = decodeFrames(quality);
+      if (i + 1 == warmupIterations) {
+        start = std::chrono::high_resolution_clock::now();
+      }
+    }
+    std::chrono::system_clock::time_point end =
+        std::chrono::high_resolution_clock::now();
+    printResults(
+        "Raw C++ next-only decode_quality=" + quality + sizeOptions,
+        preWarmup,
+        start,
+        end,
+        consecutiveFrameCount,
+        warmupIterations,
+        totalIterations);
+    double meanAbsoluteError =
+        (frames - fullQualityFrames).abs().mean().item<double>();
+    double meanSquaredError =
+        (frames - fullQualityFrames).pow(2).mean().item<double>();
+    double psnr = meanSquaredError == 0
+        ? INFINITY
+        : 10 * std::log10(255.0 * 255.0 / meanSquaredError);
+    std::cout << "decode_quality=" << quality << sizeOptions
+              << " mean absolute error vs full: " << meanAbsoluteError
+              << " PSNR vs full: " << psnr << " dB" << std::endl;
+  }
+}
+
 void runNDecodeIterationsWithCustomOps(
     const std::string& videoPath,
     std::vector<double>& ptsList,
@@ -134,14 +346,16 @@ void runNDecodeIterationsWithCustomOps(
           .findSchemaOrThrow("torchcodec_ns::get_next_frame", "")
           .typed<decltype(get_next_frame)>();
   for (int i = 0; i < totalIterations; ++i) {
-    torch::Tensor decoderTensor = createDecoderOp.call(videoPath);
+    torch::Tensor decoderTensor =
+        createDecoderOp.call(videoPath, /*options=*/std::nullopt);
     addVideoStreamOp.call(
         decoderTensor,
         /*width=*/std::nullopt,
         /*height=*/std::nullopt,
         /*thread_count=*/std::nullopt,
         /*shape=*/std::nullopt,
-        /*stream_index=*/std::nullopt);
+        /*stream_index=*/std::nullopt,
+        /*stream_options=*/std::nullopt);
 
     for (double pts : ptsList) {
       seekFrameOp.call(decoderTensor, pts);
@@ -163,23 +377,612 @@ void runNDecodeIterationsWithCustomOps(
       totalIterations);
 }
 
+void runNScanIterations(
+    const std::string& videoPath,
+    const std::string& scanMode,
+    int totalIterations,
+    int warmupIterations) {
+  assert(warmupIterations <= totalIterations);
+  VideoDecoder::DecoderOptions options;
+  options.scanMode = scanMode;
+  std::chrono::system_clock::time_point preWarmup =
+      std::chrono::high_resolution_clock::now();
+  std::chrono::system_clock::time_point start = preWarmup;
+  int64_t numFrames = 0;
+  // The streams whose index was built by demuxing their packets, i.e. that
+  // fell back from the container index.
+  std::string packetScannedStreams;
+  for (int i = 0; i < totalIterations; ++i) {
+    std::unique_ptr<VideoDecoder> decoder =
+        VideoDecoder::createFromFilePath(videoPath, options);
+    decoder->scanFileAndUpdateMetadataAndIndex();
+    auto metadata = decoder->getContainerMetadata();
+    numFrames = metadata.streams[*metadata.bestVideoStreamIndex]
+                    .numFramesFromScan.value_or(0);
+    packetScannedStreams.clear();
+    for (const auto& streamMetadata : metadata.streams) {
+      if (streamMetadata.indexSource == "packets") {
+        packetScannedStreams += (packetScannedStreams.empty() ? "" : ",") +
+            std::to_string(streamMetadata.streamIndex);
+      }
+    }
+    if (i + 1 == warmupIterations) {
+      start = std::chrono::high_resolution_clock::now();
+    }
+  }
+  std::chrono::system_clock::time_point end =
+      std::chrono::high_resolution_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(end - start)
+          .count();
+  double averageMicros =
+      static_cast<double>(duration) / (totalIterations - warmupIterations);
+  std::cout << "Scan mode=" << scanMode
+            << " average time to create and scan: " << averageMicros << " us"
+            << " (" << averageMicros / 1000 << "ms)"
+            << " numFramesFromScan=" << numFrames << " packetScannedStreams=["
+            << packetScannedStreams << "]" << std::endl;
+}
+
 void runBenchmark() {
   std::string videoPath =
       build::getResourcePath(
           "pytorch/torchcodec/benchmarks/decoders/resources/nasa_13013.mp4")
           .string();
-  // TODO(T180763625): Add more test cases involving random seeks forwards and
-  // backwards.
   std::vector<double> ptsList = {
       0.0, 1.0, 2.0, 3.0, 4.0, 5.0, 6.0, 7.0, 8.0, 9.0};
-  runNDecodeIterations(videoPath, ptsList, 100, 5);
+  runNDecodeIterations(videoPath, ptsList, "Raw C++ seek+next", 100, 5);
+  std::vector<double> backwardPtsList(ptsList.rbegin(), ptsList.rend());
+  runNDecodeIterations(
+      videoPath, backwardPtsList, "Raw C++ backward seek+next", 100, 5);
+  std::vector<double> randomPtsList = ptsList;
+  std::shuffle(
+      randomPtsList.begin(), randomPtsList.end(), std::mt19937(kRandomSeed));
+  runNDecodeIterations(
+      videoPath, randomPtsList, "Raw C++ random seek+next", 100, 5);
   runNDecodeIterationsWithCustomOps(videoPath, ptsList, 100, 5);
   runNdecodeIterationsGrabbingConsecutiveFrames(videoPath, 20, 100, 5);
+  runNdecodeIterationsGrabbingConsecutiveFramesInRange(videoPath, 20, 100, 5);
+  for (std::string library : {"filtergraph", "swscale"}) {
+    for (std::string sizeOptions : {"", ",width=240,height=135"}) {
+      std::string optionsString =
+          "color_conversion_library=" + library + sizeOptions;
+      runNColorConversionIterations(
+          videoPath,
+          VideoDecoder::VideoStreamDecoderOptions(optionsString),
+          "Raw C++ next-only " + optionsString,
+          20,
+          100,
+          5);
+    }
+  }
+  for (std::string sizeOptions : {"", ",width=240,height=135"}) {
+    runNDecodeQualityIterations(videoPath, sizeOptions, 20, 100, 5);
+  }
+  runNOpenIterations(videoPath, /*reopen=*/false, 5, 100, 5);
+  runNOpenIterations(videoPath, /*reopen=*/true, 5, 100, 5);
+  runNScanIterations(videoPath, "packets", 100, 5);
+  runNScanIterations(videoPath, "container_index", 100, 5);
+}
+
+// The benchmark matrix decodes synthetic videos that are encoded locally with
+// FFmpeg's encoders, so that it covers several codecs, GOP lengths and
+// resolutions without checking in large files, and runs every access pattern
+// on each of them. The results, including the decode stats, can be written as
+// JSON to compare runs across FFmpeg upgrades or decoder options.
+struct SyntheticVideoConfig {
+  std::string codecName;
+  int width;
+  int height;
+  int gopSize;
+
+  std::string getName() const {
+    return codecName + "_" + std::to_string(width) + "x" +
+        std::to_string(height) + "_gop" + std::to_string(gopSize);
+  }
+};
+
+constexpr int kSyntheticVideoFrameRate = 30;
+constexpr int kSyntheticVideoNumFrames = 150;
+
+// avformat_close_input() is only for demuxers.
+struct OutputFormatContextDeleter {
+  void operator()(AVFormatContext* formatContext) const {
+    if (!(formatContext->oformat->flags & AVFMT_NOFILE)) {
+      avio_closep(&formatContext->pb);
+    }
+    avformat_free_context(formatContext);
+  }
+};
+using UniqueOutputFormatContext =
+    std::unique_ptr<AVFormatContext, OutputFormatContextDeleter>;
+
+void checkFFMPEGStatus(int status, const std::string& call) {
+  TORCH_CHECK(
+      status >= 0,
+      call,
+      " failed: ",
+      getFFMPEGErrorStringFromErrorCode(status));
+}
+
+// Draws a gradient that scrolls with each frame and a square that moves across
+// it, so that inter frames have motion to encode.
+void drawSyntheticFrame(AVFrame* frame, int64_t frameIndex) {
+  int squareSize = frame->height / 4;
+  int squareX = (frameIndex * 8) % std::max(1, frame->width - squareSize);
+  int squareY = (frameIndex * 4) % std::max(1, frame->height - squareSize);
+  for (int y = 0; y < frame->height; ++y) {
+    uint8_t* row = frame->data[0] + y * frame->linesize[0];
+    for (int x = 0; x < frame->width; ++x) {
+      bool inSquare = x >= squareX && x < squareX + squareSize &&
+          y >= squareY && y < squareY + squareSize;
+      row[x] = inSquare ? 235 : (x + y + frameIndex * 3) % 200 + 16;
+    }
+  }
+  // Both pixel formats we encode have chroma planes of half the width and
+  // height.
+  for (int plane = 1; plane < 3; ++plane) {
+    for (int y = 0; y < AV_CEIL_RSHIFT(frame->height, 1); ++y) {
+      uint8_t* row = frame->data[plane] + y * frame->linesize[plane];
+      for (int x = 0; x < AV_CEIL_RSHIFT(frame->width, 1); ++x) {
+        row[x] = (plane == 1 ? x : y) + frameIndex % 64 + 64;
+      }
+    }
+  }
+}
+
+void generateSyntheticVideo(
+    const SyntheticVideoConfig& config,
+    const std::string& path) {
+  AVCodecPtr codec = avcodec_find_encoder_by_name(config.codecName.c_str());
+  TORCH_CHECK(codec != nullptr, "Encoder not found: ", config.codecName);
+  AVFormatContext* rawFormatContext = nullptr;
+  checkFFMPEGStatus(
+      avformat_alloc_output_context2(
+          &rawFormatContext, nullptr, "matroska", path.c_str()),
+      "avformat_alloc_output_context2");
+  UniqueOutputFormatContext formatContext(rawFormatContext);
+
+  UniqueAVCodecContext codecContext(avcodec_alloc_context3(codec));
+  TORCH_CHECK(codecContext != nullptr, "Could not allocate codec context");
+  codecContext->width = config.width;
+  codecContext->height = config.height;
+  codecContext->time_base = {1, kSyntheticVideoFrameRate};
+  codecContext->framerate = {kSyntheticVideoFrameRate, 1};
+  codecContext->gop_size = config.gopSize;
+  // About 0.1 bits per pixel.
+  codecContext->bit_rate =
+      int64_t(config.width) * config.height * kSyntheticVideoFrameRate / 10;
+  // The MJPEG encoder only takes full range YUV by default.
+  codecContext->pix_fmt = config.codecName == "mjpeg" ? AV_PIX_FMT_YUVJ420P
+                                                      : AV_PIX_FMT_YUV420P;
+  if (formatContext->oformat->flags & AVFMT_GLOBALHEADER) {
+    codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+  checkFFMPEGStatus(
+      avcodec_open2(codecContext.get(), codec, nullptr), "avcodec_open2");
+
+  AVStream* stream = avformat_new_stream(formatContext.get(), nullptr);
+  TORCH_CHECK(stream != nullptr, "Could not create stream");
+  stream->time_base = codecContext->time_base;
+  checkFFMPEGStatus(
+      avcodec_parameters_from_context(stream->codecpar, codecContext.get()),
+      "avcodec_parameters_from_context");
+  if (!(formatContext->oformat->flags & AVFMT_NOFILE)) {
+    checkFFMPEGStatus(
+        avio_open(&formatContext->pb, path.c_str(), AVIO_FLAG_WRITE),
+        "avio_open");
+  }
+  checkFFMPEGStatus(
+      avformat_write_header(formatContext.get(), nullptr),
+      "avformat_write_header");
+
+  UniqueAVPacket packet(av_packet_alloc());
+  // Sends `frame` (nullptr to flush) and writes the packets it completes.
+  auto encodeFrame = [&](AVFrame* frame) {
+    checkFFMPEGStatus(
+        avcodec_send_frame(codecContext.get(), frame), "avcodec_send_frame");
+    while (true) {
+      int status = avcodec_receive_packet(codecContext.get(), packet.get());
+      if (status == AVERROR(EAGAIN) || status == AVERROR_EOF) {
+        return;
+      }
+      checkFFMPEGStatus(status, "avcodec_receive_packet");
+      av_packet_rescale_ts(
+          packet.get(), codecContext->time_base, stream->time_base);
+      packet->stream_index = stream->index;
+      checkFFMPEGStatus(
+          av_interleaved_write_frame(formatContext.get(), packet.get()),
+          "av_interleaved_write_frame");
+    }
+  };
+  UniqueAVFrame frame(av_frame_alloc());
+  frame->format = codecContext->pix_fmt;
+  frame->width = config.width;
+  frame->height = config.height;
+  checkFFMPEGStatus(av_frame_get_buffer(frame.get(), 0), "av_frame_get_buffer");
+  for (int64_t i = 0; i < kSyntheticVideoNumFrames; ++i) {
+    // The encoder may still reference the previous frame's buffer.
+    checkFFMPEGStatus(
+        av_frame_make_writable(frame.get()), "av_frame_make_writable");
+    drawSyntheticFrame(frame.get(), i);
+    frame->pts = i;
+    encodeFrame(frame.get());
+  }
+  encodeFrame(nullptr);
+  checkFFMPEGStatus(av_write_trailer(formatContext.get()), "av_write_trailer");
+}
+
+// Returns the path of the synthetic video, generating it if it isn't there
+// from a previous run.
+std::string getSyntheticVideoPath(const SyntheticVideoConfig& config) {
+  std::filesystem::path directory = FLAGS_synthetic_video_dir.empty()
+      ? std::filesystem::temp_directory_path() / "torchcodec_benchmark_videos"
+      : std::filesystem::path(FLAGS_synthetic_video_dir);
+  std::filesystem::create_directories(directory);
+  std::filesystem::path path = directory / (config.getName() + ".mkv");
+  if (!std::filesystem::exists(path)) {
+    // Renamed once complete so that an interrupted run doesn't leave a
+    // truncated video behind.
+    std::filesystem::path partialPath = path.string() + ".partial";
+    generateSyntheticVideo(config, partialPath.string());
+    std::filesystem::rename(partialPath, path);
+  }
+  return path.string();
+}
+
+std::vector<SyntheticVideoConfig> getSyntheticVideoConfigs() {
+  std::vector<std::string> codecNames = {"mpeg4", "mpeg2video"};
+  // FFmpeg has no built-in H.264 encoder.
+  if (avcodec_find_encoder_by_name("libx264") != nullptr) {
+    codecNames.push_back("libx264");
+  }
+  std::vector<std::pair<int, int>> resolutions = {{640, 360}, {1920, 1080}};
+  std::vector<SyntheticVideoConfig> configs;
+  for (const auto& [width, height] : resolutions) {
+    for (const std::string& codecName : codecNames) {
+      for (int gopSize : {10, 100}) {
+        configs.push_back({codecName, width, height, gopSize});
+      }
+    }
+    // MJPEG only has key frames.
+    configs.push_back({"mjpeg", width, height, 1});
+  }
+  return configs;
+}
+
+enum class AccessPattern {
+  // Every frame in order with getNextDecodedOutput().
+  SEQUENTIAL,
+  // Single frames with getFrameAtIndex() at increasing, decreasing or random
+  // indexes.
+  FORWARD,
+  BACKWARD,
+  RANDOM,
+  // Batches of random indexes with getFramesAtIndexes(), on one thread or
+  // with batch_decode_threads=0.
+  BATCH,
+  PARALLEL_BATCH,
+  // Random single frames on several threads, each with its own clone of the
+  // decoder.
+  MULTI_THREADED,
+};
+
+std::string getAccessPatternName(AccessPattern accessPattern) {
+  switch (accessPattern) {
+    case AccessPattern::SEQUENTIAL:
+      return "sequential";
+    case AccessPattern::FORWARD:
+      return "forward";
+    case AccessPattern::BACKWARD:
+      return "backward";
+    case AccessPattern::RANDOM:
+      return "random";
+    case AccessPattern::BATCH:
+      return "batch";
+    case AccessPattern::PARALLEL_BATCH:
+      return "parallel_batch";
+    case AccessPattern::MULTI_THREADED:
+      return "multi_threaded";
+  }
+  return "unknown";
+}
+
+constexpr int kNumSeeksPerIteration = 20;
+constexpr int kNumBatchesPerIteration = 4;
+constexpr int kBatchSize = 16;
+
+// Returns the frame indexes of each request of an iteration. Requests are a
+// single frame, except for the batch patterns.
+std::vector<std::vector<int64_t>> getRequestedFrameIndexes(
+    AccessPattern accessPattern,
+    int64_t numFrames,
+    unsigned seed) {
+  std::mt19937 generator(seed);
+  // Distinct random frame indexes.
+  auto sampleFrameIndexes = [&](int count) {
+    std::vector<int64_t> frameIndexes(numFrames);
+    std::iota(frameIndexes.begin(), frameIndexes.end(), 0);
+    std::shuffle(frameIndexes.begin(), frameIndexes.end(), generator);
+    frameIndexes.resize(std::min<int64_t>(count, numFrames));
+    return frameIndexes;
+  };
+  std::vector<std::vector<int64_t>> requests;
+  if (accessPattern == AccessPattern::SEQUENTIAL) {
+    for (int64_t i = 0; i < numFrames; ++i) {
+      requests.push_back({i});
+    }
+  } else if (
+      accessPattern == AccessPattern::BATCH ||
+      accessPattern == AccessPattern::PARALLEL_BATCH) {
+    for (int i = 0; i < kNumBatchesPerIteration; ++i) {
+      requests.push_back(sampleFrameIndexes(kBatchSize));
+    }
+  } else {
+    std::vector<int64_t> frameIndexes =
+        sampleFrameIndexes(kNumSeeksPerIteration);
+    if (accessPattern == AccessPattern::FORWARD) {
+      std::sort(frameIndexes.begin(), frameIndexes.end());
+    } else if (accessPattern == AccessPattern::BACKWARD) {
+      std::sort(frameIndexes.rbegin(), frameIndexes.rend());
+    }
+    for (int64_t frameIndex : frameIndexes) {
+      requests.push_back({frameIndex});
+    }
+  }
+  return requests;
+}
+
+struct MatrixResult {
+  SyntheticVideoConfig video;
+  AccessPattern accessPattern;
+  std::string decoderOptions;
+  int numThreads = 1;
+  int64_t numFramesDecoded = 0;
+  double framesPerSecond = 0;
+  // The latency of each request: a frame, or a batch for the batch patterns.
+  double p50LatencyMicros = 0;
+  double p99LatencyMicros = 0;
+  // The cumulative decode stats of the measured iterations, as returned by
+  // get_decode_stats_json(), one per decoder.
+  std::vector<std::string> decodeStatsJson;
+};
+
+double getPercentile(std::vector<double> values, double percentile) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t index = std::min(
+      values.size() - 1,
+      static_cast<size_t>(percentile / 100 * values.size()));
+  std::nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+MatrixResult runMatrixCase(
+    const SyntheticVideoConfig& video,
+    const std::string& videoPath,
+    AccessPattern accessPattern,
+    const std::string& decoderOptions,
+    int totalIterations,
+    int warmupIterations) {
+  assert(warmupIterations <= totalIterations);
+  MatrixResult result;
+  result.video = video;
+  result.accessPattern = accessPattern;
+  result.decoderOptions = decoderOptions;
+  bool isBatch = accessPattern == AccessPattern::BATCH ||
+      accessPattern == AccessPattern::PARALLEL_BATCH;
+  std::string options = decoderOptions;
+  if (accessPattern == AccessPattern::PARALLEL_BATCH) {
+    options += options.empty() ? "" : ",";
+    options += "batch_decode_threads=0";
+  }
+  if (accessPattern == AccessPattern::MULTI_THREADED) {
+    result.numThreads =
+        std::clamp<int>(std::thread::hardware_concurrency(), 2, 8);
+  }
+
+  // The decoders are wrapped in tensors so that their stats are serialized by
+  // get_decode_stats_json().
+  std::vector<at::Tensor> decoderTensors;
+  decoderTensors.push_back(create_from_file(
+      videoPath,
+      options.empty() ? std::nullopt
+                      : std::optional<c10::string_view>(options)));
+  VideoDecoder* firstDecoder =
+      static_cast<VideoDecoder*>(decoderTensors[0].mutable_data_ptr());
+  firstDecoder->scanFileAndUpdateMetadataAndIndex();
+  VideoDecoder::ContainerMetadata metadata =
+      firstDecoder->getContainerMetadata();
+  int streamIndex = *metadata.bestVideoStreamIndex;
+  int64_t numFrames = *metadata.streams[streamIndex].numFramesFromScan;
+  firstDecoder->addVideoStreamDecoder(
+      streamIndex,
+      FLAGS_matrix_stream_options.empty()
+          ? VideoDecoder::VideoStreamDecoderOptions()
+          : VideoDecoder::VideoStreamDecoderOptions(
+                FLAGS_matrix_stream_options));
+  for (int i = 1; i < result.numThreads; ++i) {
+    decoderTensors.push_back(clone_decoder(decoderTensors[0]));
+  }
+
+  std::vector<std::vector<std::vector<int64_t>>> requestsPerThread;
+  for (int i = 0; i < result.numThreads; ++i) {
+    requestsPerThread.push_back(
+        getRequestedFrameIndexes(accessPattern, numFrames, kRandomSeed + i));
+  }
+  std::vector<std::vector<double>> latenciesPerThread(result.numThreads);
+  auto runRequests = [&](int thread) {
+    VideoDecoder* decoder =
+        static_cast<VideoDecoder*>(decoderTensors[thread].mutable_data_ptr());
+    if (accessPattern == AccessPattern::SEQUENTIAL) {
+      decoder->setCursorPtsInSeconds(0);
+    }
+    for (const std::vector<int64_t>& frameIndexes : requestsPerThread[thread]) {
+      auto start = std::chrono::high_resolution_clock::now();
+      if (accessPattern == AccessPattern::SEQUENTIAL) {
+        decoder->getNextDecodedOutput();
+      } else if (isBatch) {
+        decoder->getFramesAtIndexes(streamIndex, frameIndexes);
+      } else {
+        decoder->getFrameAtIndex(streamIndex, frameIndexes[0]);
+      }
+      auto end = std::chrono::high_resolution_clock::now();
+      latenciesPerThread[thread].push_back(
+          std::chrono::duration<double, std::micro>(end - start).count());
+    }
+  };
+
+  double measuredSeconds = 0;
+  for (int i = 0; i < totalIterations; ++i) {
+    if (i == warmupIterations) {
+      for (at::Tensor& decoderTensor : decoderTensors) {
+        reset_decode_stats(decoderTensor);
+      }
+      for (std::vector<double>& latencies : latenciesPerThread) {
+        latencies.clear();
+      }
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    if (result.numThreads == 1) {
+      runRequests(0);
+    } else {
+      std::vector<std::thread> threads;
+      for (int thread = 0; thread < result.numThreads; ++thread) {
+        threads.emplace_back(runRequests, thread);
+      }
+      for (std::thread& thread : threads) {
+        thread.join();
+      }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    if (i >= warmupIterations) {
+      measuredSeconds += std::chrono::duration<double>(end - start).count();
+      for (const auto& requests : requestsPerThread) {
+        for (const std::vector<int64_t>& frameIndexes : requests) {
+          result.numFramesDecoded += frameIndexes.size();
+        }
+      }
+    }
+  }
+
+  std::vector<double> latencies;
+  for (const std::vector<double>& threadLatencies : latenciesPerThread) {
+    latencies.insert(
+        latencies.end(), threadLatencies.begin(), threadLatencies.end());
+  }
+  result.framesPerSecond =
+      measuredSeconds > 0 ? result.numFramesDecoded / measuredSeconds : 0;
+  result.p50LatencyMicros = getPercentile(latencies, 50);
+  result.p99LatencyMicros = getPercentile(latencies, 99);
+  for (at::Tensor& decoderTensor : decoderTensors) {
+    result.decodeStatsJson.push_back(get_decode_stats_json(decoderTensor));
+  }
+  return result;
+}
+
+std::string quoteJsonString(const std::string& value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+std::string matrixResultsToJson(const std::vector<MatrixResult>& results) {
+  std::stringstream ss;
+  ss << "{\n\"results\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const MatrixResult& result = results[i];
+    ss << "{\n"
+       << "\"video\": " << quoteJsonString(result.video.getName()) << ",\n"
+       << "\"codec\": " << quoteJsonString(result.video.codecName) << ",\n"
+       << "\"width\": " << result.video.width << ",\n"
+       << "\"height\": " << result.video.height << ",\n"
+       << "\"gopSize\": " << result.video.gopSize << ",\n"
+       << "\"accessPattern\": "
+       << quoteJsonString(getAccessPatternName(result.accessPattern)) << ",\n"
+       << "\"decoderOptions\": " << quoteJsonString(result.decoderOptions)
+       << ",\n"
+       << "\"streamOptions\": " << quoteJsonString(FLAGS_matrix_stream_options)
+       << ",\n"
+       << "\"numThreads\": " << result.numThreads << ",\n"
+       << "\"numFramesDecoded\": " << result.numFramesDecoded << ",\n"
+       << "\"framesPerSecond\": " << result.framesPerSecond << ",\n"
+       << "\"p50LatencyMicros\": " << result.p50LatencyMicros << ",\n"
+       << "\"p99LatencyMicros\": " << result.p99LatencyMicros << ",\n"
+       << "\"decodeStats\": [\n";
+    for (size_t j = 0; j < result.decodeStatsJson.size(); ++j) {
+      ss << result.decodeStatsJson[j]
+         << (j + 1 < result.decodeStatsJson.size() ? ",\n" : "\n");
+    }
+    ss << "]\n}" << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  ss << "]\n}\n";
+  return ss.str();
+}
+
+void runBenchmarkMatrix() {
+  std::vector<std::string> decoderOptionsList;
+  std::stringstream optionsStream(FLAGS_matrix_decoder_options);
+  std::string decoderOptions;
+  while (std::getline(optionsStream, decoderOptions, ';')) {
+    decoderOptionsList.push_back(decoderOptions);
+  }
+  if (decoderOptionsList.empty() ||
+      FLAGS_matrix_decoder_options.back() == ';') {
+    decoderOptionsList.push_back("");
+  }
+
+  std::vector<MatrixResult> results;
+  for (const SyntheticVideoConfig& video : getSyntheticVideoConfigs()) {
+    std::string videoPath = getSyntheticVideoPath(video);
+    for (const std::string& options : decoderOptionsList) {
+      for (AccessPattern accessPattern :
+           {AccessPattern::SEQUENTIAL,
+            AccessPattern::FORWARD,
+            AccessPattern::BACKWARD,
+            AccessPattern::RANDOM,
+            AccessPattern::BATCH,
+            AccessPattern::PARALLEL_BATCH,
+            AccessPattern::MULTI_THREADED}) {
+        MatrixResult result = runMatrixCase(
+            video,
+            videoPath,
+            accessPattern,
+            options,
+            FLAGS_matrix_iterations + 1,
+            1);
+        std::cout << "Matrix video=" << video.getName()
+                  << " access=" << getAccessPatternName(accessPattern)
+                  << " options=" << options
+                  << " threads=" << result.numThreads << ": "
+                  << result.framesPerSecond << " frames/s"
+                  << " p50 latency: " << result.p50LatencyMicros << " us"
+                  << " p99 latency: " << result.p99LatencyMicros << " us"
+                  << std::endl;
+        results.push_back(std::move(result));
+      }
+    }
+  }
+  if (!FLAGS_json_output.empty()) {
+    std::ofstream output(FLAGS_json_output);
+    TORCH_CHECK(output, "Could not open ", FLAGS_json_output);
+    output << matrixResultsToJson(results);
+  }
 }
 
 } // namespace facebook::torchcodec
 
-int main() {
-  facebook::torchcodec::runBenchmark();
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_run_resource_benchmarks) {
+    facebook::torchcodec::runBenchmark();
+  }
+  facebook::torchcodec::runBenchmarkMatrix();
   return 0;
 }
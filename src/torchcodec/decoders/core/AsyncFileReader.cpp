@@ -0,0 +1,490 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#include "src/torchcodec/decoders/core/AsyncFileReader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include "torch/types.h"
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+// IORING_OP_READ is an enum value, so we detect the kernel 5.6 headers that
+// define it through IORING_FEAT_RW_CUR_POS, which came with it. Elsewhere, we
+// only build the pread() fallback.
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(__NR_io_uring_setup)
+#define TORCHCODEC_HAS_IO_URING
+#endif
+
+namespace facebook::torchcodec {
+namespace {
+
+#ifdef TORCHCODEC_HAS_IO_URING
+
+// There is no libc wrapper for the io_uring system calls.
+int ioUringSetup(unsigned numEntries, io_uring_params* params) {
+  return syscall(__NR_io_uring_setup, numEntries, params);
+}
+
+int ioUringEnter(
+    int fd,
+    unsigned numToSubmit,
+    unsigned minNumToComplete,
+    unsigned flags) {
+  return syscall(
+      __NR_io_uring_enter,
+      fd,
+      numToSubmit,
+      minNumToComplete,
+      flags,
+      nullptr,
+      0);
+}
+
+void* mapRing(int fd, size_t size, off_t offset) {
+  void* ring = mmap(
+      nullptr,
+      size,
+      PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE,
+      fd,
+      offset);
+  return ring == MAP_FAILED ? nullptr : ring;
+}
+
+unsigned* ringField(void* ring, uint32_t offset) {
+  return reinterpret_cast<unsigned*>(static_cast<char*>(ring) + offset);
+}
+
+#endif // TORCHCODEC_HAS_IO_URING
+
+} // namespace
+
+AsyncFileReader::AsyncFileReader(
+    const std::string& path,
+    int64_t blockSize,
+    int maxNumBlocks)
+    : blockSize_(blockSize), maxNumBlocks_(maxNumBlocks) {
+  TORCH_CHECK(blockSize > 0, "The block size must be > 0");
+  TORCH_CHECK(maxNumBlocks > 0, "The number of blocks must be > 0");
+  fd_ = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd_ < 0) {
+    throw std::invalid_argument(
+        "Could not open input file: " + path + " " + std::strerror(errno));
+  }
+  struct stat fileStat;
+  if (fstat(fd_, &fileStat) != 0) {
+    close(fd_);
+    throw std::invalid_argument("Could not stat input file: " + path);
+  }
+  size_ = fileStat.st_size;
+  setUpRing(maxNumBlocks);
+  stats_.usesIoUring = usesIoUring();
+}
+
+AsyncFileReader::~AsyncFileReader() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // The kernel writes into the blocks until their reads complete.
+  while (numInFlightReads_ > 0 && waitForCompletions(lock)) {
+  }
+  tearDownRing();
+  close(fd_);
+}
+
+void AsyncFileReader::setUpRing(unsigned numEntries) {
+#ifndef TORCHCODEC_HAS_IO_URING
+  VLOG(1) << "This build doesn't support io_uring. Reading the file with "
+          << "pread() instead.";
+#else
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = ioUringSetup(numEntries, &params);
+  if (fd < 0) {
+    VLOG(1) << "io_uring is not available (" << std::strerror(errno)
+            << "). Reading the file with pread() instead.";
+    return;
+  }
+  ring_.fd = fd;
+  ring_.numEntries = params.sq_entries;
+  ring_.sqRingSize =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring_.cqRingSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool isSingleMap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (isSingleMap) {
+    ring_.sqRingSize = ring_.cqRingSize =
+        std::max(ring_.sqRingSize, ring_.cqRingSize);
+  }
+  ring_.sqRing = mapRing(fd, ring_.sqRingSize, IORING_OFF_SQ_RING);
+  ring_.cqRing = isSingleMap
+      ? ring_.sqRing
+      : mapRing(fd, ring_.cqRingSize, IORING_OFF_CQ_RING);
+  ring_.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  ring_.sqes = static_cast<io_uring_sqe*>(
+      mapRing(fd, ring_.sqesSize, IORING_OFF_SQES));
+  if (ring_.sqRing == nullptr || ring_.cqRing == nullptr ||
+      ring_.sqes == nullptr) {
+    VLOG(1) << "Could not map the io_uring queues. Reading the file with "
+            << "pread() instead.";
+    tearDownRing();
+    return;
+  }
+  ring_.sqTail = ringField(ring_.sqRing, params.sq_off.tail);
+  ring_.sqMask = ringField(ring_.sqRing, params.sq_off.ring_mask);
+  ring_.sqArray = ringField(ring_.sqRing, params.sq_off.array);
+  ring_.cqHead = ringField(ring_.cqRing, params.cq_off.head);
+  ring_.cqTail = ringField(ring_.cqRing, params.cq_off.tail);
+  ring_.cqMask = ringField(ring_.cqRing, params.cq_off.ring_mask);
+  ring_.cqes = reinterpret_cast<io_uring_cqe*>(
+      static_cast<char*>(ring_.cqRing) + params.cq_off.cqes);
+#endif
+}
+
+void AsyncFileReader::tearDownRing() {
+  if (ring_.sqes != nullptr) {
+    munmap(ring_.sqes, ring_.sqesSize);
+  }
+  if (ring_.cqRing != nullptr && ring_.cqRing != ring_.sqRing) {
+    munmap(ring_.cqRing, ring_.cqRingSize);
+  }
+  if (ring_.sqRing != nullptr) {
+    munmap(ring_.sqRing, ring_.sqRingSize);
+  }
+  if (ring_.fd >= 0) {
+    close(ring_.fd);
+  }
+  ring_ = Ring();
+}
+
+int64_t
+AsyncFileReader::read(int64_t offset, uint8_t* buffer, int64_t length) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (offset < 0 || offset >= size_ || length <= 0) {
+    return 0;
+  }
+  int64_t blockIndex = offset / blockSize_;
+  bool wasCached = blocks_.count(blockIndex) > 0;
+  std::optional<std::chrono::high_resolution_clock::time_point> waitStart;
+  Block* block = nullptr;
+  while (true) {
+    block = getOrQueueBlock(blockIndex, /*isPrefetch=*/false, lock);
+    if (block == nullptr) {
+      return -EIO;
+    }
+    submitQueuedReads();
+    if (!block->inFlight) {
+      break;
+    }
+    if (!waitStart.has_value()) {
+      stats_.numBlockWaits++;
+      waitStart = std::chrono::high_resolution_clock::now();
+    }
+    // The mutex is released while we wait, so the block may be evicted once
+    // its read completes. We look it up again.
+    if (!waitForBlock(lock)) {
+      return -EIO;
+    }
+  }
+  if (waitStart.has_value()) {
+    stats_.waitMicros += std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::high_resolution_clock::now() -
+                             *waitStart)
+                             .count();
+  } else if (wasCached) {
+    stats_.numBlockHits++;
+  }
+  if (block->error != 0) {
+    int error = block->error;
+    blocks_.erase(blockIndex);
+    return -error;
+  }
+  int64_t start = offset - blockIndex * blockSize_;
+  int64_t numBytes = std::max<int64_t>(
+      std::min(length, block->length - start), 0);
+  memcpy(buffer, block->data.data() + start, numBytes);
+  // Reads are mostly sequential between seeks, so we start reading the next
+  // block while the caller consumes this one. This may evict the current
+  // block, which is why we copied it first.
+  if (usesIoUring() && (blockIndex + 1) * blockSize_ < size_) {
+    getOrQueueBlock(blockIndex + 1, /*isPrefetch=*/true, lock);
+    submitQueuedReads();
+  }
+  return numBytes;
+}
+
+void AsyncFileReader::prefetch(
+    const std::vector<std::pair<int64_t, int64_t>>& ranges) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (const auto& [offset, length] : ranges) {
+    if (!usesIoUring()) {
+#ifdef POSIX_FADV_WILLNEED
+      posix_fadvise(fd_, offset, length, POSIX_FADV_WILLNEED);
+#endif
+      continue;
+    }
+    int64_t end = std::min(offset + length, size_);
+    for (int64_t blockIndex = std::max<int64_t>(offset, 0) / blockSize_;
+         blockIndex * blockSize_ < end;
+         ++blockIndex) {
+      if (getOrQueueBlock(blockIndex, /*isPrefetch=*/true, lock) == nullptr) {
+        break;
+      }
+    }
+  }
+  submitQueuedReads();
+}
+
+AsyncFileReader::Stats AsyncFileReader::getStats() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+AsyncFileReader::Block* AsyncFileReader::getOrQueueBlock(
+    int64_t blockIndex,
+    bool isPrefetch,
+    std::unique_lock<std::mutex>& lock) {
+  // Waiting releases the mutex, so another thread may add the block or take
+  // the free slots in the meantime. We check again after each wait.
+  while (true) {
+    auto it = blocks_.find(blockIndex);
+    if (it != blocks_.end()) {
+      it->second.lastUse = ++useCounter_;
+      return &it->second;
+    }
+    bool isRingFull = usesIoUring() && numInFlightReads_ >= ring_.numEntries;
+    if (!isRingFull && (blocks_.size() < maxNumBlocks_ || maybeEvictBlock())) {
+      break;
+    }
+    if (isPrefetch || !waitForBlock(lock)) {
+      return nullptr;
+    }
+  }
+  Block& block = blocks_[blockIndex];
+  block.data.resize(std::min(blockSize_, size_ - blockIndex * blockSize_));
+  block.lastUse = ++useCounter_;
+  if (usesIoUring()) {
+    queueRead(blockIndex, block);
+    return &block;
+  }
+  // The block can't be evicted while it is in flight, and the threads that
+  // need it wait for readsCompleted_.
+  block.inFlight = true;
+  lock.unlock();
+  readBlockSynchronously(blockIndex, block, 0);
+  lock.lock();
+  block.inFlight = false;
+  stats_.bytesRead += block.length;
+  readsCompleted_.notify_all();
+  return &block;
+}
+
+bool AsyncFileReader::waitForBlock(std::unique_lock<std::mutex>& lock) {
+  if (usesIoUring()) {
+    return waitForCompletions(lock);
+  }
+  // Without io_uring, blocks are in flight while another thread reads them
+  // with pread().
+  readsCompleted_.wait(lock);
+  return true;
+}
+
+bool AsyncFileReader::maybeEvictBlock() {
+  auto leastRecentlyUsed = blocks_.end();
+  for (auto it = blocks_.begin(); it != blocks_.end(); ++it) {
+    if (!it->second.inFlight &&
+        (leastRecentlyUsed == blocks_.end() ||
+         it->second.lastUse < leastRecentlyUsed->second.lastUse)) {
+      leastRecentlyUsed = it;
+    }
+  }
+  if (leastRecentlyUsed == blocks_.end()) {
+    return false;
+  }
+  blocks_.erase(leastRecentlyUsed);
+  return true;
+}
+
+#ifdef TORCHCODEC_HAS_IO_URING
+
+void AsyncFileReader::queueRead(int64_t blockIndex, Block& block) {
+  // We are the only writer of the submission queue tail.
+  unsigned tail = *ring_.sqTail;
+  unsigned index = tail & *ring_.sqMask;
+  io_uring_sqe& sqe = ring_.sqes[index];
+  memset(&sqe, 0, sizeof(sqe));
+  sqe.opcode = IORING_OP_READ;
+  sqe.fd = fd_;
+  sqe.off = blockIndex * blockSize_;
+  sqe.addr = reinterpret_cast<uint64_t>(block.data.data());
+  sqe.len = block.data.size();
+  sqe.user_data = blockIndex;
+  ring_.sqArray[index] = index;
+  __atomic_store_n(ring_.sqTail, tail + 1, __ATOMIC_RELEASE);
+  block.inFlight = true;
+  numQueuedReads_++;
+  numInFlightReads_++;
+  stats_.numReadsSubmitted++;
+}
+
+void AsyncFileReader::submitQueuedReads() {
+  if (numQueuedReads_ == 0) {
+    return;
+  }
+  int numSubmitted = ioUringEnter(ring_.fd, numQueuedReads_, 0, 0);
+  if (numSubmitted > 0) {
+    stats_.numSubmitCalls++;
+    numQueuedReads_ -= numSubmitted;
+  }
+}
+
+bool AsyncFileReader::waitForCompletions(std::unique_lock<std::mutex>& lock) {
+  if (numInFlightReads_ == 0) {
+    if (numSynchronousReads_ == 0) {
+      return false;
+    }
+    // The ring is idle, but another thread is finishing reads with pread().
+    readsCompleted_.wait(lock);
+    return true;
+  }
+  if (isWaitingForCompletions_) {
+    // Another thread is in io_uring_enter() and reaps the completions for
+    // everyone.
+    uint64_t numCompletionWaits = numCompletionWaits_;
+    readsCompleted_.wait(lock, [this, numCompletionWaits]() {
+      return numCompletionWaits_ != numCompletionWaits;
+    });
+    return true;
+  }
+  // The waiting call also submits the reads that are still queued, e.g.
+  // because the last submission failed with EAGAIN. Otherwise it could wait
+  // for reads that the kernel never got.
+  unsigned numToSubmit = numQueuedReads_;
+  isWaitingForCompletions_ = true;
+  lock.unlock();
+  int status = ioUringEnter(
+      ring_.fd, numToSubmit, /*minNumToComplete=*/1, IORING_ENTER_GETEVENTS);
+  int error = errno;
+  lock.lock();
+  isWaitingForCompletions_ = false;
+  numCompletionWaits_++;
+  if (numToSubmit > 0 && status > 0) {
+    stats_.numSubmitCalls++;
+    numQueuedReads_ -= std::min<unsigned>(status, numQueuedReads_);
+  }
+  std::vector<UnfinishedRead> unfinishedReads = reapCompletions();
+  readsCompleted_.notify_all();
+  finishReadsSynchronously(unfinishedReads, lock);
+  if (status < 0 && error != EINTR && error != EAGAIN && error != EBUSY) {
+    VLOG(1) << "io_uring_enter failed: " << std::strerror(error);
+    return false;
+  }
+  return true;
+}
+
+std::vector<AsyncFileReader::UnfinishedRead>
+AsyncFileReader::reapCompletions() {
+  std::vector<UnfinishedRead> unfinishedReads;
+  // We are the only writer of the completion queue head.
+  unsigned head = *ring_.cqHead;
+  unsigned tail = __atomic_load_n(ring_.cqTail, __ATOMIC_ACQUIRE);
+  for (; head != tail; ++head) {
+    const io_uring_cqe& cqe = ring_.cqes[head & *ring_.cqMask];
+    int64_t blockIndex = cqe.user_data;
+    int result = cqe.res;
+    Block& block = blocks_.at(blockIndex);
+    numInFlightReads_--;
+    stats_.numReadsCompleted++;
+    if (result == -EINVAL || result == -EOPNOTSUPP) {
+      // Kernels older than 5.6 don't know IORING_OP_READ.
+      unfinishedReads.push_back({blockIndex, &block, 0});
+    } else if (result < 0) {
+      block.error = -result;
+      block.inFlight = false;
+    } else if (result < static_cast<int64_t>(block.data.size())) {
+      unfinishedReads.push_back({blockIndex, &block, result});
+    } else {
+      block.length = result;
+      block.inFlight = false;
+      stats_.bytesRead += block.length;
+    }
+  }
+  __atomic_store_n(ring_.cqHead, head, __ATOMIC_RELEASE);
+  return unfinishedReads;
+}
+
+#else
+
+// Without io_uring support there is never a ring, so nothing is queued.
+void AsyncFileReader::queueRead(int64_t, Block&) {}
+
+void AsyncFileReader::submitQueuedReads() {}
+
+bool AsyncFileReader::waitForCompletions(std::unique_lock<std::mutex>&) {
+  return false;
+}
+
+std::vector<AsyncFileReader::UnfinishedRead>
+AsyncFileReader::reapCompletions() {
+  return {};
+}
+
+#endif // TORCHCODEC_HAS_IO_URING
+
+void AsyncFileReader::finishReadsSynchronously(
+    const std::vector<UnfinishedRead>& reads,
+    std::unique_lock<std::mutex>& lock) {
+  if (reads.empty()) {
+    return;
+  }
+  // The blocks stay in flight, so they can't be evicted, and the threads that
+  // need them wait for readsCompleted_.
+  numSynchronousReads_ += reads.size();
+  lock.unlock();
+  for (const UnfinishedRead& read : reads) {
+    readBlockSynchronously(read.blockIndex, *read.block, read.start);
+  }
+  lock.lock();
+  for (const UnfinishedRead& read : reads) {
+    read.block->inFlight = false;
+    stats_.bytesRead += read.block->length;
+  }
+  numSynchronousReads_ -= reads.size();
+  readsCompleted_.notify_all();
+}
+
+void AsyncFileReader::readBlockSynchronously(
+    int64_t blockIndex,
+    Block& block,
+    int64_t start) {
+  block.length = start;
+  while (block.length < static_cast<int64_t>(block.data.size())) {
+    ssize_t numBytes = pread(
+        fd_,
+        block.data.data() + block.length,
+        block.data.size() - block.length,
+        blockIndex * blockSize_ + block.length);
+    if (numBytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (numBytes < 0) {
+      block.error = errno;
+      return;
+    }
+    if (numBytes == 0) {
+      break;
+    }
+    block.length += numBytes;
+  }
+}
+
+} // namespace facebook::torchcodec
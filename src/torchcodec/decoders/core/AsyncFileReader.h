@@ -0,0 +1,168 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace facebook::torchcodec {
+
+// Reads a local file in fixed size blocks through a Linux io_uring. The reads
+// of several upcoming byte ranges are submitted with a single system call and
+// complete in the background while the caller decodes. Completed blocks are
+// kept in a small least recently used cache that serves the caller's reads.
+//
+// If the kernel doesn't provide io_uring (or a seccomp policy forbids it), or
+// we aren't built on Linux with kernel 5.6+ headers, blocks are read
+// synchronously with pread() and prefetches become posix_fadvise() hints.
+//
+// All methods are thread safe. The mutex is released while waiting for I/O:
+// one thread at a time waits in io_uring_enter() and reaps the completions
+// for the others, and pread() runs without the mutex, so threads that hit the
+// cache aren't blocked by a thread waiting for the disk.
+class AsyncFileReader {
+ public:
+  // Throws std::invalid_argument if the file can't be opened.
+  explicit AsyncFileReader(
+      const std::string& path,
+      int64_t blockSize = 256 * 1024,
+      int maxNumBlocks = 64);
+  ~AsyncFileReader();
+  AsyncFileReader(const AsyncFileReader&) = delete;
+  AsyncFileReader& operator=(const AsyncFileReader&) = delete;
+
+  int64_t size() const {
+    return size_;
+  }
+
+  // Copies up to `length` bytes at `offset` into `buffer`, waiting for the
+  // block that holds them if needed. Returns the number of bytes copied,
+  // which is 0 at the end of the file, or a negative errno. Never copies past
+  // the end of a block.
+  int64_t read(int64_t offset, uint8_t* buffer, int64_t length);
+
+  // Submits, in a single batch, reads for the blocks of the
+  // (offset, length) ranges that are neither cached nor being read. Blocks
+  // that don't fit in the cache without evicting a block being read are
+  // skipped.
+  void prefetch(const std::vector<std::pair<int64_t, int64_t>>& ranges);
+
+  struct Stats {
+    bool usesIoUring = false;
+    // The number of io_uring_enter() calls that submitted reads, and the
+    // number of reads they submitted. Prefetches submit many reads per call.
+    int64_t numSubmitCalls = 0;
+    int64_t numReadsSubmitted = 0;
+    int64_t numReadsCompleted = 0;
+    // Calls to read() served by a block that was already read, and calls
+    // that had to wait for their block, and for how long in total.
+    int64_t numBlockHits = 0;
+    int64_t numBlockWaits = 0;
+    int64_t waitMicros = 0;
+    int64_t bytesRead = 0;
+  };
+  Stats getStats() const;
+
+ private:
+  struct Block {
+    std::vector<uint8_t> data;
+    // The number of valid bytes in data once the block is read.
+    int64_t length = 0;
+    bool inFlight = false;
+    // The errno of a failed read.
+    int error = 0;
+    uint64_t lastUse = 0;
+  };
+  // The submission and completion queues we share with the kernel.
+  struct Ring {
+    int fd = -1;
+    unsigned numEntries = 0;
+    void* sqRing = nullptr;
+    size_t sqRingSize = 0;
+    void* cqRing = nullptr;
+    size_t cqRingSize = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+  };
+  // A block whose io_uring read came back short, or isn't supported by the
+  // kernel. It stays in flight until the rest, from `start` on, is read with
+  // pread().
+  struct UnfinishedRead {
+    int64_t blockIndex = 0;
+    Block* block = nullptr;
+    int64_t start = 0;
+  };
+  void setUpRing(unsigned numEntries);
+  void tearDownRing();
+  bool usesIoUring() const {
+    return ring_.fd >= 0;
+  }
+  // Returns the block, after queueing its read if it wasn't cached. If the
+  // cache or the ring are full, a prefetch returns nullptr while a read waits
+  // for a slot. Without io_uring, the block is read before returning, with
+  // `lock` released.
+  Block* getOrQueueBlock(
+      int64_t blockIndex,
+      bool isPrefetch,
+      std::unique_lock<std::mutex>& lock);
+  // Waits, with `lock` released, until a block that is in flight completes.
+  // Returns false if the ring failed.
+  bool waitForBlock(std::unique_lock<std::mutex>& lock);
+  // Evicts the least recently used block that is not being read. Returns
+  // false if there is none.
+  bool maybeEvictBlock();
+  void queueRead(int64_t blockIndex, Block& block);
+  void submitQueuedReads();
+  // Submits the queued reads and waits, with `lock` released, for at least
+  // one read to complete. Returns false if the ring failed.
+  bool waitForCompletions(std::unique_lock<std::mutex>& lock);
+  // Marks the blocks of the completed reads as read, except those returned,
+  // which need finishReadsSynchronously().
+  std::vector<UnfinishedRead> reapCompletions();
+  // Reads the rest of the blocks of `reads` with `lock` released.
+  void finishReadsSynchronously(
+      const std::vector<UnfinishedRead>& reads,
+      std::unique_lock<std::mutex>& lock);
+  // Reads block.data from `start` on with pread(). Only touches `block`, so
+  // it may run without the mutex while the block is in flight.
+  void readBlockSynchronously(int64_t blockIndex, Block& block, int64_t start);
+
+  int fd_ = -1;
+  int64_t size_ = 0;
+  int64_t blockSize_;
+  size_t maxNumBlocks_;
+  mutable std::mutex mutex_;
+  std::unordered_map<int64_t, Block> blocks_;
+  uint64_t useCounter_ = 0;
+  // Reads that are in the submission queue but not submitted yet.
+  unsigned numQueuedReads_ = 0;
+  unsigned numInFlightReads_ = 0;
+  // Reads that completed in the ring and are being finished with pread().
+  size_t numSynchronousReads_ = 0;
+  // Notified when reads complete.
+  std::condition_variable readsCompleted_;
+  // Whether a thread is waiting in io_uring_enter(), and how many such waits
+  // have ended.
+  bool isWaitingForCompletions_ = false;
+  uint64_t numCompletionWaits_ = 0;
+  Ring ring_;
+  Stats stats_;
+};
+
+} // namespace facebook::torchcodec
@@ -2,6 +2,8 @@
 
 #include "src/torchcodec/decoders/core/FFMPEGCommon.h"
 
+#include "src/torchcodec/decoders/core/AsyncFileReader.h"
+
 namespace facebook::torchcodec {
 
 std::string getFFMPEGErrorStringFromErrorCode(int errorCode) {
@@ -10,6 +12,98 @@ std::string getFFMPEGErrorStringFromErrorCode(int errorCode) {
   return std::string(errorBuffer);
 }
 
+int getNumIndexEntries(AVStream* stream) {
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 78, 100)
+  return stream->nb_index_entries;
+#else
+  return avformat_index_get_entries_count(stream);
+#endif
+}
+
+const AVIndexEntry* getIndexEntry(AVStream* stream, int index) {
+#if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(58, 78, 100)
+  return &stream->index_entries[index];
+#else
+  return avformat_index_get_entry(stream, index);
+#endif
+}
+
+int getNumChannels(const AVFrame* frame) {
+#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(57, 28, 100)
+  return frame->channels;
+#else
+  return frame->ch_layout.nb_channels;
+#endif
+}
+
+int getNumChannels(const AVCodecParameters* codecParameters) {
+#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(57, 28, 100)
+  return codecParameters->channels;
+#else
+  return codecParameters->ch_layout.nb_channels;
+#endif
+}
+
+UniqueSwrContext createSwrContext(
+    const AVFrame* frame,
+    int outputSampleRate,
+    int outputNumChannels) {
+  SwrContext* swrContext = nullptr;
+#if LIBAVUTIL_VERSION_INT < AV_VERSION_INT(57, 28, 100)
+  // Frames of unknown layout are remixed as if they had the default one.
+  int64_t inputLayout = frame->channel_layout != 0
+      ? frame->channel_layout
+      : av_get_default_channel_layout(frame->channels);
+  swrContext = swr_alloc_set_opts(
+      nullptr,
+      av_get_default_channel_layout(outputNumChannels),
+      AV_SAMPLE_FMT_FLTP,
+      outputSampleRate,
+      inputLayout,
+      static_cast<AVSampleFormat>(frame->format),
+      frame->sample_rate,
+      0,
+      nullptr);
+#else
+  AVChannelLayout inputLayout;
+  if (frame->ch_layout.order == AV_CHANNEL_ORDER_UNSPEC) {
+    av_channel_layout_default(&inputLayout, frame->ch_layout.nb_channels);
+  } else {
+    av_channel_layout_copy(&inputLayout, &frame->ch_layout);
+  }
+  AVChannelLayout outputLayout;
+  av_channel_layout_default(&outputLayout, outputNumChannels);
+  int ffmpegStatus = swr_alloc_set_opts2(
+      &swrContext,
+      &outputLayout,
+      AV_SAMPLE_FMT_FLTP,
+      outputSampleRate,
+      &inputLayout,
+      static_cast<AVSampleFormat>(frame->format),
+      frame->sample_rate,
+      0,
+      nullptr);
+  av_channel_layout_uninit(&inputLayout);
+  av_channel_layout_uninit(&outputLayout);
+  if (ffmpegStatus < 0) {
+    throw std::runtime_error(
+        "Failed to create SwrContext: " +
+        getFFMPEGErrorStringFromErrorCode(ffmpegStatus));
+  }
+#endif
+  if (swrContext == nullptr) {
+    throw std::runtime_error("Failed to create SwrContext");
+  }
+  UniqueSwrContext result(swrContext);
+  int initStatus = swr_init(swrContext);
+  if (initStatus < 0) {
+    throw std::runtime_error(
+        "Failed to initialize SwrContext: " +
+        getFFMPEGErrorStringFromErrorCode(initStatus));
+  }
+  return result;
+}
+
 AVIOBytesContext::AVIOBytesContext(
     const void* data,
     size_t data_size,
@@ -79,4 +173,77 @@ int64_t AVIOBytesContext::seek(void* opaque, int64_t offset, int whence) {
   return ret;
 }
 
+AVIOFileContext::AVIOFileContext(
+    const std::string& path,
+    size_t tempBufferSize)
+    : AVIOFileContext(
+          std::make_shared<AsyncFileReader>(path),
+          tempBufferSize) {}
+
+AVIOFileContext::AVIOFileContext(
+    std::shared_ptr<AsyncFileReader> reader,
+    size_t tempBufferSize)
+    : reader_(std::move(reader)) {
+  auto buffer = static_cast<uint8_t*>(av_malloc(tempBufferSize));
+  if (!buffer) {
+    throw std::runtime_error(
+        "Failed to allocate buffer of size " + std::to_string(tempBufferSize));
+  }
+  avioContext_.reset(avio_alloc_context(
+      buffer,
+      tempBufferSize,
+      0,
+      this,
+      &AVIOFileContext::read,
+      nullptr,
+      &AVIOFileContext::seek));
+  if (!avioContext_) {
+    av_freep(&buffer);
+    throw std::runtime_error("Failed to allocate AVIOContext");
+  }
+}
+
+AVIOFileContext::~AVIOFileContext() {
+  if (avioContext_) {
+    av_freep(&avioContext_->buffer);
+  }
+}
+
+AVIOContext* AVIOFileContext::getAVIO() {
+  return avioContext_.get();
+}
+
+const std::shared_ptr<AsyncFileReader>& AVIOFileContext::getReader() {
+  return reader_;
+}
+
+// The signature of this function is defined by FFMPEG.
+int AVIOFileContext::read(void* opaque, uint8_t* buf, int buf_size) {
+  auto fileContext = static_cast<AVIOFileContext*>(opaque);
+  int64_t numBytes =
+      fileContext->reader_->read(fileContext->current_, buf, buf_size);
+  if (numBytes < 0) {
+    return AVERROR(-numBytes);
+  }
+  if (numBytes == 0) {
+    return AVERROR_EOF;
+  }
+  fileContext->current_ += numBytes;
+  return numBytes;
+}
+
+// The signature of this function is defined by FFMPEG.
+int64_t AVIOFileContext::seek(void* opaque, int64_t offset, int whence) {
+  auto fileContext = static_cast<AVIOFileContext*>(opaque);
+  switch (whence) {
+    case AVSEEK_SIZE:
+      return fileContext->reader_->size();
+    case SEEK_SET:
+      fileContext->current_ = offset;
+      return offset;
+    default:
+      return -1;
+  }
+}
+
 } // namespace facebook::torchcodec
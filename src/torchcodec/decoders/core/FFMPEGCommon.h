@@ -19,6 +19,7 @@ extern "C" {
 #include <libavutil/pixfmt.h>
 #include <libavutil/version.h>
 #include <libswresample/swresample.h>
+#include <libswscale/swscale.h>
 }
 
 namespace facebook::torchcodec {
@@ -35,6 +36,16 @@ struct Deleterp {
   }
 };
 
+// Same as Deleterp, for the delete functions that take the pointer itself.
+template <typename T, typename R, R (*Fn)(T*)>
+struct Deleter {
+  inline void operator()(T* p) const {
+    if (p) {
+      Fn(p);
+    }
+  }
+};
+
 // Unique pointers for FFMPEG structures.
 using UniqueAVFormatContext = std::unique_ptr<
     AVFormatContext,
@@ -54,6 +65,10 @@ using UniqueAVFilterInOut = std::unique_ptr<
     Deleterp<AVFilterInOut, void, avfilter_inout_free>>;
 using UniqueAVIOContext = std::
     unique_ptr<AVIOContext, Deleterp<AVIOContext, void, avio_context_free>>;
+using UniqueSwsContext =
+    std::unique_ptr<SwsContext, Deleter<SwsContext, void, sws_freeContext>>;
+using UniqueSwrContext =
+    std::unique_ptr<SwrContext, Deleterp<SwrContext, void, swr_free>>;
 #ifdef FFMPEG_VERSION_4
 using AVCodecPtr = AVCodec*;
 #else
@@ -67,6 +82,25 @@ const int AVSUCCESS = 0;
 // Returns the FFMPEG error as a string using the provided `errorCode`.
 std::string getFFMPEGErrorStringFromErrorCode(int errorCode);
 
+// Accessors for the index entries of an AVStream. Older FFMPEG versions only
+// expose them as fields of the AVStream.
+int getNumIndexEntries(AVStream* stream);
+const AVIndexEntry* getIndexEntry(AVStream* stream, int index);
+
+// Accessors for the number of audio channels. FFMPEG 5.1 replaced the channel
+// layout masks with AVChannelLayout.
+int getNumChannels(const AVFrame* frame);
+int getNumChannels(const AVCodecParameters* codecParameters);
+
+// Returns an initialized resampler that converts audio frames with the sample
+// format, sample rate and channel layout of `frame` into planar float samples
+// at `outputSampleRate`, in the default layout for `outputNumChannels` (e.g.
+// mono, which downmixes).
+UniqueSwrContext createSwrContext(
+    const AVFrame* frame,
+    int outputSampleRate,
+    int outputNumChannels);
+
 // A struct that holds state for reading bytes from an IO context.
 // We give this to FFMPEG and it will pass it back to us when it needs to read
 // or seek in the memory buffer.
@@ -97,4 +131,36 @@ class AVIOBytesContext {
   struct AVIOBufferData bufferData_;
 };
 
+class AsyncFileReader;
+
+// A class that can be used as AVFormatContext's IO context. It reads a local
+// file through an AsyncFileReader, so that the blocks the caller will need can
+// be prefetched with io_uring.
+class AVIOFileContext {
+ public:
+  AVIOFileContext(const std::string& path, size_t tempBufferSize);
+  // Reads through a reader that other contexts may share. Each context keeps
+  // its own position.
+  AVIOFileContext(
+      std::shared_ptr<AsyncFileReader> reader,
+      size_t tempBufferSize);
+  ~AVIOFileContext();
+
+  // Returns the AVIOContext that can be passed to FFMPEG.
+  AVIOContext* getAVIO();
+
+  const std::shared_ptr<AsyncFileReader>& getReader();
+
+  // The signature of this function is defined by FFMPEG.
+  static int read(void* opaque, uint8_t* buf, int buf_size);
+
+  // The signature of this function is defined by FFMPEG.
+  static int64_t seek(void* opaque, int64_t offset, int whence);
+
+ private:
+  std::shared_ptr<AsyncFileReader> reader_;
+  int64_t current_ = 0;
+  UniqueAVIOContext avioContext_;
+};
+
 } // namespace facebook::torchcodec
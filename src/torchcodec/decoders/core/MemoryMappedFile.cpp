@@ -0,0 +1,103 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#include "src/torchcodec/decoders/core/MemoryMappedFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+namespace facebook::torchcodec {
+
+MemoryMappedFile::MemoryMappedFile(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::invalid_argument(
+        "Could not open input file: " + path + " " + std::strerror(errno));
+  }
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0) {
+    close(fd);
+    throw std::invalid_argument("Could not stat input file: " + path);
+  }
+  size_ = fileStat.st_size;
+  data_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping keeps its own reference to the file.
+  close(fd);
+  if (data_ == MAP_FAILED) {
+    data_ = nullptr;
+    throw std::invalid_argument(
+        "Could not map input file: " + path + " " + std::strerror(errno));
+  }
+}
+
+MemoryMappedFile::~MemoryMappedFile() {
+  if (data_ != nullptr) {
+    munmap(data_, size_);
+  }
+}
+
+MemoryMappedFile::ScopedAccessPattern::ScopedAccessPattern(
+    MemoryMappedFile* file,
+    AccessPattern accessPattern)
+    : file_(file), accessPattern_(accessPattern) {
+  if (file_ != nullptr) {
+    file_->updateAccessPattern(accessPattern_, 1);
+  }
+}
+
+MemoryMappedFile::ScopedAccessPattern::~ScopedAccessPattern() {
+  if (file_ != nullptr) {
+    file_->updateAccessPattern(accessPattern_, -1);
+  }
+}
+
+void MemoryMappedFile::updateAccessPattern(
+    AccessPattern accessPattern,
+    int delta) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (accessPattern == AccessPattern::SEQUENTIAL) {
+    numSequentialScopes_ += delta;
+  } else if (accessPattern == AccessPattern::RANDOM) {
+    numRandomScopes_ += delta;
+  }
+  AccessPattern newAccessPattern = AccessPattern::NORMAL;
+  if (numSequentialScopes_ > 0 && numRandomScopes_ == 0) {
+    newAccessPattern = AccessPattern::SEQUENTIAL;
+  } else if (numRandomScopes_ > 0 && numSequentialScopes_ == 0) {
+    newAccessPattern = AccessPattern::RANDOM;
+  }
+  if (newAccessPattern == accessPattern_) {
+    return;
+  }
+  accessPattern_ = newAccessPattern;
+  int advice = MADV_NORMAL;
+  if (accessPattern_ == AccessPattern::SEQUENTIAL) {
+    advice = MADV_SEQUENTIAL;
+  } else if (accessPattern_ == AccessPattern::RANDOM) {
+    advice = MADV_RANDOM;
+  }
+  // Hints are best effort: a failure only costs performance.
+  madvise(data_, size_, advice);
+}
+
+void MemoryMappedFile::adviseWillNeed(int64_t offset, int64_t length) {
+  offset = std::clamp<int64_t>(offset, 0, size_);
+  length = std::min(length, size_ - offset);
+  if (length <= 0) {
+    return;
+  }
+  // madvise() needs a page aligned address.
+  static const int64_t pageSize = sysconf(_SC_PAGESIZE);
+  int64_t alignedOffset = offset - offset % pageSize;
+  madvise(
+      static_cast<char*>(data_) + alignedOffset,
+      length + offset - alignedOffset,
+      MADV_WILLNEED);
+}
+
+} // namespace facebook::torchcodec
@@ -0,0 +1,66 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace facebook::torchcodec {
+
+// A read-only shared mapping of a whole file. Since the mapping is backed by
+// the page cache, processes that map the same file (e.g. DataLoader workers)
+// share its pages instead of each holding a private copy.
+//
+// All methods are thread safe, so decoder clones can share a mapping.
+class MemoryMappedFile {
+ public:
+  // Throws std::invalid_argument if the file can't be opened or mapped.
+  explicit MemoryMappedFile(const std::string& path);
+  ~MemoryMappedFile();
+  MemoryMappedFile(const MemoryMappedFile&) = delete;
+  MemoryMappedFile& operator=(const MemoryMappedFile&) = delete;
+
+  const void* data() const {
+    return data_;
+  }
+  int64_t size() const {
+    return size_;
+  }
+
+  // Hints passed to the kernel through madvise(). They only change how the
+  // kernel reads ahead and evicts pages, never what is read.
+  enum class AccessPattern { NORMAL, SEQUENTIAL, RANDOM };
+  // Advises an access pattern for its lifetime. Decoders and their clones
+  // share the mapping from several threads, so the advice is counted: the
+  // kernel gets a pattern while all the scopes alive agree on it, and NORMAL
+  // otherwise. Does nothing if `file` is null.
+  class ScopedAccessPattern {
+   public:
+    ScopedAccessPattern(MemoryMappedFile* file, AccessPattern accessPattern);
+    ~ScopedAccessPattern();
+    ScopedAccessPattern(const ScopedAccessPattern&) = delete;
+    ScopedAccessPattern& operator=(const ScopedAccessPattern&) = delete;
+
+   private:
+    MemoryMappedFile* file_;
+    AccessPattern accessPattern_;
+  };
+  // Asks the kernel to start reading [offset, offset + length) into the page
+  // cache.
+  void adviseWillNeed(int64_t offset, int64_t length);
+
+ private:
+  // Adds `delta` to the number of scopes that advise `accessPattern`, and
+  // updates the kernel's advice if it changed.
+  void updateAccessPattern(AccessPattern accessPattern, int delta);
+
+  void* data_ = nullptr;
+  int64_t size_ = 0;
+  std::mutex mutex_;
+  int numSequentialScopes_ = 0;
+  int numRandomScopes_ = 0;
+  AccessPattern accessPattern_ = AccessPattern::NORMAL;
+};
+
+} // namespace facebook::torchcodec
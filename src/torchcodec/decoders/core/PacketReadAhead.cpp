@@ -0,0 +1,131 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#include "src/torchcodec/decoders/core/PacketReadAhead.h"
+
+#include <chrono>
+#include "torch/types.h"
+
+namespace facebook::torchcodec {
+namespace {
+
+// Waits until isReady() returns true. A packet or slot that is about to
+// arrive is picked up by yielding a few times, and after that the thread
+// parks until it is notified, so that a full or empty ring doesn't burn a
+// core.
+//
+// isParked and the positions that isReady() loads are sequentially
+// consistent: either the notifying side sees isParked, or isReady() sees its
+// update before parking.
+template <typename Predicate>
+void waitUntil(
+    std::mutex& mutex,
+    std::condition_variable& condition,
+    std::atomic<bool>& isParked,
+    Predicate isReady) {
+  constexpr int kNumYieldsBeforeParking = 64;
+  for (int i = 0; i < kNumYieldsBeforeParking; ++i) {
+    if (isReady()) {
+      return;
+    }
+    std::this_thread::yield();
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  isParked = true;
+  condition.wait(lock, isReady);
+  isParked = false;
+}
+
+void notifyIfParked(
+    std::mutex& mutex,
+    std::condition_variable& condition,
+    const std::atomic<bool>& isParked) {
+  if (isParked) {
+    // Taking the lock makes sure the other side is waiting, not between its
+    // last check and the wait.
+    std::lock_guard<std::mutex> lock(mutex);
+    condition.notify_one();
+  }
+}
+
+} // namespace
+
+PacketReadAhead::PacketReadAhead(
+    AVFormatContext* formatContext,
+    const std::set<int>& streamIndices,
+    int capacity)
+    : formatContext_(formatContext),
+      streamIndices_(streamIndices),
+      slots_(capacity) {
+  TORCH_CHECK(capacity > 0, "The read-ahead capacity must be > 0");
+  for (Slot& slot : slots_) {
+    slot.packet.reset(av_packet_alloc());
+    TORCH_CHECK(slot.packet != nullptr, "Could not allocate a packet");
+  }
+  thread_ = std::thread([this]() { run(); });
+}
+
+PacketReadAhead::~PacketReadAhead() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  notFull_.notify_one();
+  thread_.join();
+}
+
+void PacketReadAhead::run() {
+  while (true) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    waitUntil(mutex_, notFull_, isReaderParked_, [this, tail]() {
+      return stopping_ || tail - head_ < slots_.size();
+    });
+    if (stopping_) {
+      return;
+    }
+    Slot& slot = slots_[tail % slots_.size()];
+    av_packet_unref(slot.packet.get());
+    slot.status = av_read_frame(formatContext_, slot.packet.get());
+    if (slot.status == AVSUCCESS &&
+        streamIndices_.count(slot.packet->stream_index) == 0) {
+      continue;
+    }
+    if (slot.status == AVSUCCESS) {
+      bytesBuffered_ += slot.packet->size;
+    }
+    tail_ = tail + 1;
+    notifyIfParked(mutex_, notEmpty_, isCallerParked_);
+    if (slot.status != AVSUCCESS) {
+      // The caller gets the error from this slot, which is never consumed.
+      return;
+    }
+  }
+}
+
+int PacketReadAhead::readPacket(AVPacket* packet, ReadStats& stats) {
+  uint64_t head = head_.load(std::memory_order_relaxed);
+  uint64_t tail = tail_.load(std::memory_order_acquire);
+  stats = ReadStats{};
+  if (tail == head) {
+    auto start = std::chrono::high_resolution_clock::now();
+    waitUntil(mutex_, notEmpty_, isCallerParked_, [this, head]() {
+      return tail_ != head;
+    });
+    tail = tail_;
+    stats.stallMicros = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::high_resolution_clock::now() - start)
+                            .count();
+  }
+  stats.queueDepth = tail - head;
+  stats.bytesBuffered = bytesBuffered_.load();
+  Slot& slot = slots_[head % slots_.size()];
+  if (slot.status != AVSUCCESS) {
+    return slot.status;
+  }
+  bytesBuffered_ -= slot.packet->size;
+  av_packet_move_ref(packet, slot.packet.get());
+  head_ = head + 1;
+  notifyIfParked(mutex_, notFull_, isReaderParked_);
+  return AVSUCCESS;
+}
+
+} // namespace facebook::torchcodec
@@ -0,0 +1,78 @@
+// (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "src/torchcodec/decoders/core/FFMPEGCommon.h"
+
+namespace facebook::torchcodec {
+
+// Reads the packets of a set of streams on a background thread into a bounded
+// single-producer single-consumer ring, so that I/O overlaps with decoding.
+// Packets go through the ring without locking. When the ring is full (or
+// empty), the reading thread (or the caller) parks on a condition variable
+// until the other side makes room (or adds a packet).
+//
+// While a PacketReadAhead exists, it owns the read position of the
+// AVFormatContext: nothing else may read from it or seek in it. To seek,
+// destroy the PacketReadAhead (which drops the packets that were read ahead),
+// seek, and create a new one.
+class PacketReadAhead {
+ public:
+  PacketReadAhead(
+      AVFormatContext* formatContext,
+      const std::set<int>& streamIndices,
+      int capacity);
+  ~PacketReadAhead();
+  PacketReadAhead(const PacketReadAhead&) = delete;
+  PacketReadAhead& operator=(const PacketReadAhead&) = delete;
+
+  struct ReadStats {
+    // The number of packets in the queue when the packet was taken out,
+    // including that packet.
+    int64_t queueDepth = 0;
+    // The size in bytes of those packets.
+    int64_t bytesBuffered = 0;
+    // How long the caller waited for the packet because the queue was empty.
+    int64_t stallMicros = 0;
+  };
+  // Same contract as av_read_frame(): moves the next packet into `packet` and
+  // returns AVSUCCESS, or returns the error that stopped the read-ahead (e.g.
+  // AVERROR_EOF) on this and every later call.
+  int readPacket(AVPacket* packet, ReadStats& stats);
+
+ private:
+  struct Slot {
+    UniqueAVPacket packet;
+    int status = AVSUCCESS;
+  };
+  void run();
+
+  AVFormatContext* formatContext_;
+  std::set<int> streamIndices_;
+  std::vector<Slot> slots_;
+  // head_ and tail_ only ever increase. The slot of a position is
+  // slots_[position % slots_.size()]. The reading thread is the only writer
+  // of tail_ and the caller of readPacket() is the only writer of head_.
+  std::atomic<uint64_t> head_{0};
+  std::atomic<uint64_t> tail_{0};
+  std::atomic<int64_t> bytesBuffered_{0};
+  std::atomic<bool> stopping_{false};
+  // Only taken to park and to wake up a parked side. A side only notifies
+  // when the other one is parked.
+  std::mutex mutex_;
+  std::condition_variable notEmpty_;
+  std::condition_variable notFull_;
+  std::atomic<bool> isCallerParked_{false};
+  std::atomic<bool> isReaderParked_{false};
+  std::thread thread_;
+};
+
+} // namespace facebook::torchcodec
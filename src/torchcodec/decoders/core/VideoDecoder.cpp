@@ -1,10 +1,28 @@
 // (c) Meta Platforms, Inc. and affiliates. Confidential and proprietary.
 
 #include "src/torchcodec/decoders/core/VideoDecoder.h"
+#include <ATen/Parallel.h>
+#include <ATen/ThreadLocalState.h>
+#include <ATen/cpu/vec/vec.h>
+#include <ATen/record_function.h>
+#include <unistd.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <set>
 #include <stdexcept>
 #include <string_view>
+#include <thread>
+#include <type_traits>
 #include "torch/types.h"
 
 extern "C" {
@@ -25,12 +43,41 @@ namespace {
 struct AVInput {
   UniqueAVFormatContext formatContext;
   std::unique_ptr<AVIOBytesContext> ioBytesContext;
+  // Only set for DecoderOptions::useMemoryMap. Must outlive the contexts.
+  std::shared_ptr<MemoryMappedFile> memoryMappedFile;
+  // Only set for DecoderOptions::useIoUring.
+  std::unique_ptr<AVIOFileContext> ioFileContext;
 };
 
-AVInput createAVFormatContextFromFilePath(const std::string& videoFilePath) {
+// TODO(ahmads): Add an option to control this size.
+constexpr int kAVIOInternalTemporaryBufferSize = 1024 * 1024;
+
+// How far ahead of an audio stream's cursor a seek target may be before we
+// seek instead of decoding up to it.
+constexpr double kMaxAudioSecondsDecodedInsteadOfSeeking = 5.0;
+
+// How many times getAudioSamplesInRange() seeks further back when decoding
+// resumed after the start of the range.
+constexpr int kMaxAudioSeekRetries = 3;
+
+// The demuxers that can resume from the byte position of any key frame: they
+// resynchronize on their own packet headers and keep no sample tables. Others
+// either ignore byte seeks (e.g. MP4) or lose their timestamps after them.
+constexpr std::array<std::string_view, 2> kByteSeekableFormatNames = {
+    "mpegts",
+    "mpeg"};
+
+// A known `inputFormat` skips probing the input.
+AVInput createAVFormatContextFromFilePath(
+    const std::string& videoFilePath,
+    const AVInputFormat* inputFormat = nullptr) {
   AVFormatContext* formatContext = nullptr;
+  // FFMPEG 4 takes a non-const AVInputFormat.
   if (avformat_open_input(
-          &formatContext, videoFilePath.c_str(), nullptr, nullptr) != 0) {
+          &formatContext,
+          videoFilePath.c_str(),
+          const_cast<AVInputFormat*>(inputFormat),
+          nullptr) != 0) {
     throw std::invalid_argument("Could not open input file: " + videoFilePath);
   }
   TORCH_CHECK(formatContext != nullptr);
@@ -39,32 +86,99 @@ AVInput createAVFormatContextFromFilePath(const std::string& videoFilePath) {
   return toReturn;
 }
 
-AVInput createAVFormatContextFromBuffer(const void* buffer, size_t length) {
-  AVInput toReturn;
-  toReturn.formatContext.reset(avformat_alloc_context());
+// Opens an input that FFMPEG reads through our own AVIOContext.
+UniqueAVFormatContext createAVFormatContextFromAVIO(
+    AVIOContext* avioContext,
+    const std::string& inputDescription,
+    const AVInputFormat* inputFormat = nullptr) {
+  UniqueAVFormatContext formatContext(avformat_alloc_context());
   TORCH_CHECK(
-      toReturn.formatContext.get() != nullptr,
-      "Unable to alloc avformat context");
-  // TODO(ahmads): Add an option to control this size.
-  constexpr int kAVIOInternalTemporaryBufferSize = 1024 * 1024;
+      formatContext.get() != nullptr, "Unable to alloc avformat context");
+  formatContext->pb = avioContext;
+  AVFormatContext* tempFormatContext = formatContext.release();
+  int open_ret = avformat_open_input(
+      &tempFormatContext,
+      nullptr,
+      const_cast<AVInputFormat*>(inputFormat),
+      nullptr);
+  formatContext.reset(tempFormatContext);
+  if (open_ret != 0) {
+    throw std::runtime_error(
+        "Failed to open " + inputDescription + ": " +
+        getFFMPEGErrorStringFromErrorCode(open_ret));
+  }
+  return formatContext;
+}
+
+AVInput createAVFormatContextFromBuffer(
+    const void* buffer,
+    size_t length,
+    const AVInputFormat* inputFormat = nullptr) {
+  AVInput toReturn;
   toReturn.ioBytesContext.reset(
       new AVIOBytesContext(buffer, length, kAVIOInternalTemporaryBufferSize));
   if (!toReturn.ioBytesContext) {
     throw std::runtime_error("Failed to create AVIOBytesContext");
   }
-  toReturn.formatContext->pb = toReturn.ioBytesContext->getAVIO();
-  AVFormatContext* tempFormatContext = toReturn.formatContext.release();
-  int open_ret =
-      avformat_open_input(&tempFormatContext, nullptr, nullptr, nullptr);
-  toReturn.formatContext.reset(tempFormatContext);
-  if (open_ret != 0) {
-    throw std::runtime_error(
-        std::string("Failed to open input buffer: ") +
-        getFFMPEGErrorStringFromErrorCode(open_ret));
-  }
+  toReturn.formatContext = createAVFormatContextFromAVIO(
+      toReturn.ioBytesContext->getAVIO(), "input buffer", inputFormat);
   return toReturn;
 }
 
+AVInput createAVFormatContextFromFilePath(
+    const std::string& videoFilePath,
+    const VideoDecoder::DecoderOptions& options) {
+  if (options.useMemoryMap) {
+    auto memoryMappedFile = std::make_shared<MemoryMappedFile>(videoFilePath);
+    AVInput toReturn = createAVFormatContextFromBuffer(
+        memoryMappedFile->data(), memoryMappedFile->size());
+    toReturn.memoryMappedFile = std::move(memoryMappedFile);
+    return toReturn;
+  }
+  if (options.useIoUring) {
+    AVInput toReturn;
+    toReturn.ioFileContext = std::make_unique<AVIOFileContext>(
+        videoFilePath, kAVIOInternalTemporaryBufferSize);
+    toReturn.formatContext = createAVFormatContextFromAVIO(
+        toReturn.ioFileContext->getAVIO(), "input file " + videoFilePath);
+    return toReturn;
+  }
+  return createAVFormatContextFromFilePath(videoFilePath);
+}
+
+int64_t getMicrosSince(std::chrono::high_resolution_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::high_resolution_clock::now() - start)
+      .count();
+}
+
+void addDecodeStats(
+    VideoDecoder::DecodeStats& total,
+    const VideoDecoder::DecodeStats& stats) {
+  total.numSeeksAttempted += stats.numSeeksAttempted;
+  total.numSeeksDone += stats.numSeeksDone;
+  total.numSeeksSkipped += stats.numSeeksSkipped;
+  total.numPacketsRead += stats.numPacketsRead;
+  total.numPacketsSentToDecoder += stats.numPacketsSentToDecoder;
+  total.numFramesReceivedByDecoder += stats.numFramesReceivedByDecoder;
+  total.numFlushes += stats.numFlushes;
+  total.numByteSeeks += stats.numByteSeeks;
+  total.numFrameCacheHits += stats.numFrameCacheHits;
+  total.numFrameCacheMisses += stats.numFrameCacheMisses;
+  total.maxReadAheadQueueDepth =
+      std::max(total.maxReadAheadQueueDepth, stats.maxReadAheadQueueDepth);
+  total.maxReadAheadBytesBuffered = std::max(
+      total.maxReadAheadBytesBuffered, stats.maxReadAheadBytesBuffered);
+  total.readAheadStallMicros += stats.readAheadStallMicros;
+  total.numFramesDiscarded += stats.numFramesDiscarded;
+  total.seekMicros += stats.seekMicros;
+  total.demuxMicros += stats.demuxMicros;
+  total.sendPacketMicros += stats.sendPacketMicros;
+  total.receiveFrameMicros += stats.receiveFrameMicros;
+  total.conversionMicros += stats.conversionMicros;
+  total.tensorMicros += stats.tensorMicros;
+}
+
 std::vector<std::string> splitStringWithDelimiters(
     const std::string& str,
     const std::string& delims) {
@@ -82,8 +196,777 @@ std::vector<std::string> splitStringWithDelimiters(
   return result;
 }
 
+bool parseBoolOption(const std::string& key, const std::string& value) {
+  if (value == "1" || value == "true") {
+    return true;
+  }
+  if (value == "0" || value == "false") {
+    return false;
+  }
+  throw std::runtime_error(
+      "Invalid " + key + "=" + value + ". " + key +
+      " must be one of 1, 0, true or false.");
+}
+
+// Returns the largest lowres factor supported by `codec` that still decodes
+// frames at least as large as the requested output, or 0 if the output size is
+// not set. Cropped streams keep the full resolution since the crop region is
+// given in pixels of the full resolution frames.
+int getLowresForOutputSize(
+    const AVCodec* codec,
+    int width,
+    int height,
+    const VideoDecoder::VideoStreamDecoderOptions& options) {
+  if (!options.width.has_value() || !options.height.has_value() ||
+      options.crop.has_value()) {
+    return 0;
+  }
+  int lowres = 0;
+  while (lowres < codec->max_lowres &&
+         (width >> (lowres + 1)) >= *options.width &&
+         (height >> (lowres + 1)) >= *options.height) {
+    lowres++;
+  }
+  return lowres;
+}
+
+// Returns true if a codec context opened for `a` can decode a stream with the
+// parameters `b`, and produces frames that the same conversion can handle.
+bool areCodecParametersCompatible(
+    const AVCodecParameters* a,
+    const AVCodecParameters* b) {
+  return a->codec_type == b->codec_type && a->codec_id == b->codec_id &&
+      a->format == b->format && a->width == b->width &&
+      a->height == b->height &&
+      a->sample_aspect_ratio.num == b->sample_aspect_ratio.num &&
+      a->sample_aspect_ratio.den == b->sample_aspect_ratio.den &&
+      a->color_space == b->color_space && a->color_range == b->color_range &&
+      a->extradata_size == b->extradata_size &&
+      (a->extradata_size == 0 ||
+       std::memcmp(a->extradata, b->extradata, a->extradata_size) == 0);
+}
+
+// Bump this whenever the layout of the index cache file changes so that stale
+// cache files are ignored instead of being misread.
+constexpr uint32_t kIndexCacheVersion = 2;
+constexpr char kIndexCacheMagic[8] = {'T', 'C', 'I', 'D', 'X', 0, 0, 0};
+// The size of a frame in the cache file: its pts, dts, duration, pos and size.
+constexpr uint64_t kIndexCacheFrameInfoBytes = 5 * sizeof(int64_t);
+// The fingerprint covers this many bytes at the start and at the end of the
+// file. This catches in-place rewrites that preserve the size and mtime.
+constexpr size_t kIndexCacheFingerprintBytes = 64 * 1024;
+
+// Identifies the exact contents of a video file for the index cache.
+struct VideoFileKey {
+  std::string path;
+  int64_t size = 0;
+  int64_t modificationTime = 0;
+  uint64_t fingerprint = 0;
+
+  bool operator==(const VideoFileKey& other) const {
+    return path == other.path && size == other.size &&
+        modificationTime == other.modificationTime &&
+        fingerprint == other.fingerprint;
+  }
+};
+
+// 64-bit FNV-1a hash.
+uint64_t hashBytes(uint64_t hash, const char* data, size_t length) {
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= static_cast<uint8_t>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+constexpr uint64_t kFnvOffsetBasis = 14695981039346656037ULL;
+
+std::optional<VideoFileKey> getVideoFileKey(const std::string& videoFilePath) {
+  std::error_code errorCode;
+  std::filesystem::path path =
+      std::filesystem::absolute(videoFilePath, errorCode);
+  if (errorCode) {
+    return std::nullopt;
+  }
+  VideoFileKey key;
+  key.path = path.string();
+  key.size = std::filesystem::file_size(path, errorCode);
+  if (errorCode) {
+    return std::nullopt;
+  }
+  key.modificationTime = std::filesystem::last_write_time(path, errorCode)
+                             .time_since_epoch()
+                             .count();
+  if (errorCode) {
+    return std::nullopt;
+  }
+  std::ifstream input(path, std::ios::binary);
+  if (!input) {
+    return std::nullopt;
+  }
+  std::vector<char> buffer(kIndexCacheFingerprintBytes);
+  input.read(buffer.data(), buffer.size());
+  uint64_t fingerprint =
+      hashBytes(kFnvOffsetBasis, buffer.data(), input.gcount());
+  if (key.size > static_cast<int64_t>(2 * kIndexCacheFingerprintBytes)) {
+    input.clear();
+    input.seekg(key.size - kIndexCacheFingerprintBytes);
+    input.read(buffer.data(), buffer.size());
+    fingerprint = hashBytes(fingerprint, buffer.data(), input.gcount());
+  }
+  key.fingerprint = fingerprint;
+  return key;
+}
+
+// Helpers to (de)serialize the index cache. All values are stored in native
+// byte order since the cache is meant to be read back on the same host.
+template <typename T>
+void writeValue(std::ostream& output, const T& value) {
+  output.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::istream& input, T& value) {
+  input.read(reinterpret_cast<char*>(&value), sizeof(T));
+  return static_cast<bool>(input);
+}
+
+void writeString(std::ostream& output, const std::string& value) {
+  writeValue<uint64_t>(output, value.size());
+  output.write(value.data(), value.size());
+}
+
+bool readString(std::istream& input, std::string& value) {
+  uint64_t size = 0;
+  if (!readValue(input, size) || size > (1 << 20)) {
+    return false;
+  }
+  value.resize(size);
+  input.read(value.data(), size);
+  return static_cast<bool>(input);
+}
+
+void writeOptionalInt64(
+    std::ostream& output,
+    const std::optional<int64_t>& value) {
+  writeValue<uint8_t>(output, value.has_value());
+  writeValue<int64_t>(output, value.value_or(0));
+}
+
+bool readOptionalInt64(std::istream& input, std::optional<int64_t>& value) {
+  uint8_t hasValue = 0;
+  int64_t rawValue = 0;
+  if (!readValue(input, hasValue) || !readValue(input, rawValue)) {
+    return false;
+  }
+  value = hasValue ? std::optional<int64_t>(rawValue) : std::nullopt;
+  return true;
+}
+
+void writeVideoFileKey(std::ostream& output, const VideoFileKey& key) {
+  writeString(output, key.path);
+  writeValue(output, key.size);
+  writeValue(output, key.modificationTime);
+  writeValue(output, key.fingerprint);
+}
+
+bool readVideoFileKey(std::istream& input, VideoFileKey& key) {
+  return readString(input, key.path) && readValue(input, key.size) &&
+      readValue(input, key.modificationTime) &&
+      readValue(input, key.fingerprint);
+}
+
+void validatePreAllocatedOutputTensor(
+    const torch::Tensor& tensor,
+    at::IntArrayRef expectedShape,
+    torch::ScalarType expectedDtype) {
+  TORCH_CHECK(
+      tensor.scalar_type() == expectedDtype,
+      "The output tensor must have dtype ",
+      expectedDtype,
+      ", got ",
+      tensor.scalar_type());
+  TORCH_CHECK(tensor.is_contiguous(), "The output tensor must be contiguous");
+  TORCH_CHECK(
+      tensor.sizes() == expectedShape,
+      "Expected an output tensor of shape ",
+      expectedShape,
+      ", got ",
+      tensor.sizes());
+}
+
+AVPixelFormat getPixelFormat(VideoDecoder::OutputFormat outputFormat) {
+  switch (outputFormat) {
+    case VideoDecoder::OutputFormat::RGB24:
+      return AV_PIX_FMT_RGB24;
+    case VideoDecoder::OutputFormat::GRAY:
+      return AV_PIX_FMT_GRAY8;
+    case VideoDecoder::OutputFormat::YUV420P:
+      return AV_PIX_FMT_YUV420P;
+    case VideoDecoder::OutputFormat::NV12:
+      return AV_PIX_FMT_NV12;
+  }
+  return AV_PIX_FMT_NONE;
+}
+
+// The shape of one output frame. See VideoDecoder::OutputFormat.
+std::vector<int64_t> getFrameShape(
+    const VideoDecoder::VideoStreamDecoderOptions& options,
+    int64_t height,
+    int64_t width) {
+  using OutputFormat = VideoDecoder::OutputFormat;
+  if (options.outputFormat == OutputFormat::YUV420P ||
+      options.outputFormat == OutputFormat::NV12) {
+    TORCH_CHECK(
+        height % 2 == 0 && width % 2 == 0,
+        "YUV output formats require an even width and height, got ",
+        width,
+        "x",
+        height);
+    return {height * 3 / 2, width};
+  }
+  int64_t numChannels = options.outputFormat == OutputFormat::GRAY ? 1 : 3;
+  if (options.shape == "NHWC") {
+    return {height, width, numChannels};
+  } else if (options.shape == "NCHW") {
+    return {numChannels, height, width};
+  }
+  throw std::runtime_error("Unsupported frame shape=" + options.shape);
+}
+
+// Returns true if the planes of `frame` can be copied out as they are for
+// `outputFormat`.
+bool hasOutputPixelFormat(
+    const AVFrame* frame,
+    VideoDecoder::OutputFormat outputFormat) {
+  switch (outputFormat) {
+    case VideoDecoder::OutputFormat::RGB24:
+      return false;
+    case VideoDecoder::OutputFormat::GRAY: {
+      // The luma of every 8 bit YUV (or gray) format is a plane of bytes.
+      const AVPixFmtDescriptor* descriptor =
+          av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+      return descriptor != nullptr &&
+          !(descriptor->flags &
+            (AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL |
+             AV_PIX_FMT_FLAG_HWACCEL | AV_PIX_FMT_FLAG_BITSTREAM)) &&
+          descriptor->comp[0].plane == 0 && descriptor->comp[0].step == 1 &&
+          descriptor->comp[0].depth == 8;
+    }
+    case VideoDecoder::OutputFormat::YUV420P:
+      return frame->format == AV_PIX_FMT_YUV420P ||
+          frame->format == AV_PIX_FMT_YUVJ420P;
+    case VideoDecoder::OutputFormat::NV12:
+      return frame->format == AV_PIX_FMT_NV12;
+  }
+  return false;
+}
+
+// Copies the planes of `frame`, which hasOutputPixelFormat() for
+// `outputFormat` or was converted to it, into the packed `output`.
+void copyPlanes(
+    const AVFrame* frame,
+    VideoDecoder::OutputFormat outputFormat,
+    torch::Tensor& output) {
+  uint8_t* destination = output.data_ptr<uint8_t>();
+  auto copyPlane = [&destination, frame](
+                       int plane, int64_t rowSize, int64_t numRows) {
+    for (int64_t row = 0; row < numRows; ++row) {
+      std::memcpy(
+          destination,
+          frame->data[plane] + row * frame->linesize[plane],
+          rowSize);
+      destination += rowSize;
+    }
+  };
+  copyPlane(0, frame->width, frame->height);
+  if (outputFormat == VideoDecoder::OutputFormat::YUV420P) {
+    copyPlane(1, frame->width / 2, frame->height / 2);
+    copyPlane(2, frame->width / 2, frame->height / 2);
+  } else if (outputFormat == VideoDecoder::OutputFormat::NV12) {
+    copyPlane(1, frame->width, frame->height / 2);
+  }
+}
+
+// Returns `preAllocatedOutputTensor` after checking it can hold a frame, or a
+// new tensor.
+torch::Tensor getFrameOutputTensor(
+    const VideoDecoder::VideoStreamDecoderOptions& options,
+    int64_t height,
+    int64_t width,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  std::vector<int64_t> shape = getFrameShape(options, height, width);
+  if (preAllocatedOutputTensor.has_value()) {
+    validatePreAllocatedOutputTensor(
+        *preAllocatedOutputTensor, shape, options.dtype);
+    return *preAllocatedOutputTensor;
+  }
+  return torch::empty(shape, {options.dtype});
+}
+
+// Returns the {width, height} of the frames a stream outputs for decoded
+// frames of `sourceWidth` x `sourceHeight`: the crop region, resized as
+// `options` say.
+std::pair<int, int> getOutputFrameSize(
+    const VideoDecoder::VideoStreamDecoderOptions& options,
+    int sourceWidth,
+    int sourceHeight) {
+  int width = options.crop.has_value() ? options.crop->width : sourceWidth;
+  int height = options.crop.has_value() ? options.crop->height : sourceHeight;
+  switch (options.resizePolicy) {
+    case VideoDecoder::ResizePolicy::EXACT:
+      if (options.width.has_value() && options.height.has_value()) {
+        return {*options.width, *options.height};
+      }
+      return {width, height};
+    case VideoDecoder::ResizePolicy::MIN_SIDE:
+    case VideoDecoder::ResizePolicy::MAX_SIDE: {
+      bool isWidthResized =
+          (width <= height) ==
+          (options.resizePolicy == VideoDecoder::ResizePolicy::MIN_SIDE);
+      double side = options.resizeSide;
+      if (isWidthResized) {
+        return {options.resizeSide, std::lround(side * height / width)};
+      }
+      return {std::lround(side * width / height), options.resizeSide};
+    }
+  }
+  return {width, height};
+}
+
+// Returns a new reference to `frame` whose planes start at the crop region
+// and whose size is the crop region's. No pixels are copied.
+UniqueAVFrame cropFrame(
+    const AVFrame* frame,
+    const VideoDecoder::CropRegion& crop) {
+  TORCH_CHECK(
+      crop.x + crop.width <= frame->width &&
+          crop.y + crop.height <= frame->height,
+      "The crop region ",
+      crop.width,
+      "x",
+      crop.height,
+      " at (",
+      crop.x,
+      ", ",
+      crop.y,
+      ") doesn't fit in the ",
+      frame->width,
+      "x",
+      frame->height,
+      " frame");
+  UniqueAVFrame croppedFrame(av_frame_alloc());
+  TORCH_CHECK(croppedFrame.get() != nullptr);
+  int ffmpegStatus = av_frame_ref(croppedFrame.get(), frame);
+  if (ffmpegStatus < AVSUCCESS) {
+    throw std::runtime_error(
+        "Failed to reference frame: " +
+        getFFMPEGErrorStringFromErrorCode(ffmpegStatus));
+  }
+  croppedFrame->crop_left = crop.x;
+  croppedFrame->crop_top = crop.y;
+  croppedFrame->crop_right = frame->width - crop.x - crop.width;
+  croppedFrame->crop_bottom = frame->height - crop.y - crop.height;
+  // Subsampled chroma planes start at the chroma sample that covers (x, y).
+  ffmpegStatus =
+      av_frame_apply_cropping(croppedFrame.get(), AV_FRAME_CROP_UNALIGNED);
+  if (ffmpegStatus < AVSUCCESS) {
+    throw std::runtime_error(
+        "Failed to crop frame: " +
+        getFFMPEGErrorStringFromErrorCode(ffmpegStatus));
+  }
+  return croppedFrame;
+}
+
+// Mirrors `frame`, an output frame shaped as getFrameShape() says, left to
+// right in place.
+void flipFrameHorizontally(
+    const VideoDecoder::VideoStreamDecoderOptions& options,
+    torch::Tensor& frame) {
+  using OutputFormat = VideoDecoder::OutputFormat;
+  if (options.outputFormat == OutputFormat::RGB24 ||
+      options.outputFormat == OutputFormat::GRAY) {
+    int64_t widthDim = options.shape == "NHWC" ? 1 : 2;
+    frame.copy_(frame.flip({widthDim}));
+    return;
+  }
+  int64_t height = frame.size(0) * 2 / 3;
+  int64_t width = frame.size(1);
+  torch::Tensor luma = frame.narrow(0, 0, height);
+  luma.copy_(luma.flip({1}));
+  torch::Tensor chroma = frame.narrow(0, height, height / 2);
+  if (options.outputFormat == OutputFormat::YUV420P) {
+    chroma = chroma.view({2, height / 2, width / 2});
+    chroma.copy_(chroma.flip({2}));
+  } else {
+    // The U and V samples of a pixel pair stay in order.
+    chroma = chroma.view({height / 2, width / 2, 2});
+    chroma.copy_(chroma.flip({1}));
+  }
+}
+
+int getSwsInterpolationFlag(VideoDecoder::Interpolation interpolation) {
+  switch (interpolation) {
+    case VideoDecoder::Interpolation::NEAREST:
+      return SWS_POINT;
+    case VideoDecoder::Interpolation::BILINEAR:
+      return SWS_BILINEAR;
+    case VideoDecoder::Interpolation::BICUBIC:
+      return SWS_BICUBIC;
+    case VideoDecoder::Interpolation::AREA:
+      return SWS_AREA;
+  }
+  return SWS_BICUBIC;
+}
+
+// The name of the scale filter's flag for `interpolation`.
+const char* getScaleFilterInterpolationName(
+    VideoDecoder::Interpolation interpolation) {
+  switch (interpolation) {
+    case VideoDecoder::Interpolation::NEAREST:
+      return "neighbor";
+    case VideoDecoder::Interpolation::BILINEAR:
+      return "bilinear";
+    case VideoDecoder::Interpolation::BICUBIC:
+      return "bicubic";
+    case VideoDecoder::Interpolation::AREA:
+      return "area";
+  }
+  return "bicubic";
+}
+
+// The scale and bias of each lane of 3 float vectors. 3 vectors hold a whole
+// number of RGB values, so lane j always holds channel j % 3. The scalars are
+// kept for the values past the last whole chunk.
+struct RgbNormalization {
+  using Vec = at::vec::Vectorized<float>;
+  static constexpr int64_t kChunkSize = 3 * Vec::size();
+
+  RgbNormalization(
+      const std::array<float, 3>& scale,
+      const std::array<float, 3>& bias)
+      : scale(scale), bias(bias) {
+    std::array<float, kChunkSize> scales;
+    std::array<float, kChunkSize> biases;
+    for (int64_t i = 0; i < kChunkSize; ++i) {
+      scales[i] = scale[i % 3];
+      biases[i] = bias[i % 3];
+    }
+    for (int k = 0; k < 3; ++k) {
+      scaleVecs[k] = Vec::loadu(scales.data() + k * Vec::size());
+      biasVecs[k] = Vec::loadu(biases.data() + k * Vec::size());
+    }
+  }
+
+  std::array<float, 3> scale;
+  std::array<float, 3> bias;
+  std::array<Vec, 3> scaleVecs;
+  std::array<Vec, 3> biasVecs;
+};
+
+// Writes x * scale + bias for the `n` values x of `source` into
+// `destination`, with the scale and bias of channel i % 3 for value i. A
+// single channel row takes the same path with the same scale and bias for
+// the three channels.
+template <typename T>
+void normalizeRow(
+    const uint8_t* source,
+    int64_t n,
+    const RgbNormalization& normalization,
+    T* destination) {
+  using Vec = RgbNormalization::Vec;
+  constexpr int64_t kChunkSize = RgbNormalization::kChunkSize;
+  std::array<float, kChunkSize> values;
+  int64_t i = 0;
+  for (; i + kChunkSize <= n; i += kChunkSize) {
+    at::vec::convert(source + i, values.data(), kChunkSize);
+    for (int k = 0; k < 3; ++k) {
+      Vec normalized = at::vec::fmadd(
+          Vec::loadu(values.data() + k * Vec::size()),
+          normalization.scaleVecs[k],
+          normalization.biasVecs[k]);
+      if constexpr (std::is_same_v<T, float>) {
+        normalized.store(destination + i + k * Vec::size());
+      } else {
+        normalized.store(values.data() + k * Vec::size());
+      }
+    }
+    if constexpr (!std::is_same_v<T, float>) {
+      at::vec::convert(values.data(), destination + i, kChunkSize);
+    }
+  }
+  for (; i < n; ++i) {
+    destination[i] = static_cast<T>(
+        source[i] * normalization.scale[i % 3] + normalization.bias[i % 3]);
+  }
+}
+
+// Writes the RGB24 image `source` into `destination` as x * scale + bias per
+// channel, channels last or channels first, and mirrored left to right if
+// `isFlipped`. Rows that must be mirrored or split into channels are first
+// rearranged as bytes, so that every row is normalized from contiguous values
+// with at::vec.
+template <typename T>
+void normalizeRgb24(
+    const uint8_t* source,
+    int64_t sourceLinesize,
+    int64_t height,
+    int64_t width,
+    const std::array<float, 3>& scale,
+    const std::array<float, 3>& bias,
+    bool isChannelsFirst,
+    bool isFlipped,
+    T* destination) {
+  RgbNormalization interleaved(scale, bias);
+  std::vector<RgbNormalization> planar;
+  for (int c = 0; c < 3; ++c) {
+    planar.emplace_back(
+        std::array<float, 3>{scale[c], scale[c], scale[c]},
+        std::array<float, 3>{bias[c], bias[c], bias[c]});
+  }
+  std::vector<uint8_t> rowBuffer(width * 3);
+  for (int64_t y = 0; y < height; ++y) {
+    const uint8_t* sourceRow = source + y * sourceLinesize;
+    if (isChannelsFirst) {
+      uint8_t* planes[3] = {
+          rowBuffer.data(),
+          rowBuffer.data() + width,
+          rowBuffer.data() + 2 * width};
+      if (isFlipped) {
+        for (int64_t x = 0; x < width; ++x) {
+          const uint8_t* pixel = sourceRow + (width - 1 - x) * 3;
+          planes[0][x] = pixel[0];
+          planes[1][x] = pixel[1];
+          planes[2][x] = pixel[2];
+        }
+      } else {
+        for (int64_t x = 0; x < width; ++x) {
+          const uint8_t* pixel = sourceRow + x * 3;
+          planes[0][x] = pixel[0];
+          planes[1][x] = pixel[1];
+          planes[2][x] = pixel[2];
+        }
+      }
+      for (int c = 0; c < 3; ++c) {
+        normalizeRow(
+            planes[c],
+            width,
+            planar[c],
+            destination + (c * height + y) * width);
+      }
+    } else {
+      if (isFlipped) {
+        for (int64_t x = 0; x < width; ++x) {
+          std::memcpy(
+              rowBuffer.data() + x * 3, sourceRow + (width - 1 - x) * 3, 3);
+        }
+        sourceRow = rowBuffer.data();
+      }
+      normalizeRow(
+          sourceRow, width * 3, interleaved, destination + y * width * 3);
+    }
+  }
+}
+
+// Converts an RGB24 image into a tensor with the dtype and shape of `options`,
+// scaled, normalized and mirrored if `isFlipped`, in a single pass over the
+// image. This replaces the cast, divide, subtract and divide passes callers
+// would otherwise run.
+torch::Tensor convertRgb24ToNormalizedTensor(
+    const VideoDecoder::VideoStreamDecoderOptions& options,
+    const uint8_t* source,
+    int64_t sourceLinesize,
+    int64_t height,
+    int64_t width,
+    bool isFlipped,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  bool isChannelsFirst = options.shape == "NCHW";
+  torch::Tensor output =
+      getFrameOutputTensor(options, height, width, preAllocatedOutputTensor);
+  // (x / 255 - mean) / std == x * scale + bias.
+  std::array<float, 3> scale;
+  std::array<float, 3> bias;
+  for (int c = 0; c < 3; ++c) {
+    const auto& means = options.normalizationMean;
+    const auto& stds = options.normalizationStd;
+    double mean = means.empty() ? 0 : means[means.size() == 1 ? 0 : c];
+    double std = stds.empty() ? 1 : stds[stds.size() == 1 ? 0 : c];
+    scale[c] = 1 / (255 * std);
+    bias[c] = -mean / std;
+  }
+  switch (options.dtype) {
+    case torch::kFloat32:
+      normalizeRgb24(
+          source,
+          sourceLinesize,
+          height,
+          width,
+          scale,
+          bias,
+          isChannelsFirst,
+          isFlipped,
+          output.data_ptr<float>());
+      break;
+    case torch::kFloat16:
+      normalizeRgb24(
+          source,
+          sourceLinesize,
+          height,
+          width,
+          scale,
+          bias,
+          isChannelsFirst,
+          isFlipped,
+          output.data_ptr<c10::Half>());
+      break;
+    case torch::kBFloat16:
+      normalizeRgb24(
+          source,
+          sourceLinesize,
+          height,
+          width,
+          scale,
+          bias,
+          isChannelsFirst,
+          isFlipped,
+          output.data_ptr<c10::BFloat16>());
+      break;
+    default:
+      TORCH_CHECK(false, "Unsupported output dtype ", options.dtype);
+  }
+  return output;
+}
+
+// Calls task(thread) for each thread in [0, numThreads), each on its own
+// thread, and waits for them. Unlike at::parallel_for(), this runs
+// `numThreads` tasks concurrently whatever the size of the ATen thread pool,
+// including from a DataLoader worker or from inside a parallel region. The
+// calling thread runs task(0). The first exception thrown by a task is
+// rethrown once all of them are done.
+void runOnThreads(int numThreads, const std::function<void(int)>& task) {
+  // Propagates e.g. the profiler and the grad mode, like at::parallel_for().
+  at::ThreadLocalState threadLocalState;
+  std::exception_ptr firstException;
+  std::mutex exceptionMutex;
+  auto runTask = [&](int thread) {
+    try {
+      at::ThreadLocalStateGuard guard(threadLocalState);
+      task(thread);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(exceptionMutex);
+      if (!firstException) {
+        firstException = std::current_exception();
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads - 1);
+  for (int thread = 1; thread < numThreads; ++thread) {
+    threads.emplace_back(runTask, thread);
+  }
+  runTask(0);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  if (firstException) {
+    std::rethrow_exception(firstException);
+  }
+}
+
 } // namespace
 
+VideoDecoder::DecoderOptions::DecoderOptions(const std::string& optionsString) {
+  std::vector<std::string> tokens =
+      splitStringWithDelimiters(optionsString, ",");
+  for (auto token : tokens) {
+    std::vector<std::string> pairs = splitStringWithDelimiters(token, "=");
+    if (pairs.size() != 2) {
+      throw std::runtime_error(
+          "Invalid option: " + token +
+          ". Options must be in the form 'option=value'.");
+    }
+    std::string key = pairs[0];
+    std::string value = pairs[1];
+    if (key == "index_cache") {
+      useIndexCache = parseBoolOption(key, value);
+    } else if (key == "index_cache_dir") {
+      indexCacheDirectory = value;
+    } else if (key == "scan_mode") {
+      if (value != "packets" && value != "container_index") {
+        throw std::runtime_error(
+            "Invalid scan_mode=" + value +
+            ". scan_mode must be either packets or container_index.");
+      }
+      scanMode = value;
+    } else if (key == "frame_cache_bytes") {
+      frameCacheCapacityBytes = std::stoll(value);
+      if (frameCacheCapacityBytes < 0) {
+        throw std::runtime_error(
+            "Invalid frame_cache_bytes=" + value +
+            ". frame_cache_bytes must be >= 0.");
+      }
+    } else if (key == "batch_decode_threads") {
+      numBatchDecodeThreads = std::stoi(value);
+      if (numBatchDecodeThreads < 0) {
+        throw std::runtime_error(
+            "Invalid batch_decode_threads=" + value +
+            ". batch_decode_threads must be >= 0.");
+      }
+    } else if (key == "read_ahead_packets") {
+      numReadAheadPackets = std::stoi(value);
+      if (numReadAheadPackets < 0) {
+        throw std::runtime_error(
+            "Invalid read_ahead_packets=" + value +
+            ". read_ahead_packets must be >= 0.");
+      }
+    } else if (key == "mmap") {
+      useMemoryMap = parseBoolOption(key, value);
+    } else if (key == "io_uring") {
+      useIoUring = parseBoolOption(key, value);
+    } else {
+      throw std::runtime_error(
+          "Invalid option: " + key +
+          ". Valid options are: index_cache=<bool>,index_cache_dir=<string>,"
+          "scan_mode=<string>,frame_cache_bytes=<int>,"
+          "batch_decode_threads=<int>,read_ahead_packets=<int>,mmap=<bool>,"
+          "io_uring=<bool>");
+    }
+  }
+  if (useMemoryMap && useIoUring) {
+    throw std::runtime_error("mmap and io_uring can't be used together.");
+  }
+}
+
+VideoDecoder::SeekAccuracy::SeekAccuracy(const std::string& accuracyString) {
+  std::vector<std::string> parts =
+      splitStringWithDelimiters(accuracyString, ":");
+  if (parts.size() == 1 && parts[0] == "exact") {
+    mode = Mode::EXACT;
+  } else if (parts.size() == 1 && parts[0] == "key_frame") {
+    mode = Mode::NEAREST_KEY_FRAME;
+  } else if (parts.size() == 2 && parts[0] == "frames") {
+    mode = Mode::WITHIN_FRAMES;
+    frames = std::stoll(parts[1]);
+    if (frames < 0) {
+      throw std::runtime_error(
+          "Invalid seek accuracy=" + accuracyString + ". frames must be >= 0.");
+    }
+  } else if (parts.size() == 2 && parts[0] == "seconds") {
+    mode = Mode::WITHIN_SECONDS;
+    seconds = std::stod(parts[1]);
+    if (seconds < 0) {
+      throw std::runtime_error(
+          "Invalid seek accuracy=" + accuracyString +
+          ". seconds must be >= 0.");
+    }
+  } else {
+    throw std::runtime_error(
+        "Invalid seek accuracy=" + accuracyString +
+        ". Valid values are: exact, key_frame, frames:<int>, "
+        "seconds:<double>");
+  }
+}
+
 VideoDecoder::VideoStreamDecoderOptions::VideoStreamDecoderOptions(
     const std::string& optionsString) {
   std::vector<std::string> tokens =
@@ -114,10 +997,193 @@ VideoDecoder::VideoStreamDecoderOptions::VideoStreamDecoderOptions(
       width = std::stoi(value);
     } else if (key == "height") {
       height = std::stoi(value);
+    } else if (key == "color_conversion_library") {
+      if (value == "filtergraph") {
+        colorConversionLibrary = ColorConversionLibrary::FILTERGRAPH;
+      } else if (value == "swscale") {
+        colorConversionLibrary = ColorConversionLibrary::SWSCALE;
+      } else {
+        throw std::runtime_error(
+            "Invalid color_conversion_library=" + value +
+            ". color_conversion_library must be either filtergraph or "
+            "swscale.");
+      }
+    } else if (key == "key_frames_only") {
+      keyFramesOnly = parseBoolOption(key, value);
+    } else if (key == "seek_accuracy") {
+      seekAccuracy = SeekAccuracy(value);
+    } else if (key == "decode_quality") {
+      if (value == "full") {
+        decodeQuality = DecodeQuality::FULL;
+      } else if (value == "fast") {
+        decodeQuality = DecodeQuality::FAST;
+      } else if (value == "fastest") {
+        decodeQuality = DecodeQuality::FASTEST;
+      } else {
+        throw std::runtime_error(
+            "Invalid decode_quality=" + value +
+            ". decode_quality must be one of full, fast or fastest.");
+      }
+    } else if (key == "dtype") {
+      if (value == "uint8") {
+        dtype = torch::kUInt8;
+      } else if (value == "float32") {
+        dtype = torch::kFloat32;
+      } else if (value == "float16") {
+        dtype = torch::kFloat16;
+      } else if (value == "bfloat16") {
+        dtype = torch::kBFloat16;
+      } else {
+        throw std::runtime_error(
+            "Invalid dtype=" + value +
+            ". dtype must be one of uint8, float32, float16 or bfloat16.");
+      }
+    } else if (key == "output_format") {
+      if (value == "rgb24") {
+        outputFormat = OutputFormat::RGB24;
+      } else if (value == "gray") {
+        outputFormat = OutputFormat::GRAY;
+      } else if (value == "yuv420p") {
+        outputFormat = OutputFormat::YUV420P;
+      } else if (value == "nv12") {
+        outputFormat = OutputFormat::NV12;
+      } else {
+        throw std::runtime_error(
+            "Invalid output_format=" + value +
+            ". output_format must be one of rgb24, gray, yuv420p or nv12.");
+      }
+    } else if (key == "mean" || key == "std") {
+      std::vector<double>& values =
+          key == "mean" ? normalizationMean : normalizationStd;
+      values.clear();
+      for (const std::string& part : splitStringWithDelimiters(value, ":")) {
+        values.push_back(std::stod(part));
+      }
+      if (values.size() != 1 && values.size() != 3) {
+        throw std::runtime_error(
+            "Invalid " + key + "=" + value + ". " + key +
+            " must have 1 or 3 values separated by ':'.");
+      }
+    } else if (key == "crop") {
+      std::vector<std::string> parts = splitStringWithDelimiters(value, ":");
+      if (parts.size() != 4) {
+        throw std::runtime_error(
+            "Invalid crop=" + value +
+            ". crop must be <x>:<y>:<width>:<height>.");
+      }
+      crop = CropRegion{
+          std::stoi(parts[0]),
+          std::stoi(parts[1]),
+          std::stoi(parts[2]),
+          std::stoi(parts[3])};
+      if (crop->x < 0 || crop->y < 0 || crop->width <= 0 ||
+          crop->height <= 0) {
+        throw std::runtime_error(
+            "Invalid crop=" + value +
+            ". x and y must be >= 0 and width and height must be > 0.");
+      }
+    } else if (key == "resize") {
+      std::vector<std::string> parts = splitStringWithDelimiters(value, ":");
+      if (parts.size() == 1 && parts[0] == "exact") {
+        resizePolicy = ResizePolicy::EXACT;
+        resizeSide = 0;
+      } else if (
+          parts.size() == 2 &&
+          (parts[0] == "min_side" || parts[0] == "max_side") &&
+          std::stoi(parts[1]) > 0) {
+        resizePolicy = parts[0] == "min_side" ? ResizePolicy::MIN_SIDE
+                                              : ResizePolicy::MAX_SIDE;
+        resizeSide = std::stoi(parts[1]);
+      } else {
+        throw std::runtime_error(
+            "Invalid resize=" + value +
+            ". resize must be exact, min_side:<int> or max_side:<int>.");
+      }
+    } else if (key == "hflip") {
+      horizontalFlip = parseBoolOption(key, value);
+    } else if (key == "interpolation") {
+      if (value == "nearest") {
+        interpolation = Interpolation::NEAREST;
+      } else if (value == "bilinear") {
+        interpolation = Interpolation::BILINEAR;
+      } else if (value == "bicubic") {
+        interpolation = Interpolation::BICUBIC;
+      } else if (value == "area") {
+        interpolation = Interpolation::AREA;
+      } else {
+        throw std::runtime_error(
+            "Invalid interpolation=" + value +
+            ". interpolation must be one of nearest, bilinear, bicubic or "
+            "area.");
+      }
+    } else {
+      throw std::runtime_error(
+          "Invalid option: " + key +
+          ". Valid options are: ffmpeg_thread_count=<int>,shape=<string>,"
+          "width=<int>,height=<int>,color_conversion_library=<string>,"
+          "key_frames_only=<bool>,seek_accuracy=<string>,"
+          "decode_quality=<string>,dtype=<string>,mean=<floats>,"
+          "std=<floats>,output_format=<string>,crop=<x:y:width:height>,"
+          "resize=<string>,hflip=<bool>,interpolation=<string>");
+    }
+  }
+  if (resizePolicy != ResizePolicy::EXACT &&
+      (width.has_value() || height.has_value())) {
+    throw std::runtime_error(
+        "width and height can't be combined with resize=min_side or "
+        "resize=max_side.");
+  }
+  if (dtype != torch::kUInt8 && outputFormat != OutputFormat::RGB24) {
+    throw std::runtime_error("Only the rgb24 output_format supports dtype.");
+  }
+  if (dtype == torch::kUInt8 &&
+      (!normalizationMean.empty() || !normalizationStd.empty())) {
+    throw std::runtime_error("mean and std require a floating point dtype.");
+  }
+  for (double value : normalizationStd) {
+    if (value == 0) {
+      throw std::runtime_error("std values must be non-zero.");
+    }
+  }
+}
+
+VideoDecoder::AudioStreamDecoderOptions::AudioStreamDecoderOptions(
+    const std::string& optionsString) {
+  std::vector<std::string> tokens =
+      splitStringWithDelimiters(optionsString, ",");
+  for (auto token : tokens) {
+    std::vector<std::string> pairs = splitStringWithDelimiters(token, "=");
+    if (pairs.size() != 2) {
+      throw std::runtime_error(
+          "Invalid option: " + token +
+          ". Options must be in the form 'option=value'.");
+    }
+    std::string key = pairs[0];
+    std::string value = pairs[1];
+    if (key == "sample_rate") {
+      sampleRate = std::stoi(value);
+      if (*sampleRate <= 0) {
+        throw std::runtime_error(
+            "Invalid sample_rate=" + value + ". sample_rate must be > 0.");
+      }
+    } else if (key == "num_channels") {
+      numChannels = std::stoi(value);
+      if (*numChannels <= 0) {
+        throw std::runtime_error(
+            "Invalid num_channels=" + value + ". num_channels must be > 0.");
+      }
+    } else if (key == "buffer_seconds") {
+      bufferSeconds = std::stod(value);
+      if (bufferSeconds < 0) {
+        throw std::runtime_error(
+            "Invalid buffer_seconds=" + value +
+            ". buffer_seconds must be >= 0.");
+      }
     } else {
       throw std::runtime_error(
           "Invalid option: " + key +
-          ". Valid options are: ffmpeg_thread_count=<int>,shape=<string>");
+          ". Valid options are: sample_rate=<int>,num_channels=<int>,"
+          "buffer_seconds=<float>");
     }
   }
 }
@@ -129,7 +1195,14 @@ void VideoDecoder::initializeDecoder() {
   // frames to grab that. This is needed for the filter graph. TODO: If this
   // takes a long time, consider initializing the filter graph after the first
   // frame decode.
-  int ffmpegStatus = avformat_find_stream_info(formatContext_.get(), nullptr);
+  int ffmpegStatus = 0;
+  {
+    RECORD_FUNCTION(
+        "torchcodec::find_stream_info",
+        std::vector<c10::IValue>(
+            {static_cast<int64_t>(formatContext_->nb_streams)}));
+    ffmpegStatus = avformat_find_stream_info(formatContext_.get(), nullptr);
+  }
   if (ffmpegStatus < 0) {
     throw std::runtime_error(
         "Failed to find stream info: " +
@@ -161,6 +1234,13 @@ void VideoDecoder::initializeDecoder() {
       containerMetadata_.numVideoStreams++;
     } else if (stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
       containerMetadata_.numAudioStreams++;
+      if (stream->codecpar->sample_rate > 0) {
+        curr.sampleRate = stream->codecpar->sample_rate;
+      }
+      int numChannels = getNumChannels(stream->codecpar);
+      if (numChannels > 0) {
+        curr.numChannels = numChannels;
+      }
     }
   }
   if (formatContext_->duration > 0) {
@@ -174,7 +1254,7 @@ void VideoDecoder::initializeDecoder() {
   if (bestVideoStream >= 0) {
     containerMetadata_.bestVideoStreamIndex = bestVideoStream;
   }
-  int bestAudioStream = getBestStreamIndex(AVMEDIA_TYPE_VIDEO);
+  int bestAudioStream = getBestStreamIndex(AVMEDIA_TYPE_AUDIO);
   if (bestAudioStream >= 0) {
     containerMetadata_.bestAudioStreamIndex = bestAudioStream;
   }
@@ -183,10 +1263,17 @@ void VideoDecoder::initializeDecoder() {
 std::unique_ptr<VideoDecoder> VideoDecoder::createFromFilePath(
     const std::string& videoFilePath,
     const VideoDecoder::DecoderOptions& options) {
-  AVInput input = createAVFormatContextFromFilePath(videoFilePath);
+  RECORD_FUNCTION(
+      "torchcodec::open", std::vector<c10::IValue>({videoFilePath}));
+  AVInput input =
+      createAVFormatContextFromFilePath(videoFilePath, options);
   std::unique_ptr<VideoDecoder> decoder(new VideoDecoder());
+  decoder->memoryMappedFile_ = std::move(input.memoryMappedFile);
+  decoder->ioFileContext_ = std::move(input.ioFileContext);
   decoder->formatContext_ = std::move(input.formatContext);
+  decoder->ioBytesContext_ = std::move(input.ioBytesContext);
   decoder->options_ = options;
+  decoder->videoFilePath_ = videoFilePath;
   decoder->initializeDecoder();
   return decoder;
 }
@@ -195,15 +1282,215 @@ std::unique_ptr<VideoDecoder> VideoDecoder::createFromBuffer(
     const void* buffer,
     size_t length,
     const VideoDecoder::DecoderOptions& options) {
+  RECORD_FUNCTION(
+      "torchcodec::open",
+      std::vector<c10::IValue>({static_cast<int64_t>(length)}));
   AVInput input = createAVFormatContextFromBuffer(buffer, length);
   std::unique_ptr<VideoDecoder> decoder(new VideoDecoder());
   decoder->formatContext_ = std::move(input.formatContext);
   decoder->ioBytesContext_ = std::move(input.ioBytesContext);
   decoder->options_ = options;
+  decoder->videoBuffer_ = buffer;
+  decoder->videoBufferLength_ = length;
   decoder->initializeDecoder();
   return decoder;
 }
 
+bool VideoDecoder::reopenFromFilePath(const std::string& videoFilePath) {
+  RECORD_FUNCTION(
+      "torchcodec::reopen", std::vector<c10::IValue>({videoFilePath}));
+  return reopen(createFromFilePath(videoFilePath, options_));
+}
+
+bool VideoDecoder::reopenFromBuffer(const void* buffer, size_t length) {
+  RECORD_FUNCTION(
+      "torchcodec::reopen",
+      std::vector<c10::IValue>({static_cast<int64_t>(length)}));
+  return reopen(createFromBuffer(buffer, length, options_));
+}
+
+std::unique_ptr<VideoDecoder> VideoDecoder::clone() const {
+  std::unique_ptr<VideoDecoder> decoder = cloneWithoutStreams(options_);
+  for (int streamIndex : activeStreamIndices_) {
+    const StreamInfo& streamInfo = streams_.at(streamIndex);
+    if (streamInfo.stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+      decoder->addAudioStreamDecoder(streamIndex, streamInfo.audioOptions);
+    } else {
+      decoder->addVideoStreamDecoder(streamIndex, streamInfo.options);
+    }
+  }
+  return decoder;
+}
+
+std::unique_ptr<VideoDecoder> VideoDecoder::cloneWithoutStreams(
+    const DecoderOptions& options) const {
+  RECORD_FUNCTION("torchcodec::clone", std::vector<c10::IValue>());
+  const AVInputFormat* inputFormat = formatContext_->iformat;
+  AVInput input;
+  if (memoryMappedFile_) {
+    input = createAVFormatContextFromBuffer(
+        memoryMappedFile_->data(), memoryMappedFile_->size(), inputFormat);
+    input.memoryMappedFile = memoryMappedFile_;
+  } else if (ioFileContext_) {
+    input.ioFileContext = std::make_unique<AVIOFileContext>(
+        ioFileContext_->getReader(), kAVIOInternalTemporaryBufferSize);
+    input.formatContext = createAVFormatContextFromAVIO(
+        input.ioFileContext->getAVIO(),
+        "input file " + videoFilePath_,
+        inputFormat);
+  } else if (videoBuffer_ != nullptr) {
+    input = createAVFormatContextFromBuffer(
+        videoBuffer_, videoBufferLength_, inputFormat);
+  } else {
+    input = createAVFormatContextFromFilePath(videoFilePath_, inputFormat);
+  }
+  std::unique_ptr<VideoDecoder> decoder(new VideoDecoder());
+  decoder->memoryMappedFile_ = std::move(input.memoryMappedFile);
+  decoder->ioFileContext_ = std::move(input.ioFileContext);
+  decoder->formatContext_ = std::move(input.formatContext);
+  decoder->ioBytesContext_ = std::move(input.ioBytesContext);
+  decoder->options_ = options;
+  decoder->videoFilePath_ = videoFilePath_;
+  decoder->videoBuffer_ = videoBuffer_;
+  decoder->videoBufferLength_ = videoBufferLength_;
+
+  // Instead of avformat_find_stream_info(), which decodes the start of every
+  // stream, we copy the codec parameters it found for this decoder. Formats
+  // that only create their streams while reading packets still need it.
+  AVFormatContext* formatContext = decoder->formatContext_.get();
+  if ((formatContext->ctx_flags & AVFMTCTX_NOHEADER) != 0 ||
+      formatContext->nb_streams != formatContext_->nb_streams) {
+    int ffmpegStatus = avformat_find_stream_info(formatContext, nullptr);
+    if (ffmpegStatus < 0) {
+      throw std::runtime_error(
+          "Failed to find stream info: " +
+          getFFMPEGErrorStringFromErrorCode(ffmpegStatus));
+    }
+  }
+  if (formatContext->nb_streams != formatContext_->nb_streams) {
+    throw std::runtime_error(
+        "Could not clone decoder: found " +
+        std::to_string(formatContext->nb_streams) + " streams instead of " +
+        std::to_string(formatContext_->nb_streams));
+  }
+  for (unsigned int i = 0; i < formatContext->nb_streams; ++i) {
+    int ffmpegStatus = avcodec_parameters_copy(
+        formatContext->streams[i]->codecpar,
+        formatContext_->streams[i]->codecpar);
+    TORCH_CHECK_EQ(ffmpegStatus, AVSUCCESS);
+  }
+  decoder->containerMetadata_ = containerMetadata_;
+  // The clone shares our scanned index.
+  for (const auto& [streamIndex, streamInfo] : streams_) {
+    decoder->streams_[streamIndex].keyFrames = streamInfo.keyFrames;
+    decoder->streams_[streamIndex].allFrames = streamInfo.allFrames;
+  }
+  return decoder;
+}
+
+bool VideoDecoder::reopen(std::unique_ptr<VideoDecoder> decoder) {
+  // Everything that can fail is done on `decoder`, which already opened and
+  // probed the new input, before anything of this decoder is torn down: if
+  // the new input lacks a stream or a codec can't be opened, we throw and
+  // this decoder is left as it was.
+  struct ReopenedStream {
+    int oldStreamIndex = -1;
+    int newStreamIndex = -1;
+    bool reuse = false;
+  };
+  std::vector<ReopenedStream> reopenedStreams;
+  std::set<int> newStreamIndices;
+  for (int streamIndex : activeStreamIndices_) {
+    const StreamInfo& oldStreamInfo = streams_.at(streamIndex);
+    AVMediaType mediaType = oldStreamInfo.stream->codecpar->codec_type;
+    ReopenedStream reopenedStream;
+    reopenedStream.oldStreamIndex = streamIndex;
+    reopenedStream.newStreamIndex = av_find_best_stream(
+        decoder->formatContext_.get(), mediaType, streamIndex, -1, nullptr, 0);
+    if (reopenedStream.newStreamIndex < 0) {
+      // The new input has no stream of that type at the same index.
+      reopenedStream.newStreamIndex = decoder->getBestStreamIndex(mediaType);
+    }
+    if (reopenedStream.newStreamIndex < 0 ||
+        !newStreamIndices.insert(reopenedStream.newStreamIndex).second) {
+      throw std::invalid_argument(
+          "No stream found in the new input to replace stream " +
+          std::to_string(streamIndex) + ".");
+    }
+    const AVCodecParameters* newCodecParameters =
+        decoder->formatContext_->streams[reopenedStream.newStreamIndex]
+            ->codecpar;
+    // Audio codecs are cheap to open.
+    reopenedStream.reuse = mediaType == AVMEDIA_TYPE_VIDEO &&
+        areCodecParametersCompatible(
+            oldStreamInfo.stream->codecpar, newCodecParameters);
+    if (!reopenedStream.reuse) {
+      VLOG(3) << "Stream parameters changed. Reopening the codec for "
+              << "streamIndex=" << streamIndex;
+      if (mediaType == AVMEDIA_TYPE_AUDIO) {
+        decoder->addAudioStreamDecoder(
+            reopenedStream.newStreamIndex, oldStreamInfo.audioOptions);
+      } else {
+        decoder->addVideoStreamDecoder(
+            reopenedStream.newStreamIndex, oldStreamInfo.options);
+      }
+    }
+    reopenedStreams.push_back(reopenedStream);
+  }
+
+  // Nothing may read from the old input anymore.
+  stopPacketReadAhead();
+  batchWorkers_.clear();
+  frameCacheEntries_.clear();
+  frameCacheIndex_.clear();
+  frameCacheNumBytes_ = 0;
+  maybeDesiredPts_ = std::nullopt;
+  resetDecodeStats();
+  bool reusedAllStreams = true;
+  for (const ReopenedStream& reopenedStream : reopenedStreams) {
+    if (reopenedStream.reuse) {
+      decoder->reuseVideoStream(
+          reopenedStream.newStreamIndex,
+          std::move(streams_[reopenedStream.oldStreamIndex]));
+    } else {
+      reusedAllStreams = false;
+    }
+  }
+  streams_ = std::move(decoder->streams_);
+  activeStreamIndices_ = std::move(decoder->activeStreamIndices_);
+  containerMetadata_ = std::move(decoder->containerMetadata_);
+  formatContext_ = std::move(decoder->formatContext_);
+  ioBytesContext_ = std::move(decoder->ioBytesContext_);
+  // Only now that the old contexts are gone can the old mapping and file
+  // reader go away.
+  memoryMappedFile_ = std::move(decoder->memoryMappedFile_);
+  ioFileContext_ = std::move(decoder->ioFileContext_);
+  videoFilePath_ = std::move(decoder->videoFilePath_);
+  videoBuffer_ = decoder->videoBuffer_;
+  videoBufferLength_ = decoder->videoBufferLength_;
+  return reusedAllStreams;
+}
+
+void VideoDecoder::reuseVideoStream(int streamIndex, StreamInfo oldStreamInfo) {
+  AVStream* stream = formatContext_->streams[streamIndex];
+  StreamInfo& streamInfo = streams_[streamIndex];
+  streamInfo = std::move(oldStreamInfo);
+  streamInfo.streamIndex = streamIndex;
+  streamInfo.stream = stream;
+  streamInfo.timeBase = stream->time_base;
+  streamInfo.currentPts = 0;
+  streamInfo.currentDuration = 0;
+  streamInfo.discardFramesBeforePts = 0;
+  streamInfo.keyFrames.clear();
+  streamInfo.allFrames.clear();
+  AVCodecContext* codecContext = streamInfo.codecContext.get();
+  // Drops the frames of the old input that the codec may still hold.
+  avcodec_flush_buffers(codecContext);
+  codecContext->time_base = stream->time_base;
+  activeStreamIndices_.insert(streamIndex);
+  updateMetadataWithCodecContext(streamIndex, codecContext);
+}
+
 void VideoDecoder::initializeFilterGraphForStream(
     int streamIndex,
     const VideoStreamDecoderOptions& options) {
@@ -215,17 +1502,23 @@ void VideoDecoder::initializeFilterGraphForStream(
   TORCH_CHECK(filterState.filterGraph.get() != nullptr);
   const AVFilter* buffersrc = avfilter_get_by_name("buffer");
   const AVFilter* buffersink = avfilter_get_by_name("buffersink");
-  enum AVPixelFormat pix_fmts[] = {AV_PIX_FMT_RGB24, AV_PIX_FMT_NONE};
+  enum AVPixelFormat pix_fmts[] = {
+      getPixelFormat(options.outputFormat), AV_PIX_FMT_NONE};
   const StreamInfo& activeStream = streams_[streamIndex];
 
   AVCodecContext* codecContext = activeStream.codecContext.get();
+  // Cropped frames are fed to the graph, see convertAVFrameToDecodedOutput().
+  int sourceWidth =
+      options.crop.has_value() ? options.crop->width : codecContext->width;
+  int sourceHeight =
+      options.crop.has_value() ? options.crop->height : codecContext->height;
   char args[512];
   snprintf(
       args,
       sizeof(args),
       "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
-      codecContext->width,
-      codecContext->height,
+      sourceWidth,
+      sourceHeight,
       codecContext->pix_fmt,
       activeStream.stream->time_base.num,
       activeStream.stream->time_base.den,
@@ -278,13 +1571,16 @@ void VideoDecoder::initializeFilterGraphForStream(
   inputs->pad_idx = 0;
   inputs->next = nullptr;
   char description[512];
-  int width = activeStream.codecContext->width;
-  int height = activeStream.codecContext->height;
-  if (options.height.has_value() && options.width.has_value()) {
-    width = *options.width;
-    height = *options.height;
-  }
-  std::snprintf(description, sizeof(description), "scale=%d:%d", width, height);
+  auto [width, height] = getOutputFrameSize(
+      options, codecContext->width, codecContext->height);
+  std::snprintf(
+      description,
+      sizeof(description),
+      "scale=%d:%d:flags=%s%s",
+      width,
+      height,
+      getScaleFilterInterpolationName(options.interpolation),
+      options.horizontalFlip ? ",hflip" : "");
   AVFilterInOut* outputsTmp = outputs.release();
   AVFilterInOut* inputsTmp = inputs.release();
   ffmpegStatus = avfilter_graph_parse_ptr(
@@ -323,6 +1619,9 @@ void VideoDecoder::addVideoStreamDecoder(
         "Stream with index " + std::to_string(preferredStreamNumber) +
         " is already active.");
   }
+  // The read-ahead thread only reads the packets of the streams that were
+  // active when it started.
+  stopPacketReadAhead();
   TORCH_CHECK(formatContext_.get() != nullptr);
   AVCodecPtr codec = nullptr;
   int streamNumber = av_find_best_stream(
@@ -346,12 +1645,25 @@ void VideoDecoder::addVideoStreamDecoder(
         " is not a video stream.");
   }
   AVCodecContext* codecContext = avcodec_alloc_context3(codec);
-  codecContext->thread_count = options.ffmpegThreadCount.value_or(0);
   TORCH_CHECK(codecContext != nullptr);
+  codecContext->thread_count = options.ffmpegThreadCount.value_or(0);
+  if (options.keyFramesOnly) {
+    codecContext->skip_frame = AVDISCARD_NONKEY;
+  }
   streamInfo.codecContext.reset(codecContext);
   int retVal = avcodec_parameters_to_context(
       streamInfo.codecContext.get(), streamInfo.stream->codecpar);
   TORCH_CHECK_EQ(retVal, AVSUCCESS);
+  if (options.decodeQuality != DecodeQuality::FULL) {
+    codecContext->skip_loop_filter = AVDISCARD_NONREF;
+    codecContext->flags2 |= AV_CODEC_FLAG2_FAST;
+    codecContext->lowres = getLowresForOutputSize(
+        codec, codecContext->width, codecContext->height, options);
+  }
+  if (options.decodeQuality == DecodeQuality::FASTEST) {
+    codecContext->skip_loop_filter = AVDISCARD_ALL;
+    codecContext->skip_idct = AVDISCARD_NONREF;
+  }
   retVal = avcodec_open2(streamInfo.codecContext.get(), codec, nullptr);
   if (retVal < AVSUCCESS) {
     throw std::invalid_argument(getFFMPEGErrorStringFromErrorCode(retVal));
@@ -360,7 +1672,130 @@ void VideoDecoder::addVideoStreamDecoder(
   activeStreamIndices_.insert(streamNumber);
   updateMetadataWithCodecContext(streamInfo.streamIndex, codecContext);
   streamInfo.options = options;
-  initializeFilterGraphForStream(streamNumber, options);
+  if (options.colorConversionLibrary == ColorConversionLibrary::FILTERGRAPH) {
+    initializeFilterGraphForStream(streamNumber, options);
+  }
+}
+
+void VideoDecoder::addAudioStreamDecoder(
+    int preferredStreamNumber,
+    const AudioStreamDecoderOptions& options) {
+  if (activeStreamIndices_.count(preferredStreamNumber) > 0) {
+    throw std::invalid_argument(
+        "Stream with index " + std::to_string(preferredStreamNumber) +
+        " is already active.");
+  }
+  stopPacketReadAhead();
+  TORCH_CHECK(formatContext_.get() != nullptr);
+  AVCodecPtr codec = nullptr;
+  int streamNumber = av_find_best_stream(
+      formatContext_.get(),
+      AVMEDIA_TYPE_AUDIO,
+      preferredStreamNumber,
+      -1,
+      &codec,
+      0);
+  if (streamNumber < 0) {
+    throw std::invalid_argument("No valid audio stream found in input file.");
+  }
+  TORCH_CHECK(codec != nullptr);
+  StreamInfo& streamInfo = streams_[streamNumber];
+  streamInfo.streamIndex = streamNumber;
+  streamInfo.timeBase = formatContext_->streams[streamNumber]->time_base;
+  streamInfo.stream = formatContext_->streams[streamNumber];
+  AVCodecContext* codecContext = avcodec_alloc_context3(codec);
+  TORCH_CHECK(codecContext != nullptr);
+  streamInfo.codecContext.reset(codecContext);
+  int retVal = avcodec_parameters_to_context(
+      streamInfo.codecContext.get(), streamInfo.stream->codecpar);
+  TORCH_CHECK_EQ(retVal, AVSUCCESS);
+  retVal = avcodec_open2(streamInfo.codecContext.get(), codec, nullptr);
+  if (retVal < AVSUCCESS) {
+    throw std::invalid_argument(getFFMPEGErrorStringFromErrorCode(retVal));
+  }
+  codecContext->time_base = streamInfo.stream->time_base;
+  streamInfo.audioOptions = options;
+  streamInfo.outputSampleRate =
+      options.sampleRate.value_or(codecContext->sample_rate);
+  streamInfo.outputNumChannels =
+      options.numChannels.value_or(getNumChannels(streamInfo.stream->codecpar));
+  if (streamInfo.outputSampleRate <= 0 || streamInfo.outputNumChannels <= 0) {
+    throw std::invalid_argument(
+        "Unknown sample rate or number of channels for audio stream " +
+        std::to_string(streamNumber) + ". Set sample_rate and num_channels.");
+  }
+  activeStreamIndices_.insert(streamNumber);
+}
+
+void VideoDecoder::setVideoStreamTransform(
+    int streamIndex,
+    const std::string& transformOptions) {
+  if (activeStreamIndices_.count(streamIndex) == 0) {
+    throw std::runtime_error(
+        "Invalid stream index=" + std::to_string(streamIndex));
+  }
+  validateVideoStream(streamIndex);
+  static const std::set<std::string> kTransformKeys = {
+      "width", "height", "crop", "resize", "hflip", "interpolation"};
+  for (const std::string& token :
+       splitStringWithDelimiters(transformOptions, ",")) {
+    std::vector<std::string> pairs = splitStringWithDelimiters(token, "=");
+    std::string key = pairs.empty() ? token : pairs[0];
+    if (kTransformKeys.count(key) == 0) {
+      throw std::runtime_error(
+          "Invalid transform option: " + key +
+          ". Valid options are: width=<int>,height=<int>,"
+          "crop=<x:y:width:height>,resize=<string>,hflip=<bool>,"
+          "interpolation=<string>");
+    }
+  }
+  VideoStreamDecoderOptions transform(transformOptions);
+  StreamInfo& streamInfo = streams_[streamIndex];
+  const AVCodecContext* codecContext = streamInfo.codecContext.get();
+  if (codecContext->lowres > 0) {
+    // The frames are decoded at a reduced size while the batch outputs are
+    // allocated from the full resolution metadata, so the output size must
+    // not depend on the decoded size. Upscaling the reduced frames would also
+    // silently lose quality.
+    bool hasFixedSize = !transform.crop.has_value() &&
+        transform.resizePolicy == ResizePolicy::EXACT &&
+        transform.width.has_value() && transform.height.has_value();
+    if (!hasFixedSize || *transform.width > codecContext->width ||
+        *transform.height > codecContext->height) {
+      throw std::invalid_argument(
+          "Stream " + std::to_string(streamIndex) + " decodes at a reduced " +
+          "resolution of " + std::to_string(codecContext->width) + "x" +
+          std::to_string(codecContext->height) + ", so its transform must " +
+          "set a width and height no larger than that, without crop or " +
+          "resize. Use decode_quality=full for other transforms.");
+    }
+  }
+  VideoStreamDecoderOptions& options = streamInfo.options;
+  options.width = transform.width;
+  options.height = transform.height;
+  options.crop = transform.crop;
+  options.resizePolicy = transform.resizePolicy;
+  options.resizeSide = transform.resizeSide;
+  options.horizontalFlip = transform.horizontalFlip;
+  options.interpolation = transform.interpolation;
+  // The converters and the cached frames were made for the old transform.
+  streamInfo.swsContext.reset();
+  if (streamInfo.filterState.filterGraph) {
+    streamInfo.filterState.filterGraph.reset();
+    initializeFilterGraphForStream(streamIndex, options);
+  }
+  for (auto it = frameCacheEntries_.begin(); it != frameCacheEntries_.end();) {
+    if (it->output.streamIndex == streamIndex) {
+      frameCacheIndex_.erase({streamIndex, it->output.pts});
+      frameCacheNumBytes_ -= it->numBytes;
+      it = frameCacheEntries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto& worker : batchWorkers_[streamIndex]) {
+    worker->setVideoStreamTransform(streamIndex, transformOptions);
+  }
 }
 
 void VideoDecoder::updateMetadataWithCodecContext(
@@ -368,6 +1803,16 @@ void VideoDecoder::updateMetadataWithCodecContext(
     AVCodecContext* codecContext) {
   containerMetadata_.streams[streamIndex].width = codecContext->width;
   containerMetadata_.streams[streamIndex].height = codecContext->height;
+  if (codecContext->lowres > 0) {
+    // The codec context has the reduced decoding size, but the metadata
+    // describes the video.
+    VLOG(3) << "Decoding streamIndex=" << streamIndex
+            << " with lowres=" << codecContext->lowres;
+    const AVCodecParameters* codecParameters =
+        streams_[streamIndex].stream->codecpar;
+    containerMetadata_.streams[streamIndex].width = codecParameters->width;
+    containerMetadata_.streams[streamIndex].height = codecParameters->height;
+  }
   auto codedId = codecContext->codec_id;
   containerMetadata_.streams[streamIndex].codecName =
       std::string(avcodec_get_name(codedId));
@@ -385,6 +1830,27 @@ int VideoDecoder::getKeyFrameIndexForPtsUsingEncoderIndex(
   return currentKeyFrameIndex;
 }
 
+VideoDecoder::FrameIndex::FrameIndex(std::vector<FrameInfo> frameInfos)
+    : frameInfos_(
+          std::make_shared<std::vector<FrameInfo>>(std::move(frameInfos))) {}
+
+const std::vector<VideoDecoder::FrameInfo>& VideoDecoder::FrameIndex::get()
+    const {
+  static const std::vector<FrameInfo> kNoFrames;
+  return frameInfos_ ? *frameInfos_ : kNoFrames;
+}
+
+std::vector<VideoDecoder::FrameInfo>& VideoDecoder::FrameIndex::getMutable() {
+  // Only this decoder can reach frames that aren't shared, so no other thread
+  // can start sharing them while we change them.
+  if (!frameInfos_) {
+    frameInfos_ = std::make_shared<std::vector<FrameInfo>>();
+  } else if (frameInfos_.use_count() > 1) {
+    frameInfos_ = std::make_shared<std::vector<FrameInfo>>(*frameInfos_);
+  }
+  return *frameInfos_;
+}
+
 int VideoDecoder::getKeyFrameIndexForPtsUsingScannedIndex(
     const std::vector<VideoDecoder::FrameInfo>& keyFrames,
     int64_t pts) const {
@@ -401,9 +1867,262 @@ int VideoDecoder::getKeyFrameIndexForPtsUsingScannedIndex(
   return upperBound - 1 - keyFrames.begin();
 }
 
-void VideoDecoder::scanFileAndUpdateMetadataAndIndex() {
+std::string VideoDecoder::getIndexCachePath() const {
+  constexpr const char* kIndexCacheSuffix = ".torchcodec_index";
+  if (options_.indexCacheDirectory.empty()) {
+    return videoFilePath_ + kIndexCacheSuffix;
+  }
+  // Different videos may have the same file name, so we name the cache file
+  // after a hash of the absolute path of the video.
+  std::error_code errorCode;
+  std::string absolutePath =
+      std::filesystem::absolute(videoFilePath_, errorCode).string();
+  char hashString[17];
+  std::snprintf(
+      hashString,
+      sizeof(hashString),
+      "%016llx",
+      static_cast<unsigned long long>(hashBytes(
+          kFnvOffsetBasis, absolutePath.data(), absolutePath.size())));
+  return (std::filesystem::path(options_.indexCacheDirectory) /
+          (std::string(hashString) + kIndexCacheSuffix))
+      .string();
+}
+
+bool VideoDecoder::maybeLoadScannedIndexFromCache() {
+  if (videoFilePath_.empty()) {
+    return false;
+  }
+  std::ifstream input(getIndexCachePath(), std::ios::binary);
+  if (!input) {
+    VLOG(3) << "No index cache found for " << videoFilePath_;
+    return false;
+  }
+  input.seekg(0, std::ios::end);
+  const int64_t fileSize = input.tellg();
+  input.seekg(0);
+  char magic[sizeof(kIndexCacheMagic)];
+  uint32_t version = 0;
+  input.read(magic, sizeof(magic));
+  if (!input || std::memcmp(magic, kIndexCacheMagic, sizeof(magic)) != 0 ||
+      !readValue(input, version) || version != kIndexCacheVersion) {
+    VLOG(3) << "Ignoring index cache with unknown format for "
+            << videoFilePath_;
+    return false;
+  }
+  VideoFileKey cachedKey;
+  std::optional<VideoFileKey> currentKey = getVideoFileKey(videoFilePath_);
+  if (!readVideoFileKey(input, cachedKey) || !currentKey.has_value() ||
+      !(cachedKey == *currentKey)) {
+    VLOG(3) << "Ignoring stale index cache for " << videoFilePath_;
+    return false;
+  }
+
+  // Read everything into temporaries first so that a truncated cache file
+  // leaves the decoder untouched.
+  struct CachedStream {
+    int streamIndex = -1;
+    std::optional<int64_t> minPtsFromScan;
+    std::optional<int64_t> maxPtsFromScan;
+    std::optional<int64_t> numFramesFromScan;
+    std::vector<FrameInfo> keyFrames;
+    std::vector<FrameInfo> allFrames;
+  };
+  auto readFrameInfos = [&input,
+                         fileSize](std::vector<FrameInfo>& frameInfos) {
+    uint64_t numFrames = 0;
+    if (!readValue(input, numFrames)) {
+      return false;
+    }
+    // Checked before allocating, so that a damaged count can't ask for more
+    // memory than the frames the file can hold.
+    int64_t remainingBytes = fileSize - input.tellg();
+    if (remainingBytes < 0 ||
+        numFrames > remainingBytes / kIndexCacheFrameInfoBytes) {
+      return false;
+    }
+    frameInfos.resize(numFrames);
+    for (FrameInfo& frameInfo : frameInfos) {
+      if (!readValue(input, frameInfo.pts) ||
+          !readValue(input, frameInfo.dts) ||
+          !readValue(input, frameInfo.duration) ||
+          !readValue(input, frameInfo.pos) ||
+          !readValue(input, frameInfo.size)) {
+        return false;
+      }
+    }
+    return true;
+  };
+  uint64_t numStreams = 0;
+  if (!readValue(input, numStreams) ||
+      numStreams > containerMetadata_.streams.size()) {
+    return false;
+  }
+  std::vector<CachedStream> cachedStreams(numStreams);
+  for (CachedStream& cachedStream : cachedStreams) {
+    int32_t streamIndex = -1;
+    if (!readValue(input, streamIndex) || streamIndex < 0 ||
+        streamIndex >= containerMetadata_.streams.size() ||
+        !readOptionalInt64(input, cachedStream.minPtsFromScan) ||
+        !readOptionalInt64(input, cachedStream.maxPtsFromScan) ||
+        !readOptionalInt64(input, cachedStream.numFramesFromScan) ||
+        !readFrameInfos(cachedStream.keyFrames) ||
+        !readFrameInfos(cachedStream.allFrames)) {
+      VLOG(3) << "Ignoring corrupted index cache for " << videoFilePath_;
+      return false;
+    }
+    cachedStream.streamIndex = streamIndex;
+  }
+
+  for (CachedStream& cachedStream : cachedStreams) {
+    auto& streamMetadata = containerMetadata_.streams[cachedStream.streamIndex];
+    auto stream = formatContext_->streams[cachedStream.streamIndex];
+    streamMetadata.minPtsFromScan = cachedStream.minPtsFromScan;
+    streamMetadata.maxPtsFromScan = cachedStream.maxPtsFromScan;
+    streamMetadata.numFramesFromScan = cachedStream.numFramesFromScan;
+    streamMetadata.indexSource = "cache";
+    if (streamMetadata.minPtsFromScan.has_value()) {
+      streamMetadata.minPtsSecondsFromScan =
+          *streamMetadata.minPtsFromScan * av_q2d(stream->time_base);
+    }
+    if (streamMetadata.maxPtsFromScan.has_value()) {
+      streamMetadata.maxPtsSecondsFromScan =
+          *streamMetadata.maxPtsFromScan * av_q2d(stream->time_base);
+    }
+    StreamInfo& streamInfo = streams_[cachedStream.streamIndex];
+    streamInfo.keyFrames = FrameIndex(std::move(cachedStream.keyFrames));
+    streamInfo.allFrames = FrameIndex(std::move(cachedStream.allFrames));
+  }
+  VLOG(3) << "Loaded index cache for " << videoFilePath_;
+  return true;
+}
+
+void VideoDecoder::saveScannedIndexToCache() const {
+  if (videoFilePath_.empty()) {
+    return;
+  }
+  std::optional<VideoFileKey> key = getVideoFileKey(videoFilePath_);
+  if (!key.has_value()) {
+    VLOG(1) << "Could not stat " << videoFilePath_
+            << ". Not writing the index cache.";
+    return;
+  }
+  std::string cachePath = getIndexCachePath();
+  // Write to a temporary file and rename it so that concurrent readers (e.g.
+  // other DataLoader workers) never see a partially written cache. The name
+  // must be unique across processes: forked workers share the addresses of
+  // their parent, so e.g. `this` isn't.
+  std::string temporaryPath = cachePath + ".tmp" + std::to_string(getpid()) +
+      "." +
+      std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+  {
+    std::ofstream output(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!output) {
+      VLOG(1) << "Could not open " << temporaryPath
+              << " for writing the index cache.";
+      return;
+    }
+    output.write(kIndexCacheMagic, sizeof(kIndexCacheMagic));
+    writeValue(output, kIndexCacheVersion);
+    writeVideoFileKey(output, *key);
+    auto writeFrameInfos = [&output](const std::vector<FrameInfo>& frameInfos) {
+      writeValue<uint64_t>(output, frameInfos.size());
+      for (const FrameInfo& frameInfo : frameInfos) {
+        writeValue(output, frameInfo.pts);
+        writeValue(output, frameInfo.dts);
+        writeValue(output, frameInfo.duration);
+        writeValue(output, frameInfo.pos);
+        writeValue(output, frameInfo.size);
+      }
+    };
+    writeValue<uint64_t>(output, streams_.size());
+    for (const auto& [streamIndex, streamInfo] : streams_) {
+      const auto& streamMetadata = containerMetadata_.streams[streamIndex];
+      writeValue<int32_t>(output, streamIndex);
+      writeOptionalInt64(output, streamMetadata.minPtsFromScan);
+      writeOptionalInt64(output, streamMetadata.maxPtsFromScan);
+      writeOptionalInt64(output, streamMetadata.numFramesFromScan);
+      writeFrameInfos(streamInfo.keyFrames);
+      writeFrameInfos(streamInfo.allFrames);
+    }
+    if (!output) {
+      VLOG(1) << "Failed to write the index cache to " << temporaryPath;
+      output.close();
+      std::remove(temporaryPath.c_str());
+      return;
+    }
+  }
+  std::error_code errorCode;
+  std::filesystem::rename(temporaryPath, cachePath, errorCode);
+  if (errorCode) {
+    VLOG(1) << "Could not move the index cache to " << cachePath << ": "
+            << errorCode.message();
+    std::remove(temporaryPath.c_str());
+  }
+}
+
+bool VideoDecoder::maybeBuildIndexFromContainerIndex(int streamIndex) {
+  AVStream* stream = formatContext_->streams[streamIndex];
+  // Container index entries are keyed by decoding timestamp. Those only match
+  // the presentation timestamps if the decoder does not reorder frames.
+  if (stream->codecpar->codec_type == AVMEDIA_TYPE_VIDEO &&
+      stream->codecpar->video_delay > 0) {
+    return false;
+  }
+  // Some containers only index a subset of the packets (e.g. Matroska cues
+  // only point at key frames). We can only use indexes that have one entry
+  // per frame.
+  int numEntries = getNumIndexEntries(stream);
+  if (numEntries <= 0 || stream->nb_frames != numEntries) {
+    return false;
+  }
+  auto& streamMetadata = containerMetadata_.streams[streamIndex];
+  StreamInfo& streamInfo = streams_[streamIndex];
+  std::vector<FrameInfo>& keyFrames = streamInfo.keyFrames.getMutable();
+  std::vector<FrameInfo>& allFrames = streamInfo.allFrames.getMutable();
+  std::optional<int64_t> previousPts;
+  int64_t lastDuration = 0;
+  for (int i = 0; i < numEntries; ++i) {
+    const AVIndexEntry* entry = getIndexEntry(stream, i);
+    if (entry->flags & AVINDEX_DISCARD_FRAME) {
+      continue;
+    }
+    if (previousPts.has_value()) {
+      lastDuration = entry->timestamp - *previousPts;
+    }
+    previousPts = entry->timestamp;
+    streamMetadata.minPtsFromScan = std::min(
+        streamMetadata.minPtsFromScan.value_or(INT64_MAX), entry->timestamp);
+    streamMetadata.numFramesFromScan =
+        streamMetadata.numFramesFromScan.value_or(0) + 1;
+
+    // The durations are filled in from the next frame once the index is
+    // sorted.
+    FrameInfo frameInfo;
+    frameInfo.pts = entry->timestamp;
+    frameInfo.dts = entry->timestamp;
+    frameInfo.pos = entry->pos;
+    frameInfo.size = entry->size;
+    if (entry->flags & AVINDEX_KEYFRAME) {
+      keyFrames.push_back(frameInfo);
+    }
+    allFrames.push_back(frameInfo);
+  }
+  if (previousPts.has_value()) {
+    // The index has no durations. We assume the last frame lasts as long as
+    // the one before it, which is exact for constant frame rate streams.
+    streamMetadata.maxPtsFromScan = *previousPts + lastDuration;
+  }
+  return true;
+}
+
+void VideoDecoder::scanPacketsAndUpdateMetadataAndIndex(
+    const std::set<int>& streamIndices) {
+  // We reuse the same packet for the whole scan instead of allocating one per
+  // iteration.
+  UniqueAVPacket packet(av_packet_alloc());
   while (true) {
-    UniqueAVPacket packet(av_packet_alloc());
+    av_packet_unref(packet.get());
     int ffmpegStatus = av_read_frame(formatContext_.get(), packet.get());
     if (ffmpegStatus == AVERROR_EOF) {
       break;
@@ -415,7 +2134,8 @@ void VideoDecoder::scanFileAndUpdateMetadataAndIndex() {
     }
     int streamIndex = packet->stream_index;
 
-    if (packet->flags & AV_PKT_FLAG_DISCARD) {
+    if (packet->flags & AV_PKT_FLAG_DISCARD ||
+        streamIndices.count(streamIndex) == 0) {
       continue;
     }
     auto& stream = containerMetadata_.streams[streamIndex];
@@ -428,11 +2148,61 @@ void VideoDecoder::scanFileAndUpdateMetadataAndIndex() {
 
     FrameInfo frameInfo;
     frameInfo.pts = packet->pts;
+    frameInfo.dts = packet->dts;
+    frameInfo.duration = packet->duration;
+    frameInfo.pos = packet->pos;
+    frameInfo.size = packet->size;
 
     if (packet->flags & AV_PKT_FLAG_KEY) {
-      streams_[streamIndex].keyFrames.push_back(frameInfo);
+      streams_[streamIndex].keyFrames.getMutable().push_back(frameInfo);
+    }
+    streams_[streamIndex].allFrames.getMutable().push_back(frameInfo);
+  }
+  int ffmepgStatus =
+      avformat_seek_file(formatContext_.get(), 0, INT64_MIN, 0, 0, 0);
+  if (ffmepgStatus < 0) {
+    throw std::runtime_error(
+        "Could not seek file to pts=0: " +
+        getFFMPEGErrorStringFromErrorCode(ffmepgStatus));
+  }
+}
+
+void VideoDecoder::scanFileAndUpdateMetadataAndIndex() {
+  RECORD_FUNCTION(
+      "torchcodec::scan", std::vector<c10::IValue>({options_.scanMode}));
+  if (options_.useIndexCache) {
+    bool loadedIndex = false;
+    try {
+      loadedIndex = maybeLoadScannedIndexFromCache();
+    } catch (const std::exception& e) {
+      // The cache is only an optimization, so whatever is wrong with it, we
+      // scan the file instead.
+      VLOG(3) << "Ignoring unreadable index cache for " << videoFilePath_
+              << ": " << e.what();
+    }
+    if (loadedIndex) {
+      return;
+    }
+  }
+  stopPacketReadAhead();
+  std::set<int> streamsToScan;
+  for (int i = 0; i < containerMetadata_.streams.size(); ++i) {
+    if (options_.scanMode == "container_index" &&
+        maybeBuildIndexFromContainerIndex(i)) {
+      VLOG(3) << "Built index for streamIndex=" << i
+              << " from the container index";
+      containerMetadata_.streams[i].indexSource = "container_index";
+      continue;
     }
-    streams_[streamIndex].allFrames.push_back(frameInfo);
+    containerMetadata_.streams[i].indexSource = "packets";
+    streamsToScan.insert(i);
+  }
+  if (!streamsToScan.empty()) {
+    // The scan reads the whole file front to back, so the kernel can read
+    // far ahead and drop the pages behind us.
+    MemoryMappedFile::ScopedAccessPattern sequentialAccess(
+        memoryMappedFile_.get(), MemoryMappedFile::AccessPattern::SEQUENTIAL);
+    scanPacketsAndUpdateMetadataAndIndex(streamsToScan);
   }
   for (int i = 0; i < containerMetadata_.streams.size(); ++i) {
     auto& streamMetadata = containerMetadata_.streams[i];
@@ -446,26 +2216,36 @@ void VideoDecoder::scanFileAndUpdateMetadataAndIndex() {
           *streamMetadata.maxPtsFromScan * av_q2d(stream->time_base);
     }
   }
-  int ffmepgStatus =
-      avformat_seek_file(formatContext_.get(), 0, INT64_MIN, 0, 0, 0);
-  if (ffmepgStatus < 0) {
-    throw std::runtime_error(
-        "Could not seek file to pts=0: " +
-        getFFMPEGErrorStringFromErrorCode(ffmepgStatus));
-  }
   for (auto& [streamIndex, stream] : streams_) {
+    std::vector<FrameInfo>& keyFrames = stream.keyFrames.getMutable();
+    std::vector<FrameInfo>& allFrames = stream.allFrames.getMutable();
     std::sort(
-        stream.keyFrames.begin(),
-        stream.keyFrames.end(),
+        keyFrames.begin(),
+        keyFrames.end(),
         [](const FrameInfo& frameInfo1, const FrameInfo& frameInfo2) {
           return frameInfo1.pts < frameInfo2.pts;
         });
     std::sort(
-        stream.allFrames.begin(),
-        stream.allFrames.end(),
+        allFrames.begin(),
+        allFrames.end(),
         [](const FrameInfo& frameInfo1, const FrameInfo& frameInfo2) {
           return frameInfo1.pts < frameInfo2.pts;
         });
+    for (size_t i = 0; i + 1 < allFrames.size(); ++i) {
+      FrameInfo& frameInfo = allFrames[i];
+      if (frameInfo.duration <= 0) {
+        frameInfo.duration = allFrames[i + 1].pts - frameInfo.pts;
+      }
+    }
+    const auto& streamMetadata = containerMetadata_.streams[streamIndex];
+    if (!allFrames.empty() && allFrames.back().duration <= 0 &&
+        streamMetadata.maxPtsFromScan.has_value()) {
+      allFrames.back().duration =
+          *streamMetadata.maxPtsFromScan - allFrames.back().pts;
+    }
+  }
+  if (options_.useIndexCache) {
+    saveScannedIndexToCache();
   }
 }
 
@@ -513,12 +2293,18 @@ bool VideoDecoder::canWeAvoidSeekingForStream(
     return false;
   }
   if (currentPts == targetPts) {
-    // We are seeking to the exact same frame as we are currently at. Without
-    // caching we have to rewind back and decode the frame again.
-    // TODO(ahmads): We can avoid a seek+decode by caching the previous frame.
+    // We are seeking to the exact same frame as we are currently at. We have
+    // to rewind back and decode the frame again. When the frame cache is
+    // enabled, such requests are served from the cache and never get here.
     return false;
   }
   // We are seeking forwards.
+  if (streamInfo.stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+    // Every audio frame is a key frame, and decoding audio is cheap, so we
+    // decode up to targetPts unless it is far away.
+    return (targetPts - currentPts) * av_q2d(streamInfo.timeBase) <=
+        kMaxAudioSecondsDecodedInsteadOfSeeking;
+  }
   // We can only skip a seek if both currentPts and targetPts share the same
   // keyframe.
   int currentKeyFrameIndex = getKeyFrameIndexForPts(streamInfo, currentPts);
@@ -527,6 +2313,130 @@ bool VideoDecoder::canWeAvoidSeekingForStream(
       currentKeyFrameIndex == targetKeyFrameIndex;
 }
 
+/*
+The cost of returning a frame is the number of frames we have to decode to get
+to it. Without a seek that is the distance from the frame after the one we
+decoded last, as long as both are in the same GOP (see
+canWeAvoidSeekingForStream()). Otherwise it is the distance from the key frame
+that starts the frame's GOP. Within a tolerance window [lo, hi] the cheapest
+frames are therefore lo, the key frames in the window and the frame after the
+current one. Ties are broken by the distance to the requested timestamp.
+
+This counts frames in presentation order, which slightly underestimates the
+cost of streams with B-frames, but ranks the candidates correctly.
+*/
+std::optional<int64_t> VideoDecoder::getApproximateFrameIndex(
+    const StreamInfo& streamInfo,
+    double seconds,
+    const SeekAccuracy& accuracy) const {
+  const std::vector<FrameInfo>& allFrames = streamInfo.allFrames;
+  if (accuracy.mode == SeekAccuracy::Mode::EXACT || allFrames.empty() ||
+      streamInfo.keyFrames.empty()) {
+    return std::nullopt;
+  }
+  auto ptsToSeconds = [&streamInfo](int64_t pts) {
+    return 1.0 * pts / streamInfo.timeBase.den;
+  };
+  auto frameIndexForPts = [&allFrames](int64_t pts) -> int64_t {
+    auto frame = std::lower_bound(
+        allFrames.begin(),
+        allFrames.end(),
+        pts,
+        [](const FrameInfo& frameInfo, int64_t value) {
+          return frameInfo.pts < value;
+        });
+    return frame - allFrames.begin();
+  };
+  auto distance = [&](int64_t frameIndex) {
+    return std::abs(ptsToSeconds(allFrames[frameIndex].pts) - seconds);
+  };
+
+  if (accuracy.mode == SeekAccuracy::Mode::NEAREST_KEY_FRAME) {
+    const std::vector<FrameInfo>& keyFrames = streamInfo.keyFrames;
+    int keyFrameIndex = getKeyFrameIndexForPtsUsingScannedIndex(
+        keyFrames, seconds * streamInfo.timeBase.den);
+    keyFrameIndex = std::max(keyFrameIndex, 0);
+    int64_t best = frameIndexForPts(keyFrames[keyFrameIndex].pts);
+    if (keyFrameIndex + 1 < keyFrames.size()) {
+      int64_t next = frameIndexForPts(keyFrames[keyFrameIndex + 1].pts);
+      if (distance(next) < distance(best)) {
+        best = next;
+      }
+    }
+    return std::min<int64_t>(best, allFrames.size() - 1);
+  }
+
+  // The frame displayed at `seconds`, clamped to the stream.
+  auto nextFrame = std::upper_bound(
+      allFrames.begin(),
+      allFrames.end(),
+      seconds,
+      [&ptsToSeconds](double value, const FrameInfo& frameInfo) {
+        return value < ptsToSeconds(frameInfo.pts);
+      });
+  int64_t exactIndex =
+      std::max<int64_t>(nextFrame - allFrames.begin() - 1, 0);
+  int64_t lo = exactIndex;
+  int64_t hi = exactIndex;
+  if (accuracy.mode == SeekAccuracy::Mode::WITHIN_FRAMES) {
+    lo = std::max<int64_t>(exactIndex - accuracy.frames, 0);
+    hi = std::min<int64_t>(exactIndex + accuracy.frames, allFrames.size() - 1);
+  } else {
+    while (lo > 0 &&
+           seconds - ptsToSeconds(allFrames[lo - 1].pts) <= accuracy.seconds) {
+      lo--;
+    }
+    while (hi + 1 < allFrames.size() &&
+           ptsToSeconds(allFrames[hi + 1].pts) - seconds <= accuracy.seconds) {
+      hi++;
+    }
+  }
+
+  int64_t currentIndex = frameIndexForPts(streamInfo.currentPts);
+  bool canContinue = currentIndex < allFrames.size() &&
+      allFrames[currentIndex].pts == streamInfo.currentPts;
+  auto cost = [&](int64_t frameIndex) {
+    int64_t pts = allFrames[frameIndex].pts;
+    int keyFrameIndex =
+        getKeyFrameIndexForPtsUsingScannedIndex(streamInfo.keyFrames, pts);
+    int64_t keyFrameFrameIndex = keyFrameIndex < 0
+        ? 0
+        : frameIndexForPts(streamInfo.keyFrames[keyFrameIndex].pts);
+    if (canContinue && frameIndex > currentIndex &&
+        canWeAvoidSeekingForStream(streamInfo, streamInfo.currentPts, pts)) {
+      return frameIndex - currentIndex - 1;
+    }
+    return frameIndex - keyFrameFrameIndex;
+  };
+
+  std::vector<int64_t> candidates = {exactIndex, lo};
+  if (canContinue && currentIndex + 1 >= lo && currentIndex + 1 <= hi) {
+    candidates.push_back(currentIndex + 1);
+  }
+  int keyFrameIndex = getKeyFrameIndexForPtsUsingScannedIndex(
+      streamInfo.keyFrames, allFrames[lo].pts);
+  for (size_t k = std::max(keyFrameIndex, 0); k < streamInfo.keyFrames.size();
+       ++k) {
+    if (streamInfo.keyFrames[k].pts > allFrames[hi].pts) {
+      break;
+    }
+    int64_t frameIndex = frameIndexForPts(streamInfo.keyFrames[k].pts);
+    if (frameIndex >= lo && frameIndex <= hi) {
+      candidates.push_back(frameIndex);
+    }
+  }
+  int64_t best = exactIndex;
+  for (int64_t candidate : candidates) {
+    int64_t candidateCost = cost(candidate);
+    int64_t bestCost = cost(best);
+    if (candidateCost < bestCost ||
+        (candidateCost == bestCost && distance(candidate) < distance(best))) {
+      best = candidate;
+    }
+  }
+  return best;
+}
+
 // This method looks at currentPts and desiredPts and seeks in the
 // AVFormatContext if it is needed. We can skip seeking in certain cases. See
 // the comment of canWeAvoidSeeking() for details.
@@ -545,6 +2455,18 @@ void VideoDecoder::maybeSeekToBeforeDesiredPts() {
   // works.
   bool mustSeek = false;
   for (int streamIndex : activeStreamIndices_) {
+    if (packetReadAhead_ && streams_[streamIndex].keyFrames.empty()) {
+      // Without a scanned index, canWeAvoidSeekingForStream() searches the
+      // demuxer's index, which the read-ahead thread may be updating. We
+      // have to stop it, and then seek since the packets it read are lost.
+      mustSeek = true;
+      break;
+    }
+  }
+  for (int streamIndex : activeStreamIndices_) {
+    if (mustSeek) {
+      break;
+    }
     StreamInfo& streamInfo = streams_[streamIndex];
     int64_t desiredPtsForStream = *maybeDesiredPts_ * streamInfo.timeBase.den;
     if (!canWeAvoidSeekingForStream(
@@ -560,38 +2482,169 @@ void VideoDecoder::maybeSeekToBeforeDesiredPts() {
     decodeStats_.numSeeksSkipped++;
     return;
   }
+  RECORD_FUNCTION(
+      "torchcodec::seek", std::vector<c10::IValue>({*maybeDesiredPts_}));
+  stopPacketReadAhead();
   int firstActiveStreamIndex = *activeStreamIndices_.begin();
   const auto& firstStreamInfo = streams_[firstActiveStreamIndex];
   int64_t desiredPts = *maybeDesiredPts_ * firstStreamInfo.timeBase.den;
-  int ffmepgStatus = avformat_seek_file(
-      formatContext_.get(),
-      firstStreamInfo.streamIndex,
-      INT64_MIN,
-      desiredPts,
-      desiredPts,
-      0);
-  if (ffmepgStatus < 0) {
-    throw std::runtime_error(
-        "Could not seek file to pts=" + std::to_string(desiredPts) + ": " +
-        getFFMPEGErrorStringFromErrorCode(ffmepgStatus));
+  if (activeStreamIndices_.size() == 1) {
+    maybePrefetchPtsRanges(firstStreamInfo, {{desiredPts, desiredPts}});
+  }
+  bool seekedToBytePosition =
+      maybeSeekToKeyFrameBytePosition(firstStreamInfo, desiredPts);
+  if (!seekedToBytePosition) {
+    int ffmepgStatus = avformat_seek_file(
+        formatContext_.get(),
+        firstStreamInfo.streamIndex,
+        INT64_MIN,
+        desiredPts,
+        desiredPts,
+        0);
+    if (ffmepgStatus < 0) {
+      throw std::runtime_error(
+          "Could not seek file to pts=" + std::to_string(desiredPts) + ": " +
+          getFFMPEGErrorStringFromErrorCode(ffmepgStatus));
+    }
   }
   decodeStats_.numFlushes++;
   for (int streamIndex : activeStreamIndices_) {
     StreamInfo& streamInfo = streams_[streamIndex];
     avcodec_flush_buffers(streamInfo.codecContext.get());
+    // The next audio samples don't follow the buffered ones anymore.
+    streamInfo.swrContext.reset();
+    streamInfo.audioBuffer = AudioBuffer();
   }
 }
 
-VideoDecoder::DecodedOutput VideoDecoder::getDecodedOutputWithFilter(
+std::optional<std::pair<int64_t, int64_t>>
+VideoDecoder::getByteRangeForPtsRange(
+    const StreamInfo& streamInfo,
+    int64_t startPts,
+    int64_t endPts) const {
+  if (streamInfo.keyFrames.empty()) {
+    return std::nullopt;
+  }
+  int keyFrameIndex =
+      getKeyFrameIndexForPtsUsingScannedIndex(streamInfo.keyFrames, startPts);
+  if (keyFrameIndex < 0 || streamInfo.keyFrames[keyFrameIndex].pos < 0) {
+    return std::nullopt;
+  }
+  const FrameInfo& keyFrame = streamInfo.keyFrames[keyFrameIndex];
+  int64_t endPos = keyFrame.pos + keyFrame.size;
+  // allFrames is sorted by pts, but B-frames make byte positions slightly out
+  // of order, so we take the largest end position of the range.
+  auto it = std::lower_bound(
+      streamInfo.allFrames.begin(),
+      streamInfo.allFrames.end(),
+      keyFrame.pts,
+      [](const FrameInfo& frameInfo, int64_t pts) {
+        return frameInfo.pts < pts;
+      });
+  for (; it != streamInfo.allFrames.end() && it->pts <= endPts; ++it) {
+    endPos = std::max(endPos, it->pos + it->size);
+  }
+  return std::make_pair(keyFrame.pos, endPos - keyFrame.pos);
+}
+
+void VideoDecoder::maybePrefetchPtsRanges(
+    const StreamInfo& streamInfo,
+    const std::vector<std::pair<int64_t, int64_t>>& ptsRanges) {
+  if (!memoryMappedFile_ && !ioFileContext_) {
+    return;
+  }
+  std::vector<std::pair<int64_t, int64_t>> byteRanges;
+  for (const auto& [startPts, endPts] : ptsRanges) {
+    auto byteRange = getByteRangeForPtsRange(streamInfo, startPts, endPts);
+    if (byteRange.has_value()) {
+      byteRanges.push_back(*byteRange);
+    }
+  }
+  if (memoryMappedFile_) {
+    for (const auto& [offset, length] : byteRanges) {
+      memoryMappedFile_->adviseWillNeed(offset, length);
+    }
+  } else {
+    ioFileContext_->getReader()->prefetch(byteRanges);
+  }
+}
+
+bool VideoDecoder::maybeSeekToKeyFrameBytePosition(
+    const StreamInfo& streamInfo,
+    int64_t pts) {
+  // The byte position of a video key frame says nothing about where the
+  // packets of other streams are, so we only use it for a single stream.
+  if (activeStreamIndices_.size() != 1 || streamInfo.keyFrames.empty() ||
+      formatContext_->iformat->flags & AVFMT_NO_BYTE_SEEK ||
+      std::find(
+          kByteSeekableFormatNames.begin(),
+          kByteSeekableFormatNames.end(),
+          formatContext_->iformat->name) == kByteSeekableFormatNames.end()) {
+    return false;
+  }
+  int keyFrameIndex =
+      getKeyFrameIndexForPtsUsingScannedIndex(streamInfo.keyFrames, pts);
+  if (keyFrameIndex < 0 || streamInfo.keyFrames[keyFrameIndex].pos < 0) {
+    return false;
+  }
+  int64_t pos = streamInfo.keyFrames[keyFrameIndex].pos;
+  int ffmpegStatus = avformat_seek_file(
+      formatContext_.get(),
+      streamInfo.streamIndex,
+      pos,
+      pos,
+      pos,
+      AVSEEK_FLAG_BYTE);
+  if (ffmpegStatus < 0) {
+    VLOG(3) << "Could not seek to byte position " << pos << ": "
+            << getFFMPEGErrorStringFromErrorCode(ffmpegStatus)
+            << ". Seeking by timestamp instead.";
+    return false;
+  }
+  decodeStats_.numByteSeeks++;
+  return true;
+}
+
+int VideoDecoder::readPacket(AVPacket* packet) {
+  if (options_.numReadAheadPackets == 0) {
+    return av_read_frame(formatContext_.get(), packet);
+  }
+  if (!packetReadAhead_) {
+    packetReadAhead_ = std::make_unique<PacketReadAhead>(
+        formatContext_.get(),
+        activeStreamIndices_,
+        options_.numReadAheadPackets);
+  }
+  PacketReadAhead::ReadStats stats;
+  int ffmpegStatus = packetReadAhead_->readPacket(packet, stats);
+  decodeStats_.maxReadAheadQueueDepth =
+      std::max(decodeStats_.maxReadAheadQueueDepth, stats.queueDepth);
+  decodeStats_.maxReadAheadBytesBuffered =
+      std::max(decodeStats_.maxReadAheadBytesBuffered, stats.bytesBuffered);
+  decodeStats_.readAheadStallMicros += stats.stallMicros;
+  return ffmpegStatus;
+}
+
+void VideoDecoder::stopPacketReadAhead() {
+  packetReadAhead_.reset();
+}
+
+std::pair<int, UniqueAVFrame> VideoDecoder::decodeFrameWithFilter(
+    std::optional<int> requestedStreamIndex,
     std::function<bool(int, AVFrame*)> filterFunction) {
   if (activeStreamIndices_.size() == 0) {
     throw std::runtime_error("No active streams configured.");
   }
+  // The seek target in seconds, or -1 when decoding the next frame.
+  RECORD_FUNCTION(
+      "torchcodec::decode",
+      std::vector<c10::IValue>({maybeDesiredPts_.value_or(-1.0)}));
   VLOG(9) << "Starting getNextDecodedOutput()";
-  resetDecodeStats();
   if (maybeDesiredPts_.has_value()) {
     VLOG(9) << "maybeDesiredPts_=" << *maybeDesiredPts_;
+    auto seekStart = std::chrono::high_resolution_clock::now();
     maybeSeekToBeforeDesiredPts();
+    decodeStats_.seekMicros += getMicrosSince(seekStart);
     maybeDesiredPts_ = std::nullopt;
     VLOG(9) << "seeking done";
   }
@@ -599,16 +2652,34 @@ VideoDecoder::DecodedOutput VideoDecoder::getDecodedOutputWithFilter(
   UniqueAVFrame frame(av_frame_alloc());
   int ffmpegStatus = AVSUCCESS;
   bool reachedEOF = false;
+  // The streams whose codec is drained. The other streams may still hold
+  // frames, e.g. video frames after the last audio frame.
+  std::set<int> drainedStreamIndices;
   int frameStreamIndex = -1;
   while (true) {
     frameStreamIndex = -1;
     bool gotPermanentErrorOnAnyActiveStream = false;
     for (int streamIndex : activeStreamIndices_) {
+      if (drainedStreamIndices.count(streamIndex) > 0) {
+        continue;
+      }
       StreamInfo& streamInfo = streams_[streamIndex];
+      auto receiveStart = std::chrono::high_resolution_clock::now();
       ffmpegStatus =
           avcodec_receive_frame(streamInfo.codecContext.get(), frame.get());
+      decodeStats_.receiveFrameMicros += getMicrosSince(receiveStart);
       VLOG(9) << "received frame" << " status=" << ffmpegStatus
               << " streamIndex=" << streamInfo.stream->index;
+      if (ffmpegStatus == AVERROR_EOF) {
+        drainedStreamIndices.insert(streamIndex);
+        if (streamInfo.stream->codecpar->codec_type == AVMEDIA_TYPE_AUDIO) {
+          // The resampler still holds the delayed samples of the last frames.
+          appendAudioFrameToBuffer(streamIndex, /*frame=*/nullptr);
+        }
+        if (drainedStreamIndices.size() < activeStreamIndices_.size()) {
+          continue;
+        }
+      }
       bool gotNonRetriableError =
           ffmpegStatus != AVSUCCESS && ffmpegStatus != AVERROR(EAGAIN);
       if (gotNonRetriableError) {
@@ -626,11 +2697,32 @@ VideoDecoder::DecodedOutput VideoDecoder::getDecodedOutputWithFilter(
       break;
     }
     decodeStats_.numFramesReceivedByDecoder++;
+    if (ffmpegStatus == AVSUCCESS &&
+        streams_[frameStreamIndex].stream->codecpar->codec_type ==
+            AVMEDIA_TYPE_AUDIO) {
+      // Audio frames decoded on the way are kept, so that one pass over the
+      // file serves both the video and the audio streams.
+      auto conversionStart = std::chrono::high_resolution_clock::now();
+      appendAudioFrameToBuffer(frameStreamIndex, frame.get());
+      decodeStats_.conversionMicros += getMicrosSince(conversionStart);
+    }
     bool gotNeededFrame = ffmpegStatus == AVSUCCESS &&
         filterFunction(frameStreamIndex, frame.get());
     if (gotNeededFrame) {
       break;
     } else if (ffmpegStatus == AVSUCCESS) {
+      // Audio frames are buffered rather than discarded, and the frames of
+      // the streams that weren't asked for aren't a cost of this request.
+      bool isRequestedStream =
+          streams_[frameStreamIndex].stream->codecpar->codec_type ==
+              AVMEDIA_TYPE_VIDEO &&
+          requestedStreamIndex.value_or(frameStreamIndex) == frameStreamIndex;
+      if (isRequestedStream) {
+        decodeStats_.numFramesDiscarded++;
+      }
+      // The stream's codec is past this frame, so seeking back to it can't be
+      // skipped.
+      streams_[frameStreamIndex].currentPts = frame->pts;
       // No need to send more packets here as the decoder may have frames in
       // its buffer.
       continue;
@@ -641,7 +2733,9 @@ VideoDecoder::DecodedOutput VideoDecoder::getDecodedOutputWithFilter(
       continue;
     }
     UniqueAVPacket packet(av_packet_alloc());
-    ffmpegStatus = av_read_frame(formatContext_.get(), packet.get());
+    auto demuxStart = std::chrono::high_resolution_clock::now();
+    ffmpegStatus = readPacket(packet.get());
+    decodeStats_.demuxMicros += getMicrosSince(demuxStart);
     decodeStats_.numPacketsRead++;
     VLOG(9) << "av_read_frame returned status: " << ffmpegStatus;
     if (ffmpegStatus == AVERROR_EOF) {
@@ -672,8 +2766,14 @@ VideoDecoder::DecodedOutput VideoDecoder::getDecodedOutputWithFilter(
       // This packet is not for any of the active streams.
       continue;
     }
+    if (streams_[packet->stream_index].options.keyFramesOnly &&
+        !(packet->flags & AV_PKT_FLAG_KEY)) {
+      continue;
+    }
+    auto sendStart = std::chrono::high_resolution_clock::now();
     ffmpegStatus = avcodec_send_packet(
         streams_[packet->stream_index].codecContext.get(), packet.get());
+    decodeStats_.sendPacketMicros += getMicrosSince(sendStart);
     decodeStats_.numPacketsSentToDecoder++;
     if (ffmpegStatus < AVSUCCESS) {
       throw std::runtime_error(
@@ -681,6 +2781,9 @@ VideoDecoder::DecodedOutput VideoDecoder::getDecodedOutputWithFilter(
           getFFMPEGErrorStringFromErrorCode(ffmpegStatus));
     }
   }
+  if (ffmpegStatus == AVERROR_EOF) {
+    return {-1, nullptr};
+  }
   if (ffmpegStatus < AVSUCCESS) {
     throw std::runtime_error(
         "Could not receive frame from decoder: " +
@@ -697,13 +2800,166 @@ VideoDecoder::DecodedOutput VideoDecoder::getDecodedOutputWithFilter(
   activeStream.currentDuration = frame->pkt_duration;
   VLOG(3) << "Got frame: stream_index=" << activeStream.stream->index
           << " pts=" << frame->pts << " stats=" << decodeStats_;
+  return {frameStreamIndex, std::move(frame)};
+}
+
+VideoDecoder::DecodedOutput VideoDecoder::getDecodedOutputWithFilter(
+    std::optional<int> requestedStreamIndex,
+    std::function<bool(int, AVFrame*)> filterFunction,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  auto [frameStreamIndex, frame] =
+      decodeFrameWithFilter(requestedStreamIndex, filterFunction);
+  if (!frame) {
+    throw std::runtime_error(
+        "Could not receive frame from decoder: " +
+        getFFMPEGErrorStringFromErrorCode(AVERROR_EOF));
+  }
   // Convert the frame to tensor.
-  return convertAVFrameToDecodedOutput(frameStreamIndex, std::move(frame));
+  int64_t duration = frame->pkt_duration;
+  DecodedOutput output = convertAVFrameToDecodedOutput(
+      frameStreamIndex, std::move(frame), preAllocatedOutputTensor);
+  // Frames converted into the caller's tensor, which includes every frame of
+  // a batch, aren't cached: that would cost them a copy and evict the single
+  // frames that are requested again.
+  if (!preAllocatedOutputTensor.has_value()) {
+    maybeAddToFrameCache(output, duration);
+  }
+  return output;
+}
+
+std::optional<VideoDecoder::DecodedOutput> VideoDecoder::maybeGetFromFrameCache(
+    int streamIndex,
+    int64_t pts,
+    bool exactPts,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  // The entry with the largest key <= (streamIndex, pts) is the only one that
+  // can contain pts.
+  auto it = frameCacheIndex_.upper_bound({streamIndex, pts});
+  if (it == frameCacheIndex_.begin()) {
+    return std::nullopt;
+  }
+  --it;
+  const auto& [entryStreamIndex, entryPts] = it->first;
+  auto entry = it->second;
+  bool found = entryStreamIndex == streamIndex &&
+      (entryPts == pts || (!exactPts && pts < entryPts + entry->duration));
+  if (!found) {
+    return std::nullopt;
+  }
+  frameCacheEntries_.splice(
+      frameCacheEntries_.begin(), frameCacheEntries_, entry);
+  decodeStats_.numFrameCacheHits++;
+
+  // Place the cursor on the next frame, like a decode would have.
+  const StreamInfo& streamInfo = streams_[streamIndex];
+  int64_t nextPts = entryPts + std::max<int64_t>(entry->duration, 1);
+  auto nextFrame = std::upper_bound(
+      streamInfo.allFrames.begin(),
+      streamInfo.allFrames.end(),
+      entryPts,
+      [](int64_t value, const FrameInfo& frameInfo) {
+        return value < frameInfo.pts;
+      });
+  if (nextFrame != streamInfo.allFrames.end()) {
+    nextPts = nextFrame->pts;
+  }
+  setCursorPtsInSeconds(1.0 * nextPts / streamInfo.timeBase.den);
+
+  // Return a copy so callers can't modify the cached frame.
+  DecodedOutput output = entry->output;
+  if (preAllocatedOutputTensor.has_value()) {
+    validatePreAllocatedOutputTensor(
+        *preAllocatedOutputTensor,
+        output.frame.sizes(),
+        output.frame.scalar_type());
+    preAllocatedOutputTensor->copy_(output.frame);
+    output.frame = *preAllocatedOutputTensor;
+  } else {
+    output.frame = output.frame.clone();
+  }
+  VLOG(9) << "Frame cache hit: streamIndex=" << streamIndex
+          << " pts=" << entryPts;
+  return output;
+}
+
+std::optional<VideoDecoder::DecodedOutput>
+VideoDecoder::maybeGetNextDecodedOutputFromFrameCache(
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  // Without a pending seek the next frame is the one after the decoder's
+  // position, and decoding it is cheap. With several active streams the next
+  // frame may come from any of them, so we only handle a single stream.
+  if (options_.frameCacheCapacityBytes <= 0 || !maybeDesiredPts_.has_value() ||
+      activeStreamIndices_.size() != 1) {
+    return std::nullopt;
+  }
+  int streamIndex = *activeStreamIndices_.begin();
+  const StreamInfo& streamInfo = streams_[streamIndex];
+  int64_t desiredPts = *maybeDesiredPts_ * streamInfo.timeBase.den;
+  // We return the first frame on or after desiredPts. If the stream was
+  // scanned we know its exact pts. Otherwise we can only tell that a cached
+  // frame is that frame if it starts exactly at desiredPts.
+  auto frame = std::lower_bound(
+      streamInfo.allFrames.begin(),
+      streamInfo.allFrames.end(),
+      desiredPts,
+      [](const FrameInfo& frameInfo, int64_t value) {
+        return frameInfo.pts < value;
+      });
+  if (frame != streamInfo.allFrames.end()) {
+    desiredPts = frame->pts;
+  }
+  std::optional<DecodedOutput> output = maybeGetFromFrameCache(
+      streamIndex, desiredPts, /*exactPts=*/true, preAllocatedOutputTensor);
+  if (!output.has_value()) {
+    decodeStats_.numFrameCacheMisses++;
+  }
+  return output;
+}
+
+void VideoDecoder::maybeAddToFrameCache(
+    const DecodedOutput& output,
+    int64_t duration) {
+  if (options_.frameCacheCapacityBytes <= 0 ||
+      output.streamType != AVMEDIA_TYPE_VIDEO) {
+    return;
+  }
+  FrameCacheKey key = {output.streamIndex, output.pts};
+  auto existing = frameCacheIndex_.find(key);
+  if (existing != frameCacheIndex_.end()) {
+    frameCacheNumBytes_ -= existing->second->numBytes;
+    frameCacheEntries_.erase(existing->second);
+    frameCacheIndex_.erase(existing);
+  }
+  int64_t numBytes = output.frame.numel() * output.frame.element_size();
+  if (numBytes > options_.frameCacheCapacityBytes) {
+    return;
+  }
+  while (frameCacheNumBytes_ + numBytes > options_.frameCacheCapacityBytes) {
+    const FrameCacheEntry& oldest = frameCacheEntries_.back();
+    frameCacheNumBytes_ -= oldest.numBytes;
+    frameCacheIndex_.erase({oldest.output.streamIndex, oldest.output.pts});
+    frameCacheEntries_.pop_back();
+  }
+  FrameCacheEntry entry;
+  entry.output = output;
+  // The output may be a view of the filter graph's frame, so we keep a copy.
+  entry.output.frame = output.frame.clone();
+  entry.duration = duration;
+  entry.numBytes = numBytes;
+  frameCacheEntries_.push_front(std::move(entry));
+  frameCacheIndex_[key] = frameCacheEntries_.begin();
+  frameCacheNumBytes_ += numBytes;
 }
 
 VideoDecoder::DecodedOutput VideoDecoder::convertAVFrameToDecodedOutput(
     int streamIndex,
-    UniqueAVFrame frame) {
+    UniqueAVFrame frame,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  RECORD_FUNCTION(
+      "torchcodec::convert",
+      std::vector<c10::IValue>({frame->width, frame->height}));
+  auto start = std::chrono::high_resolution_clock::now();
+  int64_t conversionMicrosBefore = decodeStats_.conversionMicros;
   // Convert the frame to tensor.
   DecodedOutput output;
   output.streamIndex = streamIndex;
@@ -712,33 +2968,118 @@ VideoDecoder::DecodedOutput VideoDecoder::convertAVFrameToDecodedOutput(
   output.ptsSeconds =
       1.0 * frame->pts / formatContext_->streams[streamIndex]->time_base.den;
   if (output.streamType == AVMEDIA_TYPE_VIDEO) {
-    output.frame =
-        convertFrameToTensorUsingFilterGraph(streamIndex, frame.get());
+    const VideoStreamDecoderOptions& options = streams_[streamIndex].options;
+    if (options.crop.has_value()) {
+      // Only the crop region is converted below.
+      frame = cropFrame(frame.get(), *options.crop);
+    }
+    auto [width, height] =
+        getOutputFrameSize(options, frame->width, frame->height);
+    bool isTransformRequested = options.horizontalFlip ||
+        width != frame->width || height != frame->height;
+    if (!isTransformRequested &&
+        hasOutputPixelFormat(frame.get(), options.outputFormat)) {
+      output.frame = copyFramePlanesToTensor(
+          streamIndex, frame.get(), preAllocatedOutputTensor);
+    } else if (
+        options.colorConversionLibrary == ColorConversionLibrary::SWSCALE) {
+      output.frame = convertFrameToTensorUsingSwsScale(
+          streamIndex, frame.get(), preAllocatedOutputTensor);
+    } else {
+      output.frame = convertFrameToTensorUsingFilterGraph(
+          streamIndex, frame.get(), preAllocatedOutputTensor);
+    }
   } else if (output.streamType == AVMEDIA_TYPE_AUDIO) {
-    // TODO: implement audio AVFrame to Tensor conversion here.
-    throw std::runtime_error("Audio is not supported yet.");
+    // Audio frames are only resampled into the stream's buffer, see
+    // getAudioSamplesInRange().
+    throw std::runtime_error(
+        "Audio frames can't be returned as frames, use "
+        "getAudioSamplesInRange().");
   }
+  // The rest of the time went to allocating and filling the output tensor.
+  decodeStats_.tensorMicros += getMicrosSince(start) -
+      (decodeStats_.conversionMicros - conversionMicrosBefore);
   return output;
 }
 
+std::optional<int64_t> VideoDecoder::getFrameIndexDisplayedAt(
+    const StreamInfo& streamInfo,
+    double seconds) const {
+  auto nextFrame = std::upper_bound(
+      streamInfo.allFrames.begin(),
+      streamInfo.allFrames.end(),
+      seconds,
+      [&streamInfo](double value, const FrameInfo& frameInfo) {
+        return value < 1.0 * frameInfo.pts / streamInfo.timeBase.den;
+      });
+  if (nextFrame == streamInfo.allFrames.begin()) {
+    return std::nullopt;
+  }
+  const FrameInfo& frameInfo = *(nextFrame - 1);
+  double frameEndTime =
+      1.0 * (frameInfo.pts + frameInfo.duration) / streamInfo.timeBase.den;
+  if (seconds >= frameEndTime) {
+    return std::nullopt;
+  }
+  return nextFrame - 1 - streamInfo.allFrames.begin();
+}
+
 VideoDecoder::DecodedOutput VideoDecoder::getFrameDisplayedAtTimestamp(
-    double seconds) {
+    double seconds,
+    std::optional<SeekAccuracy> accuracy) {
+  DecodeStatsScope decodeStatsScope(*this);
+  if (activeStreamIndices_.size() == 1) {
+    int streamIndex = *activeStreamIndices_.begin();
+    const StreamInfo& streamInfo = streams_[streamIndex];
+    std::optional<int64_t> approximateFrameIndex = getApproximateFrameIndex(
+        streamInfo,
+        seconds,
+        accuracy.value_or(streamInfo.options.seekAccuracy));
+    if (approximateFrameIndex.has_value()) {
+      int64_t pts = streamInfo.allFrames[*approximateFrameIndex].pts;
+      std::optional<DecodedOutput> cachedOutput =
+          maybeGetFromFrameCache(streamIndex, pts, /*exactPts=*/true);
+      if (cachedOutput.has_value()) {
+        return *cachedOutput;
+      }
+      setCursorPtsInSeconds(1.0 * pts / streamInfo.timeBase.den);
+      return getNextDecodedOutput();
+    }
+    int64_t pts = seconds * streamInfo.timeBase.den;
+    std::optional<DecodedOutput> cachedOutput =
+        maybeGetFromFrameCache(streamIndex, pts, /*exactPts=*/false);
+    if (cachedOutput.has_value()) {
+      return *cachedOutput;
+    }
+    // The scanned index knows the duration of every frame, so it tells us
+    // which frame is displayed without having to decode anything first.
+    std::optional<int64_t> frameIndex =
+        getFrameIndexDisplayedAt(streamInfo, seconds);
+    if (frameIndex.has_value()) {
+      const FrameInfo& frameInfo = streamInfo.allFrames[*frameIndex];
+      setCursorPtsInSeconds(1.0 * frameInfo.pts / streamInfo.timeBase.den);
+      return getNextDecodedOutput();
+    }
+  }
   for (auto& [streamIndex, stream] : streams_) {
     double frameStartTime = 1.0 * stream.currentPts / stream.timeBase.den;
     double frameEndTime = 1.0 * (stream.currentPts + stream.currentDuration) /
         stream.timeBase.den;
     if (seconds >= frameStartTime && seconds < frameEndTime) {
-      // We are in the same frame as the one we just returned. However, since we
-      // don't cache it locally, we have to rewind back.
-      // TODO: add caching so we don't have to do this.
+      // We are in the same frame as the one we just returned. Since it isn't
+      // in the frame cache, we have to rewind back.
       seconds = frameStartTime;
       break;
     }
   }
   setCursorPtsInSeconds(seconds);
   return getDecodedOutputWithFilter(
+      /*requestedStreamIndex=*/std::nullopt,
       [seconds, this](int frameStreamIndex, AVFrame* frame) {
         StreamInfo& stream = streams_[frameStreamIndex];
+        if (stream.stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
+          return false;
+        }
         double frameStartTime = 1.0 * frame->pts / stream.timeBase.den;
         double frameEndTime =
             1.0 * (frame->pts + frame->pkt_duration) / stream.timeBase.den;
@@ -748,7 +3089,9 @@ VideoDecoder::DecodedOutput VideoDecoder::getFrameDisplayedAtTimestamp(
 
 VideoDecoder::DecodedOutput VideoDecoder::getFrameAtIndex(
     int streamIndex,
-    int64_t frameIndex) {
+    int64_t frameIndex,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  DecodeStatsScope decodeStatsScope(*this);
   if (streamIndex < 0 || streamIndex >= containerMetadata_.streams.size()) {
     throw std::runtime_error(
         "Invalid stream index=" + std::to_string(streamIndex));
@@ -757,6 +3100,7 @@ VideoDecoder::DecodedOutput VideoDecoder::getFrameAtIndex(
     throw std::runtime_error(
         "streamIndex=" + std::to_string(streamIndex) + " not added to decoder");
   }
+  validateVideoStream(streamIndex);
   const auto& stream = streams_[streamIndex];
   if (frameIndex < 0 || frameIndex >= stream.allFrames.size()) {
     throw std::runtime_error(
@@ -764,82 +3108,749 @@ VideoDecoder::DecodedOutput VideoDecoder::getFrameAtIndex(
         " for streamIndex=" + std::to_string(streamIndex) +
         " numFrames=" + std::to_string(streams_[streamIndex].allFrames.size()));
   }
+  validateFrameIsDecodable(stream, frameIndex);
   int64_t pts = stream.allFrames[frameIndex].pts;
   setCursorPtsInSeconds(1.0 * pts / stream.timeBase.den);
-  return getNextDecodedOutput();
+  return getNextDecodedOutputFromStream(streamIndex, preAllocatedOutputTensor);
 }
 
 VideoDecoder::BatchDecodedOutput VideoDecoder::getFramesAtIndexes(
     int streamIndex,
-    const std::vector<int64_t>& frameIndexes) {
+    const std::vector<int64_t>& frameIndexes,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  DecodeStatsScope decodeStatsScope(*this);
   if (streamIndex < 0 || streamIndex >= containerMetadata_.streams.size()) {
     throw std::runtime_error(
         "Invalid stream index=" + std::to_string(streamIndex));
   }
+  validateVideoStream(streamIndex);
   BatchDecodedOutput output;
-  const auto& streamMetadata = containerMetadata_.streams[streamIndex];
-  const auto& options = streams_[streamIndex].options;
-  if (options.shape == "NHWC") {
-    output.frames = torch::empty(
-        {(long)frameIndexes.size(),
-         options.height.value_or(*streamMetadata.height),
-         options.width.value_or(*streamMetadata.width),
-         3},
-        {torch::kUInt8});
-  } else if (options.shape == "NCHW") {
-    output.frames = torch::empty(
-        {(long)frameIndexes.size(),
-         3,
-         options.height.value_or(*streamMetadata.height),
-         options.width.value_or(*streamMetadata.width)},
-        {torch::kUInt8});
+  output.frames = allocateBatchOutputTensor(
+      streamIndex, frameIndexes.size(), preAllocatedOutputTensor);
+  const auto& stream = streams_[streamIndex];
+  for (int64_t frameIndex : frameIndexes) {
+    if (frameIndex < 0 || frameIndex >= stream.allFrames.size()) {
+      throw std::runtime_error(
+          "Invalid frame index=" + std::to_string(frameIndex));
+    }
+    validateFrameIsDecodable(stream, frameIndex);
+  }
+  std::vector<FrameBatchSegment> segments =
+      planFrameBatch(stream, frameIndexes);
+  int numThreads = options_.numBatchDecodeThreads == 0
+      ? at::get_num_threads()
+      : options_.numBatchDecodeThreads;
+  // Segments jump around the file, so reading ahead of them would mostly
+  // fetch pages we don't need. Each segment asks for its own range instead.
+  // The batch workers share our mapping, so the advice covers them too.
+  MemoryMappedFile::ScopedAccessPattern randomAccess(
+      memoryMappedFile_.get(), MemoryMappedFile::AccessPattern::RANDOM);
+  if (numThreads > 1 && segments.size() > 1) {
+    decodeFrameBatchSegmentsInParallel(streamIndex, segments, output.frames);
   } else {
-    throw std::runtime_error("Unsupported frame shape=" + options.shape);
+    decodeFrameBatchSegments(streamIndex, segments, output.frames);
   }
-  int i = 0;
+  return output;
+}
+
+VideoDecoder::BatchDecodedOutput VideoDecoder::getFramesDisplayedAtTimestamps(
+    int streamIndex,
+    const std::vector<double>& timestamps,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  DecodeStatsScope decodeStatsScope(*this);
   if (streams_.count(streamIndex) == 0) {
     throw std::runtime_error(
         "Invalid stream index=" + std::to_string(streamIndex));
   }
-  const auto& stream = streams_[streamIndex];
-  for (int64_t frameIndex : frameIndexes) {
-    if (frameIndex < 0 || frameIndex >= stream.allFrames.size()) {
+  const StreamInfo& streamInfo = streams_[streamIndex];
+  std::vector<int64_t> frameIndexes;
+  frameIndexes.reserve(timestamps.size());
+  for (double seconds : timestamps) {
+    std::optional<int64_t> frameIndex =
+        getFrameIndexDisplayedAt(streamInfo, seconds);
+    if (!frameIndex.has_value()) {
       throw std::runtime_error(
-          "Invalid frame index=" + std::to_string(frameIndex));
+          "No frame is displayed at timestamp=" + std::to_string(seconds));
+    }
+    frameIndexes.push_back(*frameIndex);
+  }
+  return getFramesAtIndexes(
+      streamIndex, frameIndexes, preAllocatedOutputTensor);
+}
+
+std::vector<torch::Tensor> VideoDecoder::decodeVideos(
+    const std::vector<VideoDecodeRequest>& requests,
+    const DecoderOptions& options,
+    const VideoStreamDecoderOptions& streamOptions,
+    int numThreads) {
+  std::vector<torch::Tensor> outputs(requests.size());
+  if (numThreads == 0) {
+    numThreads = at::get_num_threads();
+  }
+  numThreads = std::min<int64_t>(numThreads, requests.size());
+  // Videos vary a lot in how long they take to decode, so instead of giving
+  // each thread a fixed share of them, threads take the next video from a
+  // shared counter.
+  std::atomic<size_t> nextRequest{0};
+  auto decodeNextVideos = [&]() {
+    size_t i;
+    while ((i = nextRequest++) < requests.size()) {
+      const VideoDecodeRequest& request = requests[i];
+      std::unique_ptr<VideoDecoder> decoder = request.videoFilePath.empty()
+          ? createFromBuffer(request.buffer, request.length, options)
+          : createFromFilePath(request.videoFilePath, options);
+      decoder->scanFileAndUpdateMetadataAndIndex();
+      std::optional<int> streamIndex =
+          decoder->getContainerMetadata().bestVideoStreamIndex;
+      if (!streamIndex.has_value()) {
+        throw std::invalid_argument("No valid stream found in input file.");
+      }
+      decoder->addVideoStreamDecoder(*streamIndex, streamOptions);
+      outputs[i] = request.timestamps.empty()
+          ? decoder->getFramesAtIndexes(*streamIndex, request.frameIndexes)
+                .frames
+          : decoder
+                ->getFramesDisplayedAtTimestamps(
+                    *streamIndex, request.timestamps)
+                .frames;
+    }
+  };
+  if (numThreads <= 1) {
+    decodeNextVideos();
+    return outputs;
+  }
+  VLOG(5) << "Decoding " << requests.size() << " videos with " << numThreads
+          << " threads";
+  runOnThreads(numThreads, [&](int) { decodeNextVideos(); });
+  return outputs;
+}
+
+VideoDecoder::BatchDecodedOutput VideoDecoder::getKeyFrames(
+    int streamIndex,
+    int64_t step,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  DecodeStatsScope decodeStatsScope(*this);
+  if (streams_.count(streamIndex) == 0) {
+    throw std::runtime_error(
+        "Invalid stream index=" + std::to_string(streamIndex));
+  }
+  if (step <= 0) {
+    throw std::runtime_error(
+        "Invalid step=" + std::to_string(step) + ". step must be > 0.");
+  }
+  const StreamInfo& streamInfo = streams_[streamIndex];
+  std::vector<int64_t> frameIndexes;
+  for (size_t i = 0; i < streamInfo.keyFrames.size(); i += step) {
+    int64_t pts = streamInfo.keyFrames[i].pts;
+    auto frame = std::lower_bound(
+        streamInfo.allFrames.begin(),
+        streamInfo.allFrames.end(),
+        pts,
+        [](const FrameInfo& frameInfo, int64_t value) {
+          return frameInfo.pts < value;
+        });
+    TORCH_CHECK(
+        frame != streamInfo.allFrames.end() && frame->pts == pts,
+        "Key frame with pts=",
+        pts,
+        " is missing from the scanned index");
+    frameIndexes.push_back(frame - streamInfo.allFrames.begin());
+  }
+  // Each key frame is its own segment, so this only decodes the key frames
+  // and can decode them in parallel.
+  return getFramesAtIndexes(
+      streamIndex, frameIndexes, preAllocatedOutputTensor);
+}
+
+VideoDecoder::BatchDecodedOutput VideoDecoder::getFramesInRange(
+    int streamIndex,
+    int64_t start,
+    int64_t stop,
+    int64_t step,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  DecodeStatsScope decodeStatsScope(*this);
+  if (streamIndex < 0 || streamIndex >= containerMetadata_.streams.size() ||
+      activeStreamIndices_.count(streamIndex) == 0) {
+    throw std::runtime_error(
+        "Invalid stream index=" + std::to_string(streamIndex));
+  }
+  validateVideoStream(streamIndex);
+  const StreamInfo& streamInfo = streams_[streamIndex];
+  int64_t numFrames = streamInfo.allFrames.size();
+  if (start < 0 || start > stop || stop > numFrames || step <= 0) {
+    throw std::runtime_error(
+        "Invalid frame range start=" + std::to_string(start) +
+        " stop=" + std::to_string(stop) + " step=" + std::to_string(step) +
+        " for streamIndex=" + std::to_string(streamIndex) +
+        " numFrames=" + std::to_string(numFrames));
+  }
+  int64_t numOutputFrames = (stop - start + step - 1) / step;
+  for (int64_t i = 0; i < numOutputFrames; ++i) {
+    validateFrameIsDecodable(streamInfo, start + i * step);
+  }
+  BatchDecodedOutput output;
+  output.frames = allocateBatchOutputTensor(
+      streamIndex, numOutputFrames, preAllocatedOutputTensor);
+  for (int64_t i = 0; i < numOutputFrames; ++i) {
+    int64_t frameIndex = start + i * step;
+    int64_t pts = streamInfo.allFrames[frameIndex].pts;
+    // We seek when the frame's key frame comes after the frame that follows
+    // the previous one, which skips decoding the frames in between. Within a
+    // GOP, and from one GOP into the next, we keep decoding forward.
+    int keyFrameIndex =
+        getKeyFrameIndexForPtsUsingScannedIndex(streamInfo.keyFrames, pts);
+    bool mustSeek = i == 0 ||
+        (keyFrameIndex >= 0 &&
+         streamInfo.keyFrames[keyFrameIndex].pts >
+             streamInfo.allFrames[frameIndex - step + 1].pts);
+    if (mustSeek) {
+      setCursorPtsInSeconds(1.0 * pts / streamInfo.timeBase.den);
+    }
+    // Frames of other streams and the frames between two requested ones are
+    // dropped before they are converted.
+    getDecodedOutputWithFilter(
+        streamIndex,
+        [streamIndex, pts](int frameStreamIndex, AVFrame* frame) {
+          return frameStreamIndex == streamIndex && frame->pts >= pts;
+        },
+        output.frames[i]);
+  }
+  return output;
+}
+
+void VideoDecoder::appendAudioFrameToBuffer(
+    int streamIndex,
+    const AVFrame* frame) {
+  int numInputSamples = frame != nullptr ? frame->nb_samples : 0;
+  RECORD_FUNCTION(
+      "torchcodec::resample", std::vector<c10::IValue>({numInputSamples}));
+  StreamInfo& streamInfo = streams_[streamIndex];
+  AudioBuffer& audioBuffer = streamInfo.audioBuffer;
+  if (!streamInfo.swrContext) {
+    if (frame == nullptr) {
+      // Nothing was resampled since the last seek.
+      return;
+    }
+    streamInfo.swrContext = createSwrContext(
+        frame, streamInfo.outputSampleRate, streamInfo.outputNumChannels);
+    audioBuffer = AudioBuffer();
+    if (frame->pts != AV_NOPTS_VALUE) {
+      audioBuffer.startSeconds = frame->pts * av_q2d(streamInfo.timeBase);
+    }
+  }
+  int maxNumSamples =
+      swr_get_out_samples(streamInfo.swrContext.get(), numInputSamples);
+  torch::Tensor samples = torch::empty(
+      {streamInfo.outputNumChannels, maxNumSamples}, {torch::kFloat32});
+  // The planes of AV_SAMPLE_FMT_FLTP are the rows of `samples`.
+  std::vector<uint8_t*> planes(streamInfo.outputNumChannels);
+  for (int channel = 0; channel < streamInfo.outputNumChannels; ++channel) {
+    planes[channel] = reinterpret_cast<uint8_t*>(
+        samples.data_ptr<float>() + channel * maxNumSamples);
+  }
+  int numSamples = swr_convert(
+      streamInfo.swrContext.get(),
+      planes.data(),
+      maxNumSamples,
+      frame != nullptr ? const_cast<const uint8_t**>(frame->extended_data)
+                       : nullptr,
+      numInputSamples);
+  if (numSamples < 0) {
+    throw std::runtime_error(
+        "Failed to resample audio frame: " +
+        getFFMPEGErrorStringFromErrorCode(numSamples));
+  }
+  if (numSamples == 0) {
+    return;
+  }
+  audioBuffer.chunks.push_back(samples.narrow(1, 0, numSamples));
+  audioBuffer.numSamples += numSamples;
+  // Drop the oldest chunks that aren't needed to keep bufferSeconds, unless
+  // they hold samples of the range getAudioSamplesInRange() is decoding.
+  int64_t maxNumBufferedSamples =
+      streamInfo.audioOptions.bufferSeconds * streamInfo.outputSampleRate;
+  while (audioBuffer.chunks.size() > 1 &&
+         audioBuffer.numSamples - audioBuffer.chunks.front().size(1) >=
+             maxNumBufferedSamples) {
+    int64_t numDroppedSamples = audioBuffer.chunks.front().size(1);
+    if (streamInfo.audioRangeStartSeconds.has_value() &&
+        audioBuffer.startSeconds +
+                1.0 * numDroppedSamples / streamInfo.outputSampleRate >
+            *streamInfo.audioRangeStartSeconds) {
+      break;
+    }
+    audioBuffer.startSeconds +=
+        1.0 * numDroppedSamples / streamInfo.outputSampleRate;
+    audioBuffer.numSamples -= numDroppedSamples;
+    audioBuffer.chunks.pop_front();
+  }
+}
+
+torch::Tensor VideoDecoder::getAudioSamplesInRange(
+    int streamIndex,
+    double startSeconds,
+    double stopSeconds,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  DecodeStatsScope decodeStatsScope(*this);
+  if (activeStreamIndices_.count(streamIndex) == 0 ||
+      streams_[streamIndex].stream->codecpar->codec_type !=
+          AVMEDIA_TYPE_AUDIO) {
+    throw std::runtime_error(
+        "Invalid audio stream index=" + std::to_string(streamIndex));
+  }
+  if (startSeconds > stopSeconds) {
+    throw std::runtime_error(
+        "Invalid audio range start_seconds=" + std::to_string(startSeconds) +
+        " stop_seconds=" + std::to_string(stopSeconds));
+  }
+  StreamInfo& streamInfo = streams_[streamIndex];
+  const int sampleRate = streamInfo.outputSampleRate;
+  std::vector<int64_t> shape = {
+      streamInfo.outputNumChannels,
+      std::lround((stopSeconds - startSeconds) * sampleRate)};
+  torch::Tensor output;
+  if (preAllocatedOutputTensor.has_value()) {
+    validatePreAllocatedOutputTensor(
+        *preAllocatedOutputTensor, shape, torch::kFloat32);
+    output = *preAllocatedOutputTensor;
+  } else {
+    output = torch::empty(shape, {torch::kFloat32});
+  }
+
+  const AudioBuffer& audioBuffer = streamInfo.audioBuffer;
+  auto getBufferEndSeconds = [&audioBuffer, sampleRate]() {
+    return audioBuffer.startSeconds + 1.0 * audioBuffer.numSamples / sampleRate;
+  };
+  auto isStartBuffered = [&audioBuffer, startSeconds, &getBufferEndSeconds]() {
+    return audioBuffer.numSamples > 0 &&
+        startSeconds >= audioBuffer.startSeconds &&
+        startSeconds <= getBufferEndSeconds();
+  };
+  // There are no samples before the start of the stream.
+  double firstSampleSeconds = streamInfo.stream->start_time != AV_NOPTS_VALUE
+      ? streamInfo.stream->start_time * av_q2d(streamInfo.timeBase)
+      : 0;
+  double expectedBufferStartSeconds =
+      std::max(startSeconds, firstSampleSeconds) + 1.0 / sampleRate;
+  // The audio seeks have their own target. Once the audio is decoded, the
+  // video streams resume where they were: at the seek that is still pending,
+  // or else at the frame after the last one they returned, since the video
+  // frames decoded for the audio are discarded.
+  std::optional<double> videoDesiredPts = maybeDesiredPts_;
+  if (!videoDesiredPts.has_value()) {
+    for (int activeStreamIndex : activeStreamIndices_) {
+      const StreamInfo& activeStream = streams_[activeStreamIndex];
+      if (activeStream.stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
+        continue;
+      }
+      double nextFramePts =
+          (activeStream.currentPts + activeStream.currentDuration) *
+          av_q2d(activeStream.timeBase);
+      videoDesiredPts =
+          std::min(videoDesiredPts.value_or(nextFramePts), nextFramePts);
+    }
+  }
+  std::optional<double> pendingDesiredPts = maybeDesiredPts_;
+  maybeDesiredPts_ = std::nullopt;
+  streamInfo.audioRangeStartSeconds = startSeconds;
+  double seekSeconds = startSeconds;
+  for (int attempt = 0;; ++attempt) {
+    if (!isStartBuffered()) {
+      maybeDesiredPts_ = std::max(seekSeconds, 0.0);
+    }
+    if (maybeDesiredPts_.has_value() || getBufferEndSeconds() < stopSeconds) {
+      // The video streams have to seek back unless we are served from the
+      // buffer.
+      pendingDesiredPts = videoDesiredPts;
+      // Returns a null frame if the file ends first, and the rest is zeros.
+      decodeFrameWithFilter(
+          streamIndex,
+          [streamIndex, stopSeconds, &getBufferEndSeconds](
+              int frameStreamIndex, AVFrame*) {
+            return frameStreamIndex == streamIndex &&
+                getBufferEndSeconds() >= stopSeconds;
+          });
+    }
+    bool isStartMissing = audioBuffer.numSamples > 0 &&
+        audioBuffer.startSeconds > expectedBufferStartSeconds;
+    if (!isStartMissing) {
+      break;
     }
-    int64_t pts = stream.allFrames[frameIndex].pts;
-    setCursorPtsInSeconds(1.0 * pts / stream.timeBase.den);
-    torch::Tensor frame = getNextDecodedOutput().frame;
-    output.frames[i++] = frame;
+    if (attempt == kMaxAudioSeekRetries) {
+      streamInfo.audioRangeStartSeconds = std::nullopt;
+      maybeDesiredPts_ = pendingDesiredPts;
+      throw std::runtime_error(
+          "Could not decode audio from start_seconds=" +
+          std::to_string(startSeconds) + ", the first decoded sample is at " +
+          std::to_string(audioBuffer.startSeconds) + " seconds");
+    }
+    // The demuxer resumed after startSeconds, e.g. at the position of a video
+    // key frame, so we seek from further back.
+    seekSeconds = startSeconds - (1 << attempt);
+  }
+  streamInfo.audioRangeStartSeconds = std::nullopt;
+  maybeDesiredPts_ = pendingDesiredPts;
+
+  // The position in `output` of the first buffered sample.
+  int64_t outputPosition =
+      std::lround((audioBuffer.startSeconds - startSeconds) * sampleRate);
+  int64_t numOutputSamples = shape[1];
+  int64_t firstCopiedPosition =
+      std::clamp<int64_t>(outputPosition, 0, numOutputSamples);
+  for (const torch::Tensor& chunk : audioBuffer.chunks) {
+    int64_t chunkSize = chunk.size(1);
+    int64_t begin = std::max<int64_t>(outputPosition, 0);
+    int64_t end = std::min(outputPosition + chunkSize, numOutputSamples);
+    if (begin < end) {
+      output.narrow(1, begin, end - begin)
+          .copy_(chunk.narrow(1, begin - outputPosition, end - begin));
+    }
+    outputPosition += chunkSize;
   }
+  int64_t lastCopiedPosition = std::clamp<int64_t>(
+      outputPosition, firstCopiedPosition, numOutputSamples);
+  output.narrow(1, 0, firstCopiedPosition).zero_();
+  output.narrow(1, lastCopiedPosition, numOutputSamples - lastCopiedPosition)
+      .zero_();
   return output;
 }
 
-VideoDecoder::DecodedOutput VideoDecoder::getNextDecodedOutput() {
+torch::Tensor VideoDecoder::allocateBatchOutputTensor(
+    int streamIndex,
+    int64_t numFrames,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  const auto& streamMetadata = containerMetadata_.streams[streamIndex];
+  const auto& options = streams_[streamIndex].options;
+  auto [width, height] = getOutputFrameSize(
+      options, *streamMetadata.width, *streamMetadata.height);
+  std::vector<int64_t> shape = getFrameShape(options, height, width);
+  shape.insert(shape.begin(), numFrames);
+  if (preAllocatedOutputTensor.has_value()) {
+    validatePreAllocatedOutputTensor(
+        *preAllocatedOutputTensor, shape, options.dtype);
+    return *preAllocatedOutputTensor;
+  }
+  return torch::empty(shape, {options.dtype});
+}
+
+std::vector<VideoDecoder::FrameBatchSegment> VideoDecoder::planFrameBatch(
+    const StreamInfo& streamInfo,
+    const std::vector<int64_t>& frameIndexes) const {
+  // Visit the requested positions in frame order so that we only ever decode
+  // forward. allFrames is sorted by pts, so frame order is also pts order.
+  std::vector<int64_t> positions(frameIndexes.size());
+  std::iota(positions.begin(), positions.end(), 0);
+  std::stable_sort(
+      positions.begin(),
+      positions.end(),
+      [&frameIndexes](int64_t a, int64_t b) {
+        return frameIndexes[a] < frameIndexes[b];
+      });
+  std::vector<FrameBatchSegment> segments;
+  for (int64_t position : positions) {
+    int64_t frameIndex = frameIndexes[position];
+    int keyFrameIndex = getKeyFrameIndexForPts(
+        streamInfo, streamInfo.allFrames[frameIndex].pts);
+    if (segments.empty() || segments.back().keyFrameIndex != keyFrameIndex) {
+      segments.emplace_back();
+      segments.back().keyFrameIndex = keyFrameIndex;
+    }
+    FrameBatchSegment& segment = segments.back();
+    if (segment.frameIndexes.empty() ||
+        segment.frameIndexes.back() != frameIndex) {
+      segment.frameIndexes.push_back(frameIndex);
+      segment.outputPositions.emplace_back();
+    }
+    segment.outputPositions.back().push_back(position);
+  }
+  VLOG(5) << "Planned " << frameIndexes.size() << " frames into "
+          << segments.size() << " key frame segments";
+  return segments;
+}
+
+void VideoDecoder::decodeFrameBatchSegments(
+    int streamIndex,
+    const std::vector<FrameBatchSegment>& segments,
+    torch::Tensor& frames) {
+  const auto& streamInfo = streams_[streamIndex];
+  // The reads of the next few segments are issued together, so they can
+  // complete while we decode the current one.
+  constexpr size_t kNumPrefetchedSegments = 4;
+  for (size_t segmentIndex = 0; segmentIndex < segments.size();
+       ++segmentIndex) {
+    std::vector<std::pair<int64_t, int64_t>> ptsRanges;
+    size_t end =
+        std::min(segmentIndex + kNumPrefetchedSegments, segments.size());
+    for (size_t j = segmentIndex; j < end; ++j) {
+      ptsRanges.emplace_back(
+          streamInfo.allFrames[segments[j].frameIndexes.front()].pts,
+          streamInfo.allFrames[segments[j].frameIndexes.back()].pts);
+    }
+    maybePrefetchPtsRanges(streamInfo, ptsRanges);
+    const FrameBatchSegment& segment = segments[segmentIndex];
+    RECORD_FUNCTION(
+        "torchcodec::decode_segment",
+        getFrameBatchSegmentProfilerInputs(streamInfo, segment));
+    // Only the first frame of a segment may need a seek. The following ones
+    // share its key frame and are decoded by moving forward. See
+    // canWeAvoidSeekingForStream() for details.
+    for (size_t i = 0; i < segment.frameIndexes.size(); ++i) {
+      int64_t pts = streamInfo.allFrames[segment.frameIndexes[i]].pts;
+      setCursorPtsInSeconds(1.0 * pts / streamInfo.timeBase.den);
+      // The frame is converted directly into its first output position and
+      // copied to the other ones.
+      const std::vector<int64_t>& outputPositions = segment.outputPositions[i];
+      torch::Tensor frame = getNextDecodedOutputFromStream(
+                                streamIndex, frames[outputPositions[0]])
+                                .frame;
+      for (size_t j = 1; j < outputPositions.size(); ++j) {
+        frames[outputPositions[j]] = frame;
+      }
+    }
+  }
+}
+
+void VideoDecoder::decodeFrameBatchSegmentsInParallel(
+    int streamIndex,
+    const std::vector<FrameBatchSegment>& segments,
+    torch::Tensor& frames) {
+  int numThreads = options_.numBatchDecodeThreads == 0
+      ? at::get_num_threads()
+      : options_.numBatchDecodeThreads;
+  int numChunks = std::min<int>(numThreads, segments.size());
+  const StreamInfo& streamInfo = streams_[streamIndex];
+
+  // The cost of a segment is the number of frames decoded for it.
+  std::vector<int64_t> costs;
+  int64_t totalCost = 0;
+  for (const FrameBatchSegment& segment : segments) {
+    costs.push_back(getNumFramesToDecode(streamInfo, segment));
+    totalCost += costs.back();
+  }
+  // Chunk i gets the segments whose cumulative cost falls in
+  // [i * totalCost / numChunks, (i + 1) * totalCost / numChunks).
+  std::vector<std::vector<FrameBatchSegment>> chunks(numChunks);
+  int64_t cumulativeCost = 0;
+  for (size_t i = 0; i < segments.size(); ++i) {
+    int chunk = std::min<int64_t>(
+        cumulativeCost * numChunks / std::max<int64_t>(totalCost, 1),
+        numChunks - 1);
+    chunks[chunk].push_back(segments[i]);
+    cumulativeCost += costs[i];
+  }
+
+  auto& workers = batchWorkers_[streamIndex];
+  while (workers.size() < numChunks) {
+    workers.push_back(createBatchWorker(streamIndex));
+  }
+  VLOG(5) << "Decoding " << segments.size() << " segments with " << numChunks
+          << " threads";
+  runOnThreads(numChunks, [&](int chunk) {
+    workers[chunk]->decodeFrameBatchSegments(
+        streamIndex, chunks[chunk], frames);
+  });
+  for (int chunk = 0; chunk < numChunks; ++chunk) {
+    addDecodeStats(decodeStats_, workers[chunk]->getCumulativeDecodeStats());
+    workers[chunk]->resetDecodeStats();
+  }
+}
+
+int64_t VideoDecoder::getNumFramesToDecode(
+    const StreamInfo& streamInfo,
+    const FrameBatchSegment& segment) const {
+  int64_t firstFrameIndex = segment.frameIndexes.front();
+  if (segment.keyFrameIndex >= 0 &&
+      segment.keyFrameIndex < streamInfo.keyFrames.size()) {
+    int64_t keyFramePts = streamInfo.keyFrames[segment.keyFrameIndex].pts;
+    firstFrameIndex = std::lower_bound(
+                          streamInfo.allFrames.begin(),
+                          streamInfo.allFrames.end(),
+                          keyFramePts,
+                          [](const FrameInfo& frameInfo, int64_t value) {
+                            return frameInfo.pts < value;
+                          }) -
+        streamInfo.allFrames.begin();
+  }
+  return segment.frameIndexes.back() - firstFrameIndex + 1;
+}
+
+std::vector<c10::IValue> VideoDecoder::getFrameBatchSegmentProfilerInputs(
+    const StreamInfo& streamInfo,
+    const FrameBatchSegment& segment) const {
+  std::optional<std::pair<int64_t, int64_t>> byteRange =
+      getByteRangeForPtsRange(
+          streamInfo,
+          streamInfo.allFrames[segment.frameIndexes.front()].pts,
+          streamInfo.allFrames[segment.frameIndexes.back()].pts);
+  return {
+      static_cast<int64_t>(segment.frameIndexes.size()),
+      getNumFramesToDecode(streamInfo, segment),
+      byteRange.has_value() ? byteRange->second : int64_t{-1}};
+}
+
+std::unique_ptr<VideoDecoder> VideoDecoder::createBatchWorker(
+    int streamIndex) const {
+  // Workers don't cache frames, so the frame cache budget stays per decoder.
+  std::unique_ptr<VideoDecoder> worker = cloneWithoutStreams(DecoderOptions());
+  worker->addVideoStreamDecoder(streamIndex, streams_.at(streamIndex).options);
+  return worker;
+}
+
+VideoDecoder::DecodedOutput VideoDecoder::getNextDecodedOutput(
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  DecodeStatsScope decodeStatsScope(*this);
+  std::optional<DecodedOutput> cachedOutput =
+      maybeGetNextDecodedOutputFromFrameCache(preAllocatedOutputTensor);
+  if (cachedOutput.has_value()) {
+    return *cachedOutput;
+  }
+  // The audio frames decoded on the way are only buffered. See
+  // getAudioSamplesInRange().
   return getDecodedOutputWithFilter(
+      /*requestedStreamIndex=*/std::nullopt,
       [this](int frameStreamIndex, AVFrame* frame) {
         StreamInfo& activeStream = streams_[frameStreamIndex];
-        return frame->pts >=
+        return activeStream.stream->codecpar->codec_type ==
+            AVMEDIA_TYPE_VIDEO &&
+            frame->pts >=
             activeStream.discardFramesBeforePts.value_or(INT64_MIN);
+      },
+      preAllocatedOutputTensor);
+}
+
+VideoDecoder::DecodedOutput VideoDecoder::getNextDecodedOutputFromStream(
+    int streamIndex,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  std::optional<DecodedOutput> cachedOutput =
+      maybeGetNextDecodedOutputFromFrameCache(preAllocatedOutputTensor);
+  if (cachedOutput.has_value()) {
+    return *cachedOutput;
+  }
+  return getDecodedOutputWithFilter(
+      streamIndex,
+      [this, streamIndex](int frameStreamIndex, AVFrame* frame) {
+        return frameStreamIndex == streamIndex &&
+            frame->pts >=
+            streams_[streamIndex].discardFramesBeforePts.value_or(INT64_MIN);
+      },
+      preAllocatedOutputTensor);
+}
+
+void VideoDecoder::validateVideoStream(int streamIndex) const {
+  auto streamInfo = streams_.find(streamIndex);
+  if (streamInfo == streams_.end()) {
+    throw std::runtime_error(
+        "Invalid stream index=" + std::to_string(streamIndex));
+  }
+  if (streamInfo->second.stream->codecpar->codec_type != AVMEDIA_TYPE_VIDEO) {
+    throw std::runtime_error(
+        "Stream with index " + std::to_string(streamIndex) +
+        " is not a video stream.");
+  }
+}
+
+void VideoDecoder::validateFrameIsDecodable(
+    const StreamInfo& streamInfo,
+    int64_t frameIndex) const {
+  if (!streamInfo.options.keyFramesOnly) {
+    return;
+  }
+  int64_t pts = streamInfo.allFrames[frameIndex].pts;
+  auto keyFrame = std::lower_bound(
+      streamInfo.keyFrames.begin(),
+      streamInfo.keyFrames.end(),
+      pts,
+      [](const FrameInfo& frameInfo, int64_t value) {
+        return frameInfo.pts < value;
       });
+  if (keyFrame == streamInfo.keyFrames.end() || keyFrame->pts != pts) {
+    throw std::runtime_error(
+        "Frame index=" + std::to_string(frameIndex) + " of streamIndex=" +
+        std::to_string(streamInfo.streamIndex) +
+        " is not a key frame, and the stream only decodes key frames. Use "
+        "getKeyFrames() or sequential decoding, or add the stream without "
+        "key_frames_only.");
+  }
 }
 
 void VideoDecoder::setCursorPtsInSeconds(double seconds) {
   maybeDesiredPts_ = seconds;
 }
 
+double VideoDecoder::seekToTimestamp(
+    double seconds,
+    std::optional<SeekAccuracy> accuracy) {
+  if (activeStreamIndices_.size() == 1) {
+    const StreamInfo& streamInfo = streams_[*activeStreamIndices_.begin()];
+    std::optional<int64_t> approximateFrameIndex = getApproximateFrameIndex(
+        streamInfo,
+        seconds,
+        accuracy.value_or(streamInfo.options.seekAccuracy));
+    if (approximateFrameIndex.has_value()) {
+      seconds = 1.0 * streamInfo.allFrames[*approximateFrameIndex].pts /
+          streamInfo.timeBase.den;
+    }
+  }
+  setCursorPtsInSeconds(seconds);
+  return seconds;
+}
+
+std::optional<AsyncFileReader::Stats> VideoDecoder::getAsyncReadStats()
+    const {
+  if (!ioFileContext_) {
+    return std::nullopt;
+  }
+  return ioFileContext_->getReader()->getStats();
+}
+
 VideoDecoder::DecodeStats VideoDecoder::getDecodeStats() const {
   return decodeStats_;
 }
 
+VideoDecoder::DecodeStats VideoDecoder::getCumulativeDecodeStats() const {
+  DecodeStats stats = cumulativeDecodeStats_;
+  addDecodeStats(stats, decodeStats_);
+  return stats;
+}
+
 void VideoDecoder::resetDecodeStats() {
   decodeStats_ = DecodeStats{};
+  cumulativeDecodeStats_ = DecodeStats{};
+}
+
+void VideoDecoder::startNewDecodeStats() {
+  addDecodeStats(cumulativeDecodeStats_, decodeStats_);
+  decodeStats_ = DecodeStats{};
+}
+
+VideoDecoder::DecodeStatsScope::DecodeStatsScope(VideoDecoder& decoder)
+    : decoder_(decoder) {
+  if (decoder_.numDecodeStatsScopes_++ == 0) {
+    decoder_.startNewDecodeStats();
+  }
+}
+
+VideoDecoder::DecodeStatsScope::~DecodeStatsScope() {
+  decoder_.numDecodeStatsScopes_--;
+}
+
+torch::Tensor VideoDecoder::copyFramePlanesToTensor(
+    int streamIndex,
+    const AVFrame* frame,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  const VideoStreamDecoderOptions& options = streams_[streamIndex].options;
+  torch::Tensor output = getFrameOutputTensor(
+      options, frame->height, frame->width, preAllocatedOutputTensor);
+  copyPlanes(frame, options.outputFormat, output);
+  return output;
 }
 
 torch::Tensor VideoDecoder::convertFrameToTensorUsingFilterGraph(
     int streamIndex,
-    const AVFrame* frame) {
+    const AVFrame* frame,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
   FilterState& filterState = streams_[streamIndex].filterState;
+  auto conversionStart = std::chrono::high_resolution_clock::now();
   int ffmpegStatus = av_buffersrc_write_frame(filterState.sourceContext, frame);
   if (ffmpegStatus < AVSUCCESS) {
     throw std::runtime_error("Failed to add frame to buffer source context");
@@ -847,7 +3858,30 @@ torch::Tensor VideoDecoder::convertFrameToTensorUsingFilterGraph(
   UniqueAVFrame filteredFrame(av_frame_alloc());
   ffmpegStatus =
       av_buffersink_get_frame(filterState.sinkContext, filteredFrame.get());
-  TORCH_CHECK_EQ(filteredFrame->format, AV_PIX_FMT_RGB24);
+  decodeStats_.conversionMicros += getMicrosSince(conversionStart);
+  StreamInfo& activeStream = streams_[streamIndex];
+  TORCH_CHECK_EQ(
+      filteredFrame->format, getPixelFormat(activeStream.options.outputFormat));
+  if (activeStream.options.outputFormat != OutputFormat::RGB24) {
+    torch::Tensor output = getFrameOutputTensor(
+        activeStream.options,
+        filteredFrame->height,
+        filteredFrame->width,
+        preAllocatedOutputTensor);
+    copyPlanes(filteredFrame.get(), activeStream.options.outputFormat, output);
+    return output;
+  }
+  if (activeStream.options.dtype != torch::kUInt8) {
+    // Read straight from the filter graph's frame, which hflip mirrored.
+    return convertRgb24ToNormalizedTensor(
+        activeStream.options,
+        filteredFrame->data[0],
+        filteredFrame->linesize[0],
+        filteredFrame->height,
+        filteredFrame->width,
+        /*isFlipped=*/false,
+        preAllocatedOutputTensor);
+  }
   std::vector<int64_t> shape = {filteredFrame->height, filteredFrame->width, 3};
   std::vector<int64_t> strides = {filteredFrame->linesize[0], 3, 1};
   AVFrame* filteredFramePtr = filteredFrame.release();
@@ -856,10 +3890,170 @@ torch::Tensor VideoDecoder::convertFrameToTensorUsingFilterGraph(
   };
   torch::Tensor tensor = torch::from_blob(
       filteredFramePtr->data[0], shape, strides, deleter, {torch::kUInt8});
-  StreamInfo& activeStream = streams_[streamIndex];
   if (activeStream.options.shape == "NCHW") {
     tensor = tensor.permute({2, 0, 1});
   }
+  if (preAllocatedOutputTensor.has_value()) {
+    // Copy the rows out of the padded filter graph frame, which is released
+    // when `tensor` goes out of scope.
+    validatePreAllocatedOutputTensor(
+        *preAllocatedOutputTensor, tensor.sizes(), torch::kUInt8);
+    preAllocatedOutputTensor->copy_(tensor);
+    return *preAllocatedOutputTensor;
+  }
+  return tensor;
+}
+
+torch::Tensor VideoDecoder::convertFrameToTensorUsingSwsScale(
+    int streamIndex,
+    const AVFrame* frame,
+    std::optional<torch::Tensor> preAllocatedOutputTensor) {
+  StreamInfo& activeStream = streams_[streamIndex];
+  const VideoStreamDecoderOptions& options = activeStream.options;
+  auto [width, height] =
+      getOutputFrameSize(options, frame->width, frame->height);
+  // The context only depends on the source frame properties and the
+  // transform, so it is only recreated if the decoded frames change.
+  // setVideoStreamTransform() resets it.
+  if (!activeStream.swsContext || activeStream.swsSourceWidth != frame->width ||
+      activeStream.swsSourceHeight != frame->height ||
+      activeStream.swsSourceFormat != frame->format) {
+    SwsContext* swsContext = sws_getContext(
+        frame->width,
+        frame->height,
+        static_cast<AVPixelFormat>(frame->format),
+        width,
+        height,
+        getPixelFormat(options.outputFormat),
+        getSwsInterpolationFlag(options.interpolation),
+        nullptr,
+        nullptr,
+        nullptr);
+    TORCH_CHECK(swsContext != nullptr, "Failed to create SwsContext");
+    // Like the scale filter, convert with the frame's color matrix and range.
+    // YUV and gray outputs keep the range of the frame.
+    int colorspace = frame->colorspace == AVCOL_SPC_UNSPECIFIED
+        ? SWS_CS_DEFAULT
+        : frame->colorspace;
+    const int* coefficients = sws_getCoefficients(colorspace);
+    int sourceRange = frame->color_range == AVCOL_RANGE_JPEG;
+    sws_setColorspaceDetails(
+        swsContext,
+        coefficients,
+        sourceRange,
+        coefficients,
+        /*dstRange=*/
+        options.outputFormat == OutputFormat::RGB24 ? 1 : sourceRange,
+        /*brightness=*/0,
+        /*contrast=*/1 << 16,
+        /*saturation=*/1 << 16);
+    activeStream.swsContext.reset(swsContext);
+    activeStream.swsSourceWidth = frame->width;
+    activeStream.swsSourceHeight = frame->height;
+    activeStream.swsSourceFormat = frame->format;
+  }
+
+  if (options.outputFormat != OutputFormat::RGB24) {
+    // Gray and YUV frames have the same layout whatever the shape, so we
+    // scale straight into the output tensor's planes.
+    torch::Tensor output =
+        getFrameOutputTensor(options, height, width, preAllocatedOutputTensor);
+    uint8_t* data = output.data_ptr<uint8_t>();
+    uint8_t* destinations[4] = {data, nullptr, nullptr, nullptr};
+    int destinationLinesizes[4] = {width, 0, 0, 0};
+    if (options.outputFormat == OutputFormat::YUV420P) {
+      destinations[1] = data + width * height;
+      destinations[2] = destinations[1] + width * height / 4;
+      destinationLinesizes[1] = destinationLinesizes[2] = width / 2;
+    } else if (options.outputFormat == OutputFormat::NV12) {
+      destinations[1] = data + width * height;
+      destinationLinesizes[1] = width;
+    }
+    auto conversionStart = std::chrono::high_resolution_clock::now();
+    int resultHeight = sws_scale(
+        activeStream.swsContext.get(),
+        frame->data,
+        frame->linesize,
+        0,
+        frame->height,
+        destinations,
+        destinationLinesizes);
+    decodeStats_.conversionMicros += getMicrosSince(conversionStart);
+    TORCH_CHECK(
+        resultHeight == height,
+        "sws_scale returned ",
+        resultHeight,
+        " rows, expected ",
+        height);
+    if (options.horizontalFlip) {
+      flipFrameHorizontally(options, output);
+    }
+    return output;
+  }
+
+  // An NHWC uint8 output tensor is packed RGB, so we scale straight into it.
+  // NCHW outputs are scaled into an HWC tensor that is then permuted, and
+  // floating point outputs into a reused buffer that is then normalized.
+  bool isNCHW = options.shape == "NCHW";
+  bool isUInt8 = options.dtype == torch::kUInt8;
+  torch::Tensor hwcTensor;
+  if (preAllocatedOutputTensor.has_value() && !isNCHW && isUInt8) {
+    validatePreAllocatedOutputTensor(
+        *preAllocatedOutputTensor, {height, width, 3}, torch::kUInt8);
+    hwcTensor = *preAllocatedOutputTensor;
+  } else if (!isUInt8) {
+    if (!activeStream.rgb24Buffer.defined() ||
+        activeStream.rgb24Buffer.size(0) != height ||
+        activeStream.rgb24Buffer.size(1) != width) {
+      activeStream.rgb24Buffer =
+          torch::empty({height, width, 3}, {torch::kUInt8});
+    }
+    hwcTensor = activeStream.rgb24Buffer;
+  } else {
+    hwcTensor = torch::empty({height, width, 3}, {torch::kUInt8});
+  }
+  uint8_t* destinations[4] = {
+      hwcTensor.data_ptr<uint8_t>(), nullptr, nullptr, nullptr};
+  int destinationLinesizes[4] = {width * 3, 0, 0, 0};
+  auto conversionStart = std::chrono::high_resolution_clock::now();
+  int resultHeight = sws_scale(
+      activeStream.swsContext.get(),
+      frame->data,
+      frame->linesize,
+      0,
+      frame->height,
+      destinations,
+      destinationLinesizes);
+  decodeStats_.conversionMicros += getMicrosSince(conversionStart);
+  TORCH_CHECK(
+      resultHeight == height,
+      "sws_scale returned ",
+      resultHeight,
+      " rows, expected ",
+      height);
+  if (!isUInt8) {
+    return convertRgb24ToNormalizedTensor(
+        options,
+        hwcTensor.data_ptr<uint8_t>(),
+        width * 3,
+        height,
+        width,
+        options.horizontalFlip,
+        preAllocatedOutputTensor);
+  }
+  if (options.horizontalFlip) {
+    hwcTensor.copy_(hwcTensor.flip({1}));
+  }
+  if (!isNCHW) {
+    return hwcTensor;
+  }
+  torch::Tensor tensor = hwcTensor.permute({2, 0, 1});
+  if (preAllocatedOutputTensor.has_value()) {
+    validatePreAllocatedOutputTensor(
+        *preAllocatedOutputTensor, tensor.sizes(), torch::kUInt8);
+    preAllocatedOutputTensor->copy_(tensor);
+    return *preAllocatedOutputTensor;
+  }
   return tensor;
 }
 
@@ -872,7 +4066,20 @@ std::ostream& operator<<(
      << ", numPacketsSentToDecoder=" << stats.numPacketsSentToDecoder
      << ", numSeeksAttempted=" << stats.numSeeksAttempted
      << ", numSeeksSkipped=" << stats.numSeeksSkipped
-     << ", numFlushes=" << stats.numFlushes << "}";
+     << ", numByteSeeks=" << stats.numByteSeeks
+     << ", numFlushes=" << stats.numFlushes
+     << ", numFrameCacheHits=" << stats.numFrameCacheHits
+     << ", numFrameCacheMisses=" << stats.numFrameCacheMisses
+     << ", maxReadAheadQueueDepth=" << stats.maxReadAheadQueueDepth
+     << ", maxReadAheadBytesBuffered=" << stats.maxReadAheadBytesBuffered
+     << ", readAheadStallMicros=" << stats.readAheadStallMicros
+     << ", numFramesDiscarded=" << stats.numFramesDiscarded
+     << ", seekMicros=" << stats.seekMicros
+     << ", demuxMicros=" << stats.demuxMicros
+     << ", sendPacketMicros=" << stats.sendPacketMicros
+     << ", receiveFrameMicros=" << stats.receiveFrameMicros
+     << ", conversionMicros=" << stats.conversionMicros
+     << ", tensorMicros=" << stats.tensorMicros << "}";
 
   return os;
 }
@@ -4,11 +4,17 @@
 
 #include <torch/types.h>
 #include <cstdint>
+#include <deque>
+#include <list>
+#include <map>
 #include <memory>
 #include <ostream>
 #include <string_view>
 
+#include "src/torchcodec/decoders/core/AsyncFileReader.h"
 #include "src/torchcodec/decoders/core/FFMPEGCommon.h"
+#include "src/torchcodec/decoders/core/MemoryMappedFile.h"
+#include "src/torchcodec/decoders/core/PacketReadAhead.h"
 
 namespace facebook::torchcodec {
 
@@ -45,7 +51,54 @@ class VideoDecoder {
 
   struct DecoderOptions {
     DecoderOptions() {}
-    // TODO: Add options for the entire decoder here.
+    explicit DecoderOptions(const std::string& optionsString);
+    // If true, scanFileAndUpdateMetadataAndIndex() first tries to load the
+    // scanned index from an on-disk cache file and only scans the file if the
+    // cache is missing or stale. After a scan, the cache file is (re)written.
+    // Only decoders created from a file path use the cache.
+    bool useIndexCache = false;
+    // The directory where the index cache files are stored. If empty, the cache
+    // file is stored next to the video as "<video path>.torchcodec_index".
+    std::string indexCacheDirectory;
+    // How scanFileAndUpdateMetadataAndIndex() builds the frame index:
+    // - "packets" demuxes every packet of the file.
+    // - "container_index" reads the index stored in the container (e.g. the
+    //   MP4 sample tables) for the streams where it lists every frame, and
+    //   only demuxes the packets of the other streams. That index only has
+    //   decoding timestamps, so video streams that reorder frames (e.g. H.264
+    //   with B-frames) are demuxed too, as are Matroska streams, whose cues
+    //   only list key frames. See StreamMetadata::indexSource.
+    std::string scanMode = "packets";
+    // The maximum number of bytes of converted frames kept in the frame cache.
+    // Frames are evicted in least recently used order. Requests for a cached
+    // frame are served without seeking or decoding. Only the single frames
+    // returned in a new tensor are cached, not the frames of batches or of
+    // calls with an output tensor. 0 disables the cache.
+    int64_t frameCacheCapacityBytes = 0;
+    // The number of threads getFramesAtIndexes() uses. Frames that depend on
+    // different key frames are decoded concurrently, each thread with its own
+    // demuxer and codec contexts over the same input. The threads are started
+    // for the call rather than taken from the ATen thread pool, so they aren't
+    // limited by its size. 0 means at::get_num_threads().
+    int numBatchDecodeThreads = 1;
+    // If > 0, packets of the active streams are read on a background thread
+    // into a queue of at most this many packets, so that I/O overlaps with
+    // decoding. Seeks, scans and adding a stream drop the packets that were
+    // read ahead.
+    int numReadAheadPackets = 0;
+    // If true, decoders created from a file path map the file read-only and
+    // serve the demuxer's reads from the mapping instead of reading the file.
+    // The pages live in the page cache, so processes decoding the same file
+    // (e.g. DataLoader workers) share them. The decoder advises the kernel of
+    // its access pattern: sequential while scanning, random while decoding
+    // the frames of a batch.
+    bool useMemoryMap = false;
+    // If true, decoders created from a file path read the file through an
+    // AsyncFileReader. Seeks and batch decodes submit the reads of the key
+    // frame ranges they are about to decode in a single io_uring batch. Falls
+    // back to pread() where io_uring isn't available. Can't be combined with
+    // useMemoryMap.
+    bool useIoUring = false;
   };
 
   // --------------------------------------------------------------------------
@@ -65,11 +118,40 @@ class VideoDecoder {
       size_t length,
       const DecoderOptions& options = DecoderOptions());
 
+  // Points the decoder at a new video and adds the streams that were active
+  // with the same options. An active stream keeps its open codec context and
+  // its filter graph or swscale context if the stream it is replaced by has
+  // the same codec parameters (codec, extradata, size, pixel format, aspect
+  // ratio and color properties), which saves most of the setup cost of a new
+  // decoder. Returns true if every active stream was kept this way.
+  //
+  // An active stream is replaced by the stream at the same index of the new
+  // video, or by the new video's best stream of the same type if there is no
+  // such stream. If the new video can't be opened or has no replacement for
+  // a stream, this throws and the decoder is left unchanged.
+  //
+  // The scanned index, the frame cache and the decode stats are reset. The
+  // new video must be scanned again if needed.
+  bool reopenFromFilePath(const std::string& videoFilePath);
+  bool reopenFromBuffer(const void* buffer, size_t length);
+
+  // Returns a new decoder over the same input with the same options and
+  // active streams. The clone can decode on another thread while this decoder
+  // is used, e.g. to decode different parts of the video in parallel.
+  //
+  // The clone copies the container metadata and the scanned index, and reads
+  // from the same memory mapping or io_uring file reader, so it neither probes
+  // nor scans the input: it mostly costs opening the codecs. Its cursor,
+  // frame cache and decode stats start out empty. The clone of a decoder
+  // created from a buffer doesn't own the buffer either.
+  std::unique_ptr<VideoDecoder> clone() const;
+
   // --------------------------------------------------------------------------
   // VIDEO METADATA QUERY API
   // --------------------------------------------------------------------------
   // Updates the metadata of the video to accurate values obtained by scanning
-  // the contents of the video file.
+  // the contents of the video file. If DecoderOptions::useIndexCache is set,
+  // the index is loaded from the cache file instead when it is up to date.
   void scanFileAndUpdateMetadataAndIndex();
   struct StreamMetadata {
     // Common (video and audio) fields derived from the AVStream.
@@ -95,10 +177,17 @@ class VideoDecoder {
     std::optional<double> maxPtsSecondsFromScan;
     // This can be useful for index-based seeking.
     std::optional<int64_t> numFramesFromScan;
+    // Where the scanned index of this stream came from: "packets",
+    // "container_index" or "cache". See DecoderOptions::scanMode.
+    std::optional<std::string> indexSource;
 
     // Video-only fields derived from the AVCodecContext.
     std::optional<int64_t> width;
     std::optional<int64_t> height;
+
+    // Audio-only fields derived from the AVStream.
+    std::optional<int64_t> sampleRate;
+    std::optional<int64_t> numChannels;
   };
   struct ContainerMetadata {
     std::vector<StreamMetadata> streams;
@@ -121,6 +210,84 @@ class VideoDecoder {
   // ADDING STREAMS API
   // --------------------------------------------------------------------------
 
+  // The library that converts decoded frames to RGB and resizes them.
+  enum class ColorConversionLibrary {
+    // A libavfilter graph with a scale filter.
+    FILTERGRAPH,
+    // A cached SwsContext per stream that writes straight into the output
+    // tensor.
+    SWSCALE,
+  };
+  // How close to a requested timestamp the returned frame has to be. Anything
+  // other than EXACT lets the decoder return a nearby frame that is cheaper to
+  // decode, e.g. a key frame instead of the frame that is 100 frames after it.
+  // Only streams that have been scanned can be sought approximately.
+  struct SeekAccuracy {
+    enum class Mode {
+      // The frame displayed at the requested timestamp.
+      EXACT,
+      // The key frame closest to the requested timestamp.
+      NEAREST_KEY_FRAME,
+      // Any frame at most `frames` frames away from the exact frame.
+      WITHIN_FRAMES,
+      // Any frame that starts at most `seconds` away from the timestamp.
+      WITHIN_SECONDS,
+    };
+    SeekAccuracy() {}
+    // Parses "exact", "key_frame", "frames:<int>" or "seconds:<double>".
+    explicit SeekAccuracy(const std::string& accuracyString);
+    Mode mode = Mode::EXACT;
+    int64_t frames = 0;
+    double seconds = 0;
+  };
+  // Trades decoding fidelity for decoding speed.
+  enum class DecodeQuality {
+    // Decode every frame at full quality.
+    FULL,
+    // Skip the loop filter of non-reference frames, which no other frame
+    // depends on, and allow non spec-compliant speedups. If the output is
+    // smaller than the video, codecs that support it (e.g. MJPEG, MPEG-2,
+    // MPEG-4 part 2) also decode at a reduced resolution ("lowres").
+    FAST,
+    // FAST, and also skip the loop filter of all frames and the IDCT of
+    // non-reference frames. Errors propagate until the next key frame.
+    FASTEST,
+  };
+  // The pixel format of the output frames. The YUV formats are returned as a
+  // single uint8 tensor of shape (H * 3 / 2, W) holding the planes one after
+  // the other, like FFMPEG packs them: the Y plane (H, W), followed by the U
+  // and V planes (H / 2, W / 2) for YUV420P, or by the interleaved UV plane
+  // (H / 2, W / 2, 2) for NV12. They require an even width and height and
+  // ignore VideoStreamDecoderOptions::shape.
+  enum class OutputFormat {
+    // 3 channels, laid out as VideoStreamDecoderOptions::shape says.
+    RGB24,
+    // Luma only, i.e. 1 channel.
+    GRAY,
+    YUV420P,
+    NV12,
+  };
+  // A rectangle of the decoded frames, in pixels.
+  struct CropRegion {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+  };
+  // How the output frames are resized when width and height aren't both set.
+  // MIN_SIDE and MAX_SIDE keep the aspect ratio and scale the shorter or the
+  // longer side to VideoStreamDecoderOptions::resizeSide.
+  enum class ResizePolicy {
+    EXACT,
+    MIN_SIDE,
+    MAX_SIDE,
+  };
+  enum class Interpolation {
+    NEAREST,
+    BILINEAR,
+    BICUBIC,
+    AREA,
+  };
   struct VideoStreamDecoderOptions {
     VideoStreamDecoderOptions() {}
     explicit VideoStreamDecoderOptions(const std::string& optionsString);
@@ -136,9 +303,56 @@ class VideoDecoder {
     // is the same as the original video.
     std::optional<int> width;
     std::optional<int> height;
+    ColorConversionLibrary colorConversionLibrary =
+        ColorConversionLibrary::FILTERGRAPH;
+    // If true, only key frames are decoded: non-key packets are dropped
+    // before they reach the codec, which is also told to discard non-key
+    // frames. Seeking to a timestamp then returns the first key frame at or
+    // after it, and getNextDecodedOutput() returns the next key frame. The
+    // methods that take frame indexes throw for non-key frames.
+    bool keyFramesOnly = false;
+    // The default accuracy of getFrameDisplayedAtTimestamp() and
+    // seekToTimestamp() for this stream.
+    SeekAccuracy seekAccuracy;
+    DecodeQuality decodeQuality = DecodeQuality::FULL;
+    // The dtype of the output frames: uint8, float32, float16 or bfloat16.
+    // Floating point frames are scaled to [0, 1] and then normalized per RGB
+    // channel with (x - mean) / std, in the same pass that writes them into
+    // the output tensor. mean and std have either one value for all channels
+    // or one value per channel. They default to 0 and 1.
+    torch::ScalarType dtype = torch::kUInt8;
+    // If no resize is requested and the decoded frames already have the
+    // output format (any 8 bit YUV format for GRAY), their planes are copied
+    // out as they are, without color conversion. Only RGB24 supports floating
+    // point dtypes.
+    OutputFormat outputFormat = OutputFormat::RGB24;
+    std::vector<double> normalizationMean;
+    std::vector<double> normalizationStd;
+    // The transform applied while converting the decoded frames: the crop
+    // region is cut out first, without copying pixels, so that only it is
+    // color converted and scaled. It is then resized to width and height, or
+    // as resizePolicy says, with `interpolation`, and mirrored left to right if
+    // horizontalFlip is set. See setVideoStreamTransform() to change the
+    // transform between calls.
+    std::optional<CropRegion> crop;
+    ResizePolicy resizePolicy = ResizePolicy::EXACT;
+    int resizeSide = 0;
+    bool horizontalFlip = false;
+    Interpolation interpolation = Interpolation::BICUBIC;
   };
   struct AudioStreamDecoderOptions {
-    // TODO: Add channels, shape, sample options, etc.
+    AudioStreamDecoderOptions() {}
+    explicit AudioStreamDecoderOptions(const std::string& optionsString);
+    // The sample rate and number of channels of the output samples. Frames are
+    // resampled and remixed with swresample, e.g. 1 channel downmixes to mono.
+    // If not specified, they are the ones of the stream.
+    std::optional<int> sampleRate;
+    std::optional<int> numChannels;
+    // How many seconds of output samples are kept. The audio frames that are
+    // decoded while decoding video frames are kept too, so audio requests for
+    // the time range of recently decoded video frames don't read the file
+    // again.
+    double bufferSeconds = 30;
   };
   void addVideoStreamDecoder(
       int streamIndex,
@@ -146,12 +360,29 @@ class VideoDecoder {
   void addAudioStreamDecoder(
       int streamIndex,
       const AudioStreamDecoderOptions& options = AudioStreamDecoderOptions());
+  // Replaces the transform of an active video stream for the frames returned
+  // from now on, e.g. to take a different random crop for each clip.
+  // `transformOptions` takes the width, height, crop, resize, hflip and
+  // interpolation keys of VideoStreamDecoderOptions. Keys that are not given
+  // are reset to their defaults. Streams that decode at a reduced resolution
+  // (see DecodeQuality::FAST) only take transforms with a width and height no
+  // larger than the decoded frames.
+  void setVideoStreamTransform(
+      int streamIndex,
+      const std::string& transformOptions);
 
   // ---- SINGLE FRAME SEEK AND DECODING API ----
   // Places the cursor at the first frame on or after the position in seconds.
   // Calling getNextFrameAsTensor() will return the first frame at or after this
   // position.
   void setCursorPtsInSeconds(double seconds);
+  // Like setCursorPtsInSeconds(), but the cursor may be placed on any frame
+  // that satisfies `accuracy` (or the stream's default accuracy). The cheapest
+  // such frame is chosen. Returns the timestamp in seconds of the frame that
+  // getNextDecodedOutput() will return, or `seconds` for exact seeks.
+  double seekToTimestamp(
+      double seconds,
+      std::optional<SeekAccuracy> accuracy = std::nullopt);
   struct DecodedOutput {
     // The actual decoded output as a Tensor.
     torch::Tensor frame;
@@ -166,28 +397,130 @@ class VideoDecoder {
     double ptsSeconds;
   };
   // Decodes the frame where the current cursor position is. It also advances
-  // the cursor to the next frame.
-  DecodedOutput getNextDecodedOutput();
+  // the cursor to the next frame. Only video frames are returned: the audio
+  // frames decoded on the way are kept for getAudioSamplesInRange().
+  //
+  // The methods that return frames accept an optional pre-allocated output
+  // tensor. If given, it must be a contiguous uint8 tensor with the shape of
+  // the output, and the frame is converted directly into it instead of into a
+  // newly allocated tensor. This lets callers reuse their output buffers.
+  DecodedOutput getNextDecodedOutput(
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
   // Decodes the frame that is visible at a given timestamp. Frames in the video
   // have a presentation timestamp and a duration. For example, if a frame has
   // presentation timestamp of 5.0s and a duration of 1.0s, it will be visible
   // in the timestamp range [5.0, 6.0). i.e. it will be returned when this
   // function is called with seconds=5.0 or seconds=5.999, etc.
-  DecodedOutput getFrameDisplayedAtTimestamp(double seconds);
-  DecodedOutput getFrameAtIndex(int streamIndex, int64_t frameIndex);
+  //
+  // If `accuracy` (or the stream's default accuracy) is not EXACT, the
+  // cheapest frame that satisfies it is returned instead. The pts of the
+  // returned frame are in DecodedOutput::pts and DecodedOutput::ptsSeconds.
+  DecodedOutput getFrameDisplayedAtTimestamp(
+      double seconds,
+      std::optional<SeekAccuracy> accuracy = std::nullopt);
+  DecodedOutput getFrameAtIndex(
+      int streamIndex,
+      int64_t frameIndex,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
   struct BatchDecodedOutput {
     torch::Tensor frames;
   };
   // Returns frames at the given indexes for a given stream as a single stacked
-  // Tensor.
+  // Tensor. The indexes may be unsorted and may contain duplicates: the frames
+  // are decoded in a single forward pass, each frame is decoded at most once,
+  // and the output follows the order of `frameIndexes`. See
+  // DecoderOptions::numBatchDecodeThreads to decode them in parallel.
   BatchDecodedOutput getFramesAtIndexes(
       int streamIndex,
-      const std::vector<int64_t>& frameIndexes);
+      const std::vector<int64_t>& frameIndexes,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
+  // Returns every `step`-th key frame of a given stream, starting from the
+  // first one, as a single stacked Tensor. The stream must have been scanned.
+  // This is cheapest when the stream was added with keyFramesOnly.
+  BatchDecodedOutput getKeyFrames(
+      int streamIndex,
+      int64_t step = 1,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
+  // Returns the frames at indexes start, start + step, ... up to but excluding
+  // stop for a given stream as a single stacked Tensor. The frames are decoded
+  // moving forward: the frames between two requested ones are decoded but not
+  // converted, unless a key frame lets us seek past them. The stream must have
+  // been scanned.
+  BatchDecodedOutput getFramesInRange(
+      int streamIndex,
+      int64_t start,
+      int64_t stop,
+      int64_t step = 1,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
+  // Returns the frames displayed at the given timestamps in seconds for a
+  // given stream as a single stacked Tensor. Like getFramesAtIndexes(), the
+  // timestamps may be unsorted and may contain duplicates. The stream must
+  // have been scanned.
+  BatchDecodedOutput getFramesDisplayedAtTimestamps(
+      int streamIndex,
+      const std::vector<double>& timestamps,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
+  // Returns the samples of an audio stream in [startSeconds, stopSeconds) as a
+  // float32 tensor of shape [numChannels, round((stop - start) * sampleRate)],
+  // at the stream's output sample rate and number of channels. Times with no
+  // samples, e.g. past the end of the stream, are zeros. If given, the output
+  // is written into `preAllocatedOutputTensor`, which must have that shape.
+  //
+  // All active streams share one pass over the file: the audio frames decoded
+  // along with video frames are served from the stream's buffer (see
+  // AudioStreamDecoderOptions::bufferSeconds). The cursor of the video
+  // streams doesn't move: their next frame is the one after the last frame
+  // they returned, or the target of a pending seek, e.g. from
+  // setCursorPtsInSeconds().
+  // Throws if decoding can't resume at or before startSeconds.
+  torch::Tensor getAudioSamplesInRange(
+      int streamIndex,
+      double startSeconds,
+      double stopSeconds,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
+
+  // --------------------------------------------------------------------------
+  // MULTI-VIDEO API
+  // --------------------------------------------------------------------------
+
+  // A video for decodeVideos() and the frames to decode from its best video
+  // stream.
+  struct VideoDecodeRequest {
+    // The video is read from this path if it is not empty, and from the
+    // buffer otherwise. The buffer is not owned.
+    std::string videoFilePath;
+    const void* buffer = nullptr;
+    size_t length = 0;
+    // The frames to decode, as frame indexes or, if `timestamps` is not empty,
+    // as timestamps in seconds.
+    std::vector<int64_t> frameIndexes;
+    std::vector<double> timestamps;
+  };
+  // Decodes several videos concurrently on `numThreads` threads started for
+  // the call, whatever the size of the ATen thread pool (0 means
+  // at::get_num_threads()). Returns the frames of each
+  // video as one stacked Tensor, in the order of `requests`. Each video gets
+  // its own decoder, created with `options`, scanned, and decoding its best
+  // video stream with `streamOptions`. Threads pick the next video as soon as
+  // they are done with one, so long and short videos balance out.
+  static std::vector<torch::Tensor> decodeVideos(
+      const std::vector<VideoDecodeRequest>& requests,
+      const DecoderOptions& options = DecoderOptions(),
+      const VideoStreamDecoderOptions& streamOptions =
+          VideoStreamDecoderOptions(),
+      int numThreads = 0);
 
   // --------------------------------------------------------------------------
   // DECODER PERFORMANCE STATISTICS API
   // --------------------------------------------------------------------------
 
+  // Decoding is also instrumented with torch.profiler scopes named
+  // "torchcodec::<stage>" for open, find_stream_info, scan, seek, decode,
+  // decode_segment, convert and resample. Their inputs, e.g. the seek target
+  // or the frame and byte counts of a batch segment, are recorded when
+  // profiling with record_shapes=True. The scopes cost a branch each when the
+  // profiler is off.
+
   // Only exposed for performance testing.
   struct DecodeStats {
     int64_t numSeeksAttempted = 0;
@@ -197,20 +530,111 @@ class VideoDecoder {
     int64_t numPacketsSentToDecoder = 0;
     int64_t numFramesReceivedByDecoder = 0;
     int64_t numFlushes = 0;
+    // Seeks that jumped to the byte position of a key frame.
+    int64_t numByteSeeks = 0;
+    // Frame cache lookups of the frame to return after a seek that found the
+    // frame, or had to decode it.
+    int64_t numFrameCacheHits = 0;
+    int64_t numFrameCacheMisses = 0;
+    // Only set with DecoderOptions::numReadAheadPackets. The largest number
+    // and size of packets that were read ahead, and the time spent waiting
+    // for the read-ahead thread.
+    int64_t maxReadAheadQueueDepth = 0;
+    int64_t maxReadAheadBytesBuffered = 0;
+    int64_t readAheadStallMicros = 0;
+    // Frames of the requested video stream that the decoder returned but
+    // weren't requested, e.g. the frames between a key frame and the frame
+    // we seeked to. The frames of other streams decoded on the way aren't
+    // counted, and audio frames are buffered rather than discarded.
+    int64_t numFramesDiscarded = 0;
+    // The time spent in each stage of decoding: seeking, reading packets,
+    // avcodec_send_packet(), avcodec_receive_frame(), converting frames with
+    // the filter graph, swscale or swresample, and copying the converted
+    // frames into their output tensors.
+    int64_t seekMicros = 0;
+    int64_t demuxMicros = 0;
+    int64_t sendPacketMicros = 0;
+    int64_t receiveFrameMicros = 0;
+    int64_t conversionMicros = 0;
+    int64_t tensorMicros = 0;
   };
+  // The stats of the last call that returned frames or audio samples, e.g.
+  // all the frames of getFramesAtIndexes() or a single getNextDecodedOutput().
   DecodeStats getDecodeStats() const;
+  // The stats summed over everything decoded since the decoder was created
+  // or resetDecodeStats() was called. They include the work of the parallel
+  // batch workers, so the times can add up to more than the elapsed time.
+  DecodeStats getCumulativeDecodeStats() const;
+  // The submission and completion stats of the input reads since the input
+  // was opened. nullopt unless DecoderOptions::useIoUring is set.
+  std::optional<AsyncFileReader::Stats> getAsyncReadStats() const;
+  // Resets both the last and the cumulative stats.
   void resetDecodeStats();
 
  private:
   struct FrameInfo {
     int64_t pts = 0;
-    // TODO: Add duration and dts, etc. as need be.
+    int64_t dts = 0;
+    // The duration of the frame in time base. Frames whose packet has no
+    // duration last until the next frame.
+    int64_t duration = 0;
+    // The byte position and size of the frame's packet in the file. pos is -1
+    // if unknown.
+    int64_t pos = -1;
+    int64_t size = 0;
+  };
+  // The scanned frames of a stream. Copies share the frames, so the clones
+  // and batch workers of a decoder don't each hold a copy of an index that
+  // takes megabytes for long videos. Changing the frames copies them first
+  // if they are shared.
+  class FrameIndex {
+   public:
+    FrameIndex() = default;
+    explicit FrameIndex(std::vector<FrameInfo> frameInfos);
+    const std::vector<FrameInfo>& get() const;
+    operator const std::vector<FrameInfo>&() const {
+      return get();
+    }
+    // Returns the frames to change, copied from the shared ones if needed.
+    std::vector<FrameInfo>& getMutable();
+    void clear() {
+      frameInfos_.reset();
+    }
+    size_t size() const {
+      return get().size();
+    }
+    bool empty() const {
+      return get().empty();
+    }
+    std::vector<FrameInfo>::const_iterator begin() const {
+      return get().begin();
+    }
+    std::vector<FrameInfo>::const_iterator end() const {
+      return get().end();
+    }
+    const FrameInfo& operator[](size_t i) const {
+      return get()[i];
+    }
+    const FrameInfo& back() const {
+      return get().back();
+    }
+
+   private:
+    std::shared_ptr<std::vector<FrameInfo>> frameInfos_;
   };
   struct FilterState {
     UniqueAVFilterGraph filterGraph;
     AVFilterContext* sourceContext = nullptr;
     AVFilterContext* sinkContext = nullptr;
   };
+  // The output samples of an audio stream, contiguous in time.
+  struct AudioBuffer {
+    // Float tensors of shape [numChannels, numSamples], oldest first.
+    std::deque<torch::Tensor> chunks;
+    // The time in seconds of the first sample, and the number of samples.
+    double startSeconds = 0;
+    int64_t numSamples = 0;
+  };
   // Stores information for each stream.
   struct StreamInfo {
     int streamIndex = -1;
@@ -228,10 +652,63 @@ class VideoDecoder {
     // The filter state associated with this stream (for video streams). The
     // actual graph will be nullptr for inactive streams.
     FilterState filterState;
-    std::vector<FrameInfo> keyFrames;
-    std::vector<FrameInfo> allFrames;
+    // The swscale context of this stream and the frame properties it was
+    // created for. Only used with ColorConversionLibrary::SWSCALE.
+    UniqueSwsContext swsContext;
+    int swsSourceWidth = 0;
+    int swsSourceHeight = 0;
+    int swsSourceFormat = AV_PIX_FMT_NONE;
+    // The RGB24 output of sws_scale() for streams with a floating point
+    // dtype, reused across frames.
+    torch::Tensor rgb24Buffer;
+    // Audio streams only. The resampler is created for the first frame after
+    // each seek, when the buffer restarts.
+    AudioStreamDecoderOptions audioOptions;
+    int outputSampleRate = 0;
+    int outputNumChannels = 0;
+    UniqueSwrContext swrContext;
+    AudioBuffer audioBuffer;
+    // The start of the range getAudioSamplesInRange() is decoding. The
+    // buffer keeps its samples even past bufferSeconds.
+    std::optional<double> audioRangeStartSeconds;
+    FrameIndex keyFrames;
+    FrameIndex allFrames;
+  };
+  // A group of requested frames that share the same key frame. All of them
+  // can be decoded in a single forward pass starting from that key frame.
+  struct FrameBatchSegment {
+    int keyFrameIndex = -1;
+    // Indexes into StreamInfo::allFrames, sorted and without duplicates.
+    std::vector<int64_t> frameIndexes;
+    // outputPositions[i] are the positions in the caller's batch where the
+    // frame at frameIndexes[i] goes.
+    std::vector<std::vector<int64_t>> outputPositions;
+  };
+  // A converted frame in the frame cache.
+  struct FrameCacheEntry {
+    DecodedOutput output;
+    int64_t duration = 0;
+    int64_t numBytes = 0;
   };
+  // (streamIndex, pts) of a cached frame.
+  using FrameCacheKey = std::pair<int, int64_t>;
   VideoDecoder();
+  // Returns the path of the index cache file for this decoder's video.
+  std::string getIndexCachePath() const;
+  // Tries to populate the scanned metadata and index from the index cache file.
+  // Returns false if the cache file is missing, corrupted or stale. The
+  // caller also falls back to scanning if it throws.
+  bool maybeLoadScannedIndexFromCache();
+  // Writes the scanned metadata and index to the index cache file. Failures
+  // are logged and otherwise ignored since the cache is only an optimization.
+  void saveScannedIndexToCache() const;
+  // Builds the index and the scan metadata of a stream from the index stored
+  // in the container. Returns false if that index is incomplete or cannot be
+  // used for this stream.
+  bool maybeBuildIndexFromContainerIndex(int streamIndex);
+  // Builds the index and the scan metadata of the given streams by demuxing
+  // every packet of the file.
+  void scanPacketsAndUpdateMetadataAndIndex(const std::set<int>& streamIndices);
   // Returns the key frame index of the presentation timestamp using FFMPEG's
   // index. Note that this index may be truncated for some files.
   int getKeyFrameIndexForPtsUsingEncoderIndex(AVStream* stream, int64_t pts)
@@ -242,6 +719,83 @@ class VideoDecoder {
       const std::vector<VideoDecoder::FrameInfo>& keyFrames,
       int64_t pts) const;
   int getKeyFrameIndexForPts(const StreamInfo& stream, int64_t pts) const;
+  // Returns the index into StreamInfo::allFrames of the frame displayed at
+  // `seconds`, or nullopt if the scanned index has no such frame.
+  std::optional<int64_t> getFrameIndexDisplayedAt(
+      const StreamInfo& streamInfo,
+      double seconds) const;
+  // Returns the index into StreamInfo::allFrames of the cheapest frame to
+  // decode that satisfies `accuracy` for a seek to `seconds`, or nullopt if
+  // the seek has to be exact. See the definition for the cost model.
+  std::optional<int64_t> getApproximateFrameIndex(
+      const StreamInfo& streamInfo,
+      double seconds,
+      const SeekAccuracy& accuracy) const;
+  // Allocates the output of a batch of `numFrames` frames of a stream, with the
+  // shape and size set in the stream's options. If `preAllocatedOutputTensor`
+  // is given, checks that it can hold that output and returns it instead.
+  torch::Tensor allocateBatchOutputTensor(
+      int streamIndex,
+      int64_t numFrames,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
+  // Sorts and dedupes the requested frame indexes and groups them by key
+  // frame. The indexes must be valid indexes into streamInfo.allFrames.
+  std::vector<FrameBatchSegment> planFrameBatch(
+      const StreamInfo& streamInfo,
+      const std::vector<int64_t>& frameIndexes) const;
+  // Decodes the frames of the given segments in order and writes each of them
+  // to its output positions in `frames`.
+  void decodeFrameBatchSegments(
+      int streamIndex,
+      const std::vector<FrameBatchSegment>& segments,
+      torch::Tensor& frames);
+  // Splits the segments into contiguous chunks of similar decoding cost and
+  // decodes each chunk on its own thread with a batch worker.
+  void decodeFrameBatchSegmentsInParallel(
+      int streamIndex,
+      const std::vector<FrameBatchSegment>& segments,
+      torch::Tensor& frames);
+  // Returns the number of frames decoded for `segment` when starting from its
+  // key frame: all frames from the key frame to its last requested frame.
+  int64_t getNumFramesToDecode(
+      const StreamInfo& streamInfo,
+      const FrameBatchSegment& segment) const;
+  // Returns the inputs of the profiler scope of `segment`: the number of
+  // requested frames, and the number of frames and of bytes (-1 if unknown)
+  // needed from its key frame on. Fewer are decoded if the previous segment
+  // left the decoder past that key frame.
+  std::vector<c10::IValue> getFrameBatchSegmentProfilerInputs(
+      const StreamInfo& streamInfo,
+      const FrameBatchSegment& segment) const;
+  // Returns a clone of this decoder that decodes only `streamIndex`.
+  std::unique_ptr<VideoDecoder> createBatchWorker(int streamIndex) const;
+  // Implements clone(). The clone has no active streams.
+  std::unique_ptr<VideoDecoder> cloneWithoutStreams(
+      const DecoderOptions& options) const;
+  // Returns the cached frame of `streamIndex` with the given pts or, if
+  // `exactPts` is false, the cached frame that is displayed at `pts`. On a hit
+  // the cursor is moved to the frame after the returned one.
+  std::optional<DecodedOutput> maybeGetFromFrameCache(
+      int streamIndex,
+      int64_t pts,
+      bool exactPts,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
+  // Like getNextDecodedOutput(), but skips the frames of the other streams.
+  DecodedOutput getNextDecodedOutputFromStream(
+      int streamIndex,
+      std::optional<torch::Tensor> preAllocatedOutputTensor);
+  // Throws if `streamIndex` wasn't added or isn't a video stream.
+  void validateVideoStream(int streamIndex) const;
+  // Throws if the stream was added with keyFramesOnly and the frame at
+  // `frameIndex` of StreamInfo::allFrames isn't a key frame: it is never
+  // decoded, so the next key frame would be returned in its place.
+  void validateFrameIsDecodable(
+      const StreamInfo& streamInfo,
+      int64_t frameIndex) const;
+  // Returns the frame that getNextDecodedOutput() would return if it is cached.
+  std::optional<DecodedOutput> maybeGetNextDecodedOutputFromFrameCache(
+      std::optional<torch::Tensor> preAllocatedOutputTensor);
+  void maybeAddToFrameCache(const DecodedOutput& output, int64_t duration);
   bool canWeAvoidSeekingForStream(
       const StreamInfo& stream,
       int64_t currentPts,
@@ -253,13 +807,75 @@ class VideoDecoder {
   // for more details about the heuristics.
   int getBestStreamIndex(AVMediaType mediaType);
   void initializeDecoder();
+  // Implements reopenFromFilePath() and reopenFromBuffer(): takes over the
+  // input of `decoder`, a new decoder without streams.
+  bool reopen(std::unique_ptr<VideoDecoder> decoder);
+  // Makes `oldStreamInfo`, an active video stream of another decoder whose
+  // codec parameters are compatible with it, decode `streamIndex`.
+  void reuseVideoStream(int streamIndex, StreamInfo oldStreamInfo);
   // Creates and initializes a filter graph for a stream. The filter graph can
   // do rescaling and color conversion.
   void initializeFilterGraphForStream(
       int streamIndex,
       const VideoStreamDecoderOptions& options);
   void maybeSeekToBeforeDesiredPts();
-  DecodedOutput getDecodedOutputWithFilter(std::function<bool(int, AVFrame*)>);
+  // Reads the next packet of the active streams, from the read-ahead queue if
+  // DecoderOptions::numReadAheadPackets is set. Same contract as
+  // av_read_frame().
+  int readPacket(AVPacket* packet);
+  // Stops the read-ahead thread and drops the packets it read. Must be called
+  // before anything else reads from or seeks in formatContext_.
+  void stopPacketReadAhead();
+  // Returns the (offset, length) of the bytes needed to decode the frames in
+  // [startPts, endPts], from the key frame of startPts on, using the scanned
+  // index.
+  std::optional<std::pair<int64_t, int64_t>> getByteRangeForPtsRange(
+      const StreamInfo& streamInfo,
+      int64_t startPts,
+      int64_t endPts) const;
+  // With DecoderOptions::useMemoryMap or useIoUring, starts reading the bytes
+  // of each [startPts, endPts] range of `ptsRanges` ahead of the demuxer.
+  void maybePrefetchPtsRanges(
+      const StreamInfo& streamInfo,
+      const std::vector<std::pair<int64_t, int64_t>>& ptsRanges);
+  // Seeks the demuxer to the byte position of the key frame of `pts`, using
+  // the scanned index. Only done for MPEG-TS and MPEG-PS files with a single
+  // active stream. Returns false if the index, the container or the active
+  // streams don't allow it, in which case nothing was done.
+  bool maybeSeekToKeyFrameBytePosition(
+      const StreamInfo& streamInfo,
+      int64_t pts);
+  DecodedOutput getDecodedOutputWithFilter(
+      std::optional<int> requestedStreamIndex,
+      std::function<bool(int, AVFrame*)>,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
+  // Decodes frames of the active streams until `filterFunction` accepts one,
+  // and returns it with its stream index. Audio frames are added to their
+  // stream's buffer before they are passed to `filterFunction`. Returns a null
+  // frame at the end of the file. The rejected frames of
+  // `requestedStreamIndex`, or of any video stream if it is nullopt, are
+  // counted in DecodeStats::numFramesDiscarded.
+  std::pair<int, UniqueAVFrame> decodeFrameWithFilter(
+      std::optional<int> requestedStreamIndex,
+      std::function<bool(int, AVFrame*)> filterFunction);
+  // Adds decodeStats_ to cumulativeDecodeStats_ and starts new stats.
+  void startNewDecodeStats();
+  // Starts new stats in the public methods that return frames or samples,
+  // unless they are called by another one, so that decodeStats_ covers the
+  // whole call.
+  class DecodeStatsScope {
+   public:
+    explicit DecodeStatsScope(VideoDecoder& decoder);
+    ~DecodeStatsScope();
+    DecodeStatsScope(const DecodeStatsScope&) = delete;
+    DecodeStatsScope& operator=(const DecodeStatsScope&) = delete;
+
+   private:
+    VideoDecoder& decoder_;
+  };
+  // Resamples an audio frame and appends it to its stream's buffer. A null
+  // frame flushes the samples the resampler delayed, at the end of the stream.
+  void appendAudioFrameToBuffer(int streamIndex, const AVFrame* frame);
   // Once we create a decoder can update the metadata with the codec context.
   // For example, for video streams, we can add the height and width of the
   // decoded stream.
@@ -267,14 +883,38 @@ class VideoDecoder {
       int streamIndex,
       AVCodecContext* codecContext);
   void populateVideoMetadataFromStreamIndex(int streamIndex);
+  // Copies the planes of a frame that already has the stream's YUV or gray
+  // output format and size, without converting it.
+  torch::Tensor copyFramePlanesToTensor(
+      int streamIndex,
+      const AVFrame* frame,
+      std::optional<torch::Tensor> preAllocatedOutputTensor);
   torch::Tensor convertFrameToTensorUsingFilterGraph(
       int streamIndex,
-      const AVFrame* frame);
+      const AVFrame* frame,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
+  torch::Tensor convertFrameToTensorUsingSwsScale(
+      int streamIndex,
+      const AVFrame* frame,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
   DecodedOutput convertAVFrameToDecodedOutput(
       int streamIndex,
-      UniqueAVFrame frame);
+      UniqueAVFrame frame,
+      std::optional<torch::Tensor> preAllocatedOutputTensor = std::nullopt);
 
   DecoderOptions options_;
+  // The path of the video file. Empty if the decoder was created from a buffer.
+  std::string videoFilePath_;
+  // The input buffer if the decoder was created from a buffer. Not owned.
+  const void* videoBuffer_ = nullptr;
+  size_t videoBufferLength_ = 0;
+  // The mapping of videoFilePath_ if DecoderOptions::useMemoryMap is set.
+  // Declared before the contexts that read from it so that it outlives them.
+  // Shared with the clones of this decoder.
+  std::shared_ptr<MemoryMappedFile> memoryMappedFile_;
+  // Reads videoFilePath_ if DecoderOptions::useIoUring is set. Declared before
+  // formatContext_ for the same reason.
+  std::unique_ptr<AVIOFileContext> ioFileContext_;
   ContainerMetadata containerMetadata_;
   UniqueAVFormatContext formatContext_;
   std::map<int, StreamInfo> streams_;
@@ -287,8 +927,25 @@ class VideoDecoder {
 
   // Stores various internal decoding stats.
   DecodeStats decodeStats_;
+  // The stats of the calls before the one in decodeStats_.
+  DecodeStats cumulativeDecodeStats_;
+  // The number of DecodeStatsScope objects alive.
+  int numDecodeStatsScopes_ = 0;
+  // The frame cache, most recently used first. frameCacheIndex_ maps the key of
+  // each entry to its position in frameCacheEntries_.
+  std::list<FrameCacheEntry> frameCacheEntries_;
+  std::map<FrameCacheKey, std::list<FrameCacheEntry>::iterator>
+      frameCacheIndex_;
+  int64_t frameCacheNumBytes_ = 0;
+  // Decoders used by getFramesAtIndexes() to decode in parallel, per stream.
+  // They are created on first use and reused across calls.
+  std::map<int, std::vector<std::unique_ptr<VideoDecoder>>> batchWorkers_;
   // Stores the AVIOContext for the input buffer.
   std::unique_ptr<AVIOBytesContext> ioBytesContext_;
+  // Created on the first read after a seek if
+  // DecoderOptions::numReadAheadPackets is set. Declared last so that its
+  // thread is stopped before the contexts it reads from are destroyed.
+  std::unique_ptr<PacketReadAhead> packetReadAhead_;
 };
 
 // Prints the VideoDecoder::DecodeStats to the ostream.
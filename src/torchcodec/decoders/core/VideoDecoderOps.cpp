@@ -29,18 +29,49 @@ TORCH_LIBRARY(torchcodec_ns, m) {
   m.impl_abstract_pystub(
       "torchcodec.decoders.core.video_decoder_ops",
       "//pytorch/torchcodec:torchcodec");
-  m.def("create_from_file(str filename) -> Tensor");
-  m.def("create_from_tensor(Tensor video_tensor) -> Tensor");
+  m.def("create_from_file(str filename, *, str? options=None) -> Tensor");
   m.def(
-      "add_video_stream(Tensor(a!) decoder, *, int? width=None, int? height=None, int? num_threads=None, str? shape=None, int? stream_index=None) -> ()");
+      "create_from_tensor(Tensor video_tensor, *, str? options=None) -> Tensor");
+  m.def("reopen_from_file(Tensor(a!) decoder, str filename) -> bool");
+  m.def("reopen_from_tensor(Tensor(a!) decoder, Tensor video_tensor) -> bool");
+  m.def("clone_decoder(Tensor decoder) -> Tensor");
+  m.def(
+      "add_video_stream(Tensor(a!) decoder, *, int? width=None, int? height=None, int? num_threads=None, str? shape=None, int? stream_index=None, str? options=None) -> ()");
+  m.def(
+      "add_audio_stream(Tensor(a!) decoder, *, int? stream_index=None, str? options=None) -> ()");
+  m.def(
+      "set_video_stream_transform(Tensor(a!) decoder, *, int stream_index, str transform) -> ()");
   m.def("seek_to_pts(Tensor(a!) decoder, float seconds) -> ()");
   m.def("get_next_frame(Tensor(a!) decoder) -> Tensor");
+  m.def(
+      "get_next_frame.out(Tensor(a!) decoder, *, Tensor(b!) out) -> Tensor(b!)");
   m.def("get_frame_at_pts(Tensor(a!) decoder, float seconds) -> Tensor");
+  m.def(
+      "get_frame_at_pts_with_accuracy(Tensor(a!) decoder, float seconds, *, str accuracy) -> (Tensor, float)");
   m.def(
       "get_frame_at_index(Tensor(a!) decoder, *, int frame_index, int? stream_index=None) -> Tensor");
+  m.def(
+      "get_frame_at_index.out(Tensor(a!) decoder, *, int frame_index, int? stream_index=None, Tensor(b!) out) -> Tensor(b!)");
   m.def(
       "get_frames_at_indices(Tensor(a!) decoder, *, int[] frame_indices, int? stream_index=None) -> Tensor");
+  m.def(
+      "get_frames_at_indices.out(Tensor(a!) decoder, *, int[] frame_indices, int? stream_index=None, Tensor(b!) out) -> Tensor(b!)");
+  m.def(
+      "get_frames_in_range(Tensor(a!) decoder, *, int stream_index, int start, int stop, int? step=None) -> Tensor");
+  m.def(
+      "get_key_frames(Tensor(a!) decoder, *, int stream_index, int? step=None) -> Tensor");
+  m.def(
+      "get_frames_in_range.out(Tensor(a!) decoder, *, int stream_index, int start, int stop, int? step=None, Tensor(b!) out) -> Tensor(b!)");
+  m.def(
+      "get_audio_samples_in_range(Tensor(a!) decoder, *, int stream_index, float start_seconds, float stop_seconds) -> Tensor");
+  m.def(
+      "get_audio_samples_in_range.out(Tensor(a!) decoder, *, int stream_index, float start_seconds, float stop_seconds, Tensor(b!) out) -> Tensor(b!)");
   m.def("get_json_metadata(Tensor(a!) decoder) -> str");
+  m.def(
+      "get_decode_stats_json(Tensor(a!) decoder, *, bool cumulative=True) -> str");
+  m.def("reset_decode_stats(Tensor(a!) decoder) -> ()");
+  m.def(
+      "decode_videos(str[] filenames, Tensor[] video_tensors, *, int[] num_frames, int[]? frame_indices=None, float[]? timestamps=None, str? options=None, str? stream_options=None, int? num_threads=None) -> Tensor[]");
 }
 
 // ==============================
@@ -59,20 +90,33 @@ at::Tensor wrapDecoderPointerToTensor(
   return tensor;
 }
 
-at::Tensor create_from_file(c10::string_view filename) {
+VideoDecoder::DecoderOptions parseDecoderOptions(
+    std::optional<c10::string_view> options) {
+  if (!options.has_value()) {
+    return VideoDecoder::DecoderOptions();
+  }
+  return VideoDecoder::DecoderOptions(std::string(options.value()));
+}
+
+at::Tensor create_from_file(
+    c10::string_view filename,
+    std::optional<c10::string_view> options) {
   std::string filenameStr(filename);
   std::unique_ptr<VideoDecoder> uniqueDecoder =
-      VideoDecoder::createFromFilePath(filenameStr);
+      VideoDecoder::createFromFilePath(
+          filenameStr, parseDecoderOptions(options));
   uniqueDecoder->scanFileAndUpdateMetadataAndIndex();
   return wrapDecoderPointerToTensor(std::move(uniqueDecoder));
 }
 
-at::Tensor create_from_tensor(at::Tensor video_tensor) {
+at::Tensor create_from_tensor(
+    at::Tensor video_tensor,
+    std::optional<c10::string_view> options) {
   TORCH_CHECK(video_tensor.is_contiguous(), "video_tensor must be contiguous");
   void* buffer = video_tensor.mutable_data_ptr();
   size_t length = video_tensor.numel();
-  std::unique_ptr<VideoDecoder> videoDecoder =
-      VideoDecoder::createFromBuffer(buffer, length);
+  std::unique_ptr<VideoDecoder> videoDecoder = VideoDecoder::createFromBuffer(
+      buffer, length, parseDecoderOptions(options));
   videoDecoder->scanFileAndUpdateMetadataAndIndex();
   return wrapDecoderPointerToTensor(std::move(videoDecoder));
 }
@@ -84,17 +128,51 @@ at::Tensor create_from_buffer(const void* buffer, size_t length) {
   return wrapDecoderPointerToTensor(std::move(uniqueDecoder));
 }
 
+bool reopen_from_file(at::Tensor& decoder, c10::string_view filename) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  bool reusedAllStreams =
+      videoDecoder->reopenFromFilePath(std::string(filename));
+  videoDecoder->scanFileAndUpdateMetadataAndIndex();
+  return reusedAllStreams;
+}
+
+bool reopen_from_tensor(at::Tensor& decoder, at::Tensor video_tensor) {
+  TORCH_CHECK(video_tensor.is_contiguous(), "video_tensor must be contiguous");
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  bool reusedAllStreams = videoDecoder->reopenFromBuffer(
+      video_tensor.mutable_data_ptr(), video_tensor.numel());
+  videoDecoder->scanFileAndUpdateMetadataAndIndex();
+  return reusedAllStreams;
+}
+
+at::Tensor clone_decoder(at::Tensor& decoder) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  return wrapDecoderPointerToTensor(videoDecoder->clone());
+}
+
 void add_video_stream(
     at::Tensor& decoder,
     std::optional<int64_t> width = std::nullopt,
     std::optional<int64_t> height = std::nullopt,
     std::optional<int64_t> num_threads = std::nullopt,
     std::optional<c10::string_view> shape = std::nullopt,
-    std::optional<int64_t> stream_index = std::nullopt) {
+    std::optional<int64_t> stream_index = std::nullopt,
+    std::optional<c10::string_view> stream_options = std::nullopt) {
+  // The explicit arguments override the ones in `stream_options`.
   VideoDecoder::VideoStreamDecoderOptions options;
-  options.width = width;
-  options.height = height;
-  options.ffmpegThreadCount = num_threads;
+  if (stream_options.has_value()) {
+    options = VideoDecoder::VideoStreamDecoderOptions(
+        std::string(stream_options.value()));
+  }
+  if (width.has_value()) {
+    options.width = width;
+  }
+  if (height.has_value()) {
+    options.height = height;
+  }
+  if (num_threads.has_value()) {
+    options.ffmpegThreadCount = num_threads;
+  }
 
   if (shape.has_value()) {
     std::string stdShape{shape.value()};
@@ -106,9 +184,30 @@ void add_video_stream(
   videoDecoder->addVideoStreamDecoder(stream_index.value_or(-1), options);
 }
 
+void add_audio_stream(
+    at::Tensor& decoder,
+    std::optional<int64_t> stream_index,
+    std::optional<c10::string_view> options) {
+  VideoDecoder::AudioStreamDecoderOptions audioOptions;
+  if (options.has_value()) {
+    audioOptions =
+        VideoDecoder::AudioStreamDecoderOptions(std::string(options.value()));
+  }
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  videoDecoder->addAudioStreamDecoder(stream_index.value_or(-1), audioOptions);
+}
+
+void set_video_stream_transform(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    c10::string_view transform) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  videoDecoder->setVideoStreamTransform(stream_index, std::string(transform));
+}
+
 void seek_to_pts(at::Tensor& decoder, double seconds) {
   auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
-  videoDecoder->setCursorPtsInSeconds(seconds);
+  videoDecoder->seekToTimestamp(seconds);
 }
 
 at::Tensor get_next_frame(at::Tensor& decoder) {
@@ -122,12 +221,28 @@ at::Tensor get_next_frame(at::Tensor& decoder) {
   return result;
 }
 
+at::Tensor& get_next_frame_out(at::Tensor& decoder, at::Tensor& out) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  videoDecoder->getNextDecodedOutput(out);
+  return out;
+}
+
 at::Tensor get_frame_at_pts(at::Tensor& decoder, double seconds) {
   auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
   auto result = videoDecoder->getFrameDisplayedAtTimestamp(seconds);
   return result.frame;
 }
 
+std::tuple<at::Tensor, double> get_frame_at_pts_with_accuracy(
+    at::Tensor& decoder,
+    double seconds,
+    c10::string_view accuracy) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  auto result = videoDecoder->getFrameDisplayedAtTimestamp(
+      seconds, VideoDecoder::SeekAccuracy(std::string(accuracy)));
+  return std::make_tuple(result.frame, result.ptsSeconds);
+}
+
 at::Tensor get_frame_at_index(
     at::Tensor& decoder,
     int64_t frame_index,
@@ -138,6 +253,16 @@ at::Tensor get_frame_at_index(
   return result.frame;
 }
 
+at::Tensor& get_frame_at_index_out(
+    at::Tensor& decoder,
+    int64_t frame_index,
+    std::optional<int64_t> stream_index,
+    at::Tensor& out) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  videoDecoder->getFrameAtIndex(stream_index.value_or(-1), frame_index, out);
+  return out;
+}
+
 at::Tensor get_frames_at_indices(
     at::Tensor& decoder,
     at::IntArrayRef frame_indices,
@@ -150,10 +275,165 @@ at::Tensor get_frames_at_indices(
   return result.frames;
 }
 
+at::Tensor& get_frames_at_indices_out(
+    at::Tensor& decoder,
+    at::IntArrayRef frame_indices,
+    std::optional<int64_t> stream_index,
+    at::Tensor& out) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  std::vector<int64_t> frameIndicesVec(
+      frame_indices.begin(), frame_indices.end());
+  videoDecoder->getFramesAtIndexes(
+      stream_index.value_or(-1), frameIndicesVec, out);
+  return out;
+}
+
+at::Tensor get_frames_in_range(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    int64_t start,
+    int64_t stop,
+    std::optional<int64_t> step) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  auto result = videoDecoder->getFramesInRange(
+      stream_index, start, stop, step.value_or(1));
+  return result.frames;
+}
+
+at::Tensor& get_frames_in_range_out(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    int64_t start,
+    int64_t stop,
+    std::optional<int64_t> step,
+    at::Tensor& out) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  videoDecoder->getFramesInRange(
+      stream_index, start, stop, step.value_or(1), out);
+  return out;
+}
+
+at::Tensor get_audio_samples_in_range(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    double start_seconds,
+    double stop_seconds) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  return videoDecoder->getAudioSamplesInRange(
+      stream_index, start_seconds, stop_seconds);
+}
+
+at::Tensor& get_audio_samples_in_range_out(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    double start_seconds,
+    double stop_seconds,
+    at::Tensor& out) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  videoDecoder->getAudioSamplesInRange(
+      stream_index, start_seconds, stop_seconds, out);
+  return out;
+}
+
+at::Tensor get_key_frames(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    std::optional<int64_t> step) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  auto result = videoDecoder->getKeyFrames(stream_index, step.value_or(1));
+  return result.frames;
+}
+
+std::vector<at::Tensor> decode_videos(
+    std::vector<std::string> filenames,
+    at::TensorList video_tensors,
+    at::IntArrayRef num_frames,
+    std::optional<at::IntArrayRef> frame_indices,
+    std::optional<at::ArrayRef<double>> timestamps,
+    std::optional<c10::string_view> options,
+    std::optional<c10::string_view> stream_options,
+    std::optional<int64_t> num_threads) {
+  TORCH_CHECK(
+      filenames.empty() || video_tensors.empty(),
+      "Only one of filenames and video_tensors can be given");
+  size_t numVideos = filenames.size() + video_tensors.size();
+  TORCH_CHECK(
+      num_frames.size() == numVideos,
+      "Expected one entry in num_frames per video, got ",
+      num_frames.size(),
+      " for ",
+      numVideos,
+      " videos");
+  TORCH_CHECK(
+      frame_indices.has_value() != timestamps.has_value(),
+      "Exactly one of frame_indices and timestamps must be given");
+  // frame_indices and timestamps hold the frames of all the videos, one video
+  // after the other, and num_frames says how many of them are for each video.
+  size_t totalNumFrames = frame_indices.has_value() ? frame_indices->size()
+                                                    : timestamps->size();
+  size_t offset = 0;
+  std::vector<VideoDecoder::VideoDecodeRequest> requests(numVideos);
+  for (size_t i = 0; i < numVideos; ++i) {
+    VideoDecoder::VideoDecodeRequest& request = requests[i];
+    if (!filenames.empty()) {
+      request.videoFilePath = filenames[i];
+    } else {
+      TORCH_CHECK(
+          video_tensors[i].is_contiguous(), "video_tensors must be contiguous");
+      request.buffer = video_tensors[i].data_ptr();
+      request.length = video_tensors[i].numel();
+    }
+    TORCH_CHECK(
+        num_frames[i] >= 0 && offset + num_frames[i] <= totalNumFrames,
+        "num_frames does not match the number of requested frames");
+    if (frame_indices.has_value()) {
+      request.frameIndexes.assign(
+          frame_indices->begin() + offset,
+          frame_indices->begin() + offset + num_frames[i]);
+    } else {
+      request.timestamps.assign(
+          timestamps->begin() + offset,
+          timestamps->begin() + offset + num_frames[i]);
+    }
+    offset += num_frames[i];
+  }
+  TORCH_CHECK(
+      offset == totalNumFrames,
+      "num_frames does not match the number of requested frames");
+  VideoDecoder::VideoStreamDecoderOptions streamOptions;
+  if (stream_options.has_value()) {
+    streamOptions = VideoDecoder::VideoStreamDecoderOptions(
+        std::string(stream_options.value()));
+  }
+  return VideoDecoder::decodeVideos(
+      requests,
+      parseDecoderOptions(options),
+      streamOptions,
+      num_threads.value_or(0));
+}
+
 std::string quoteValue(const std::string& value) {
   return "\"" + value + "\"";
 }
 
+std::string mapToJson(const std::map<std::string, std::string>& map) {
+  std::stringstream ss;
+  ss << "{\n";
+  auto it = map.begin();
+  while (it != map.end()) {
+    ss << "\"" << it->first << "\": " << it->second;
+    ++it;
+    if (it != map.end()) {
+      ss << ",\n";
+    } else {
+      ss << "\n";
+    }
+  }
+  ss << "}";
+
+  return ss.str();
+}
+
 std::string get_json_metadata(at::Tensor& decoder) {
   auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
 
@@ -219,38 +499,103 @@ std::string get_json_metadata(at::Tensor& decoder) {
   if (videoMetadata.bestAudioStreamIndex.has_value()) {
     metadataMap["bestAudioStreamIndex"] =
         std::to_string(*videoMetadata.bestAudioStreamIndex);
+    const auto& audioMetadata =
+        videoMetadata.streams[*videoMetadata.bestAudioStreamIndex];
+    if (audioMetadata.sampleRate.has_value()) {
+      metadataMap["audioSampleRate"] =
+          std::to_string(*audioMetadata.sampleRate);
+    }
+    if (audioMetadata.numChannels.has_value()) {
+      metadataMap["audioNumChannels"] =
+          std::to_string(*audioMetadata.numChannels);
+    }
   }
 
-  std::stringstream ss;
-  ss << "{\n";
-  auto it = metadataMap.begin();
-  while (it != metadataMap.end()) {
-    ss << "\"" << it->first << "\": " << it->second;
-    ++it;
-    if (it != metadataMap.end()) {
-      ss << ",\n";
-    } else {
-      ss << "\n";
-    }
+  return mapToJson(metadataMap);
+}
+
+std::string get_decode_stats_json(at::Tensor& decoder, bool cumulative) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  VideoDecoder::DecodeStats stats = cumulative
+      ? videoDecoder->getCumulativeDecodeStats()
+      : videoDecoder->getDecodeStats();
+
+  std::map<std::string, std::string> statsMap;
+  statsMap["numSeeksAttempted"] = std::to_string(stats.numSeeksAttempted);
+  statsMap["numSeeksDone"] = std::to_string(stats.numSeeksDone);
+  statsMap["numSeeksSkipped"] = std::to_string(stats.numSeeksSkipped);
+  statsMap["numByteSeeks"] = std::to_string(stats.numByteSeeks);
+  statsMap["numFlushes"] = std::to_string(stats.numFlushes);
+  statsMap["numPacketsRead"] = std::to_string(stats.numPacketsRead);
+  statsMap["numPacketsSentToDecoder"] =
+      std::to_string(stats.numPacketsSentToDecoder);
+  statsMap["numFramesReceivedByDecoder"] =
+      std::to_string(stats.numFramesReceivedByDecoder);
+  statsMap["numFramesDiscarded"] = std::to_string(stats.numFramesDiscarded);
+  statsMap["numFrameCacheHits"] = std::to_string(stats.numFrameCacheHits);
+  statsMap["numFrameCacheMisses"] = std::to_string(stats.numFrameCacheMisses);
+  statsMap["maxReadAheadQueueDepth"] =
+      std::to_string(stats.maxReadAheadQueueDepth);
+  statsMap["maxReadAheadBytesBuffered"] =
+      std::to_string(stats.maxReadAheadBytesBuffered);
+  statsMap["readAheadStallMicros"] = std::to_string(stats.readAheadStallMicros);
+  statsMap["seekMicros"] = std::to_string(stats.seekMicros);
+  statsMap["demuxMicros"] = std::to_string(stats.demuxMicros);
+  statsMap["sendPacketMicros"] = std::to_string(stats.sendPacketMicros);
+  statsMap["receiveFrameMicros"] = std::to_string(stats.receiveFrameMicros);
+  statsMap["conversionMicros"] = std::to_string(stats.conversionMicros);
+  statsMap["tensorMicros"] = std::to_string(stats.tensorMicros);
+
+  // The input reads are only counted since the input was opened.
+  std::optional<AsyncFileReader::Stats> asyncReadStats =
+      videoDecoder->getAsyncReadStats();
+  if (asyncReadStats.has_value()) {
+    statsMap["asyncReadBytes"] = std::to_string(asyncReadStats->bytesRead);
+    statsMap["asyncReadBlockHits"] =
+        std::to_string(asyncReadStats->numBlockHits);
+    statsMap["asyncReadBlockWaits"] =
+        std::to_string(asyncReadStats->numBlockWaits);
+    statsMap["asyncReadWaitMicros"] =
+        std::to_string(asyncReadStats->waitMicros);
   }
-  ss << "}";
+  return mapToJson(statsMap);
+}
 
-  return ss.str();
+void reset_decode_stats(at::Tensor& decoder) {
+  auto videoDecoder = static_cast<VideoDecoder*>(decoder.mutable_data_ptr());
+  videoDecoder->resetDecodeStats();
 }
 
 TORCH_LIBRARY_IMPL(torchcodec_ns, BackendSelect, m) {
   m.impl("create_from_file", &create_from_file);
   m.impl("create_from_tensor", &create_from_tensor);
+  m.impl("decode_videos", &decode_videos);
 }
 
 TORCH_LIBRARY_IMPL(torchcodec_ns, CPU, m) {
+  m.impl("reopen_from_file", &reopen_from_file);
+  m.impl("reopen_from_tensor", &reopen_from_tensor);
+  m.impl("clone_decoder", &clone_decoder);
   m.impl("seek_to_pts", &seek_to_pts);
   m.impl("add_video_stream", &add_video_stream);
+  m.impl("add_audio_stream", &add_audio_stream);
+  m.impl("set_video_stream_transform", &set_video_stream_transform);
   m.impl("get_next_frame", &get_next_frame);
+  m.impl("get_next_frame.out", &get_next_frame_out);
   m.impl("get_json_metadata", &get_json_metadata);
+  m.impl("get_decode_stats_json", &get_decode_stats_json);
+  m.impl("reset_decode_stats", &reset_decode_stats);
   m.impl("get_frame_at_pts", &get_frame_at_pts);
+  m.impl("get_frame_at_pts_with_accuracy", &get_frame_at_pts_with_accuracy);
   m.impl("get_frame_at_index", &get_frame_at_index);
+  m.impl("get_frame_at_index.out", &get_frame_at_index_out);
   m.impl("get_frames_at_indices", &get_frames_at_indices);
+  m.impl("get_frames_at_indices.out", &get_frames_at_indices_out);
+  m.impl("get_frames_in_range", &get_frames_in_range);
+  m.impl("get_frames_in_range.out", &get_frames_in_range_out);
+  m.impl("get_key_frames", &get_key_frames);
+  m.impl("get_audio_samples_in_range", &get_audio_samples_in_range);
+  m.impl("get_audio_samples_in_range.out", &get_audio_samples_in_range_out);
 }
 
 } // namespace facebook::torchcodec
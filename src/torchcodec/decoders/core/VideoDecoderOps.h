@@ -4,6 +4,7 @@
 
 #include <torch/types.h>
 #include <optional>
+#include <tuple>
 
 namespace facebook::torchcodec {
 
@@ -15,25 +16,62 @@ namespace facebook::torchcodec {
 //          .typed<decltype(VideoDecoder_create)>();
 // auto decoderTensor = createDecoderOp.call(videoPath);
 
-// Create a VideoDecoder from file and wrap the pointer in a tensor.
-at::Tensor create_from_file(c10::string_view filename);
+// Create a VideoDecoder from file and wrap the pointer in a tensor. `options`
+// is parsed by VideoDecoder::DecoderOptions, e.g. "index_cache=1".
+at::Tensor create_from_file(
+    c10::string_view filename,
+    std::optional<c10::string_view> options = std::nullopt);
 
-at::Tensor create_from_tensor(at::Tensor video_tensor);
+at::Tensor create_from_tensor(
+    at::Tensor video_tensor,
+    std::optional<c10::string_view> options = std::nullopt);
+
+// Point an existing decoder at a new video, keeping its active streams and,
+// where the codec parameters match, their open codec contexts. Returns true if
+// every active stream was kept. See VideoDecoder::reopenFromFilePath().
+bool reopen_from_file(at::Tensor& decoder, c10::string_view filename);
+
+bool reopen_from_tensor(at::Tensor& decoder, at::Tensor video_tensor);
+
+// Create a decoder over the same video with the same active streams, without
+// probing or scanning the video again. The new decoder can be used on another
+// thread. A clone of a decoder created from a tensor doesn't keep the tensor
+// alive either. See VideoDecoder::clone().
+at::Tensor clone_decoder(at::Tensor& decoder);
 
 // This API is C++ only and will not be exposed via custom ops, use
 // videodecoder_create_from_bytes in Python
 at::Tensor create_from_buffer(const void* buffer, size_t length);
 
 // Add a new video stream at `stream_index` using the provided options.
+// `stream_options` is parsed by VideoDecoder::VideoStreamDecoderOptions, e.g.
+// "key_frames_only=1", and is overridden by the other arguments.
 void add_video_stream(
     at::Tensor& decoder,
     std::optional<int64_t> width = std::nullopt,
     std::optional<int64_t> height = std::nullopt,
     std::optional<int64_t> num_threads = std::nullopt,
     std::optional<c10::string_view> shape = std::nullopt,
-    std::optional<int64_t> stream_index = std::nullopt);
+    std::optional<int64_t> stream_index = std::nullopt,
+    std::optional<c10::string_view> stream_options = std::nullopt);
+
+// Add a new audio stream at `stream_index` (-1 or None for the best audio
+// stream). `options` is parsed by VideoDecoder::AudioStreamDecoderOptions,
+// e.g. "sample_rate=16000,num_channels=1".
+void add_audio_stream(
+    at::Tensor& decoder,
+    std::optional<int64_t> stream_index = std::nullopt,
+    std::optional<c10::string_view> options = std::nullopt);
+
+// Replaces the crop, resize and flip of an active video stream for the frames
+// returned from now on. See VideoDecoder::setVideoStreamTransform().
+void set_video_stream_transform(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    c10::string_view transform);
 
 // Seek to a particular presentation timestamp in the video in seconds.
+// Uses the seek_accuracy of the stream, see add_video_stream.
 void seek_to_pts(at::Tensor& decoder, double seconds);
 
 // Return the frame that is visible at a given timestamp in seconds. Each frame
@@ -41,6 +79,14 @@ void seek_to_pts(at::Tensor& decoder, double seconds);
 // given timestamp T has T >= PTS and T < PTS + Duration.
 at::Tensor get_frame_at_pts(at::Tensor& decoder, double seconds);
 
+// Return the cheapest frame to decode that satisfies `accuracy` for a seek to
+// `seconds` (e.g. "key_frame" or "frames:5", see
+// VideoDecoder::SeekAccuracy), and its actual timestamp in seconds.
+std::tuple<at::Tensor, double> get_frame_at_pts_with_accuracy(
+    at::Tensor& decoder,
+    double seconds,
+    c10::string_view accuracy);
+
 // Return the frame that is visible at a given index in the video.
 at::Tensor get_frame_at_index(
     at::Tensor& decoder,
@@ -54,10 +100,91 @@ at::Tensor get_frames_at_indices(
     at::IntArrayRef frame_indices,
     std::optional<int64_t> stream_index = std::nullopt);
 
+// Return the frames at indexes start, start + step, ... up to but excluding
+// stop for a given stream as a single stacked Tensor.
+at::Tensor get_frames_in_range(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    int64_t start,
+    int64_t stop,
+    std::optional<int64_t> step = std::nullopt);
+
+// Return every `step`-th key frame of a given stream as a single stacked
+// Tensor.
+at::Tensor get_key_frames(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    std::optional<int64_t> step = std::nullopt);
+
+// Return the float32 samples of an audio stream in
+// [start_seconds, stop_seconds) as a [channels, samples] tensor. See
+// VideoDecoder::getAudioSamplesInRange().
+at::Tensor get_audio_samples_in_range(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    double start_seconds,
+    double stop_seconds);
+
 // Get the next frame from the video as a tensor.
 at::Tensor get_next_frame(at::Tensor& decoder);
 
+// The following out variants decode into `out` and return it. `out` must be a
+// contiguous uint8 tensor with the shape of the output of the op, e.g. a
+// buffer reused across calls.
+at::Tensor& get_next_frame_out(at::Tensor& decoder, at::Tensor& out);
+
+at::Tensor& get_frame_at_index_out(
+    at::Tensor& decoder,
+    int64_t frame_index,
+    std::optional<int64_t> stream_index,
+    at::Tensor& out);
+
+at::Tensor& get_frames_at_indices_out(
+    at::Tensor& decoder,
+    at::IntArrayRef frame_indices,
+    std::optional<int64_t> stream_index,
+    at::Tensor& out);
+
+at::Tensor& get_frames_in_range_out(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    int64_t start,
+    int64_t stop,
+    std::optional<int64_t> step,
+    at::Tensor& out);
+
+// `out` must be a contiguous float32 [channels, samples] tensor.
+at::Tensor& get_audio_samples_in_range_out(
+    at::Tensor& decoder,
+    int64_t stream_index,
+    double start_seconds,
+    double stop_seconds,
+    at::Tensor& out);
+
+// Decode frames from several videos concurrently, see
+// VideoDecoder::decodeVideos(). The videos are given either as `filenames` or
+// as `video_tensors`. The frames are given as `frame_indices` or `timestamps`
+// for all the videos, one video after the other, and `num_frames` has the
+// number of frames of each video. Returns one stacked Tensor per video.
+std::vector<at::Tensor> decode_videos(
+    std::vector<std::string> filenames,
+    at::TensorList video_tensors,
+    at::IntArrayRef num_frames,
+    std::optional<at::IntArrayRef> frame_indices = std::nullopt,
+    std::optional<at::ArrayRef<double>> timestamps = std::nullopt,
+    std::optional<c10::string_view> options = std::nullopt,
+    std::optional<c10::string_view> stream_options = std::nullopt,
+    std::optional<int64_t> num_threads = std::nullopt);
+
 // Get the metadata from the video as a string.
 std::string get_json_metadata(at::Tensor& decoder);
 
+// Get the decode stats as a JSON string: the counts and per stage times of
+// the last op that returned frames or samples or, if `cumulative` is true,
+// everything decoded since the decoder was created or its stats were reset.
+// See VideoDecoder::DecodeStats.
+std::string get_decode_stats_json(at::Tensor& decoder, bool cumulative = true);
+
+void reset_decode_stats(at::Tensor& decoder);
+
 } // namespace facebook::torchcodec
@@ -1,4 +1,5 @@
-from typing import List, Optional
+import json
+from typing import Dict, List, Optional, Tuple, Union
 
 import torch
 from torch.library import get_ctx, register_fake
@@ -16,32 +17,155 @@ create_from_file = torch._dynamo.disallow_in_graph(
 create_from_tensor = torch._dynamo.disallow_in_graph(
     torch.ops.torchcodec_ns.create_from_tensor.default
 )
+reopen_from_file = torch.ops.torchcodec_ns.reopen_from_file.default
+reopen_from_tensor = torch.ops.torchcodec_ns.reopen_from_tensor.default
+clone_decoder = torch._dynamo.disallow_in_graph(
+    torch.ops.torchcodec_ns.clone_decoder.default
+)
 add_video_stream = torch.ops.torchcodec_ns.add_video_stream.default
+add_audio_stream = torch.ops.torchcodec_ns.add_audio_stream.default
+set_video_stream_transform = (
+    torch.ops.torchcodec_ns.set_video_stream_transform.default
+)
 seek_to_pts = torch.ops.torchcodec_ns.seek_to_pts.default
 get_next_frame = torch.ops.torchcodec_ns.get_next_frame.default
+get_next_frame_out = torch.ops.torchcodec_ns.get_next_frame.out
 get_frame_at_pts = torch.ops.torchcodec_ns.get_frame_at_pts.default
+get_frame_at_pts_with_accuracy = (
+    torch.ops.torchcodec_ns.get_frame_at_pts_with_accuracy.default
+)
 get_frame_at_index = torch.ops.torchcodec_ns.get_frame_at_index.default
+get_frame_at_index_out = torch.ops.torchcodec_ns.get_frame_at_index.out
 get_frames_at_indices = torch.ops.torchcodec_ns.get_frames_at_indices.default
+get_frames_at_indices_out = torch.ops.torchcodec_ns.get_frames_at_indices.out
+get_frames_in_range = torch.ops.torchcodec_ns.get_frames_in_range.default
+get_frames_in_range_out = torch.ops.torchcodec_ns.get_frames_in_range.out
+get_key_frames = torch.ops.torchcodec_ns.get_key_frames.default
+get_audio_samples_in_range = (
+    torch.ops.torchcodec_ns.get_audio_samples_in_range.default
+)
+get_audio_samples_in_range_out = (
+    torch.ops.torchcodec_ns.get_audio_samples_in_range.out
+)
 get_json_metadata = torch.ops.torchcodec_ns.get_json_metadata.default
+get_decode_stats_json = torch.ops.torchcodec_ns.get_decode_stats_json.default
+reset_decode_stats = torch.ops.torchcodec_ns.reset_decode_stats.default
+decode_videos = torch._dynamo.disallow_in_graph(
+    torch.ops.torchcodec_ns.decode_videos.default
+)
 
 
 # =============================
 # Functions not related to custom ops, but similar implementation to c++ ops
 # =============================
-def create_from_bytes(video_bytes: bytes) -> torch.Tensor:
-    return create_from_tensor(torch.frombuffer(video_bytes, dtype=torch.uint8))
+def create_from_bytes(
+    video_bytes: bytes, options: Optional[str] = None
+) -> torch.Tensor:
+    return create_from_tensor(
+        torch.frombuffer(video_bytes, dtype=torch.uint8), options=options
+    )
+
+
+# Returns the decode stats of the decoder as a dict: counts of seeks, packets
+# and frames, and the microseconds spent seeking, demuxing, in
+# avcodec_send_packet (sendPacketMicros) and avcodec_receive_frame
+# (receiveFrameMicros), converting frames and filling the output tensors. The
+# stats cover everything decoded since the decoder was created or
+# reset_decode_stats was called, or only the last op that returned frames or
+# samples if `cumulative` is False.
+def get_decode_stats(
+    decoder: torch.Tensor, *, cumulative: bool = True
+) -> Dict[str, int]:
+    return json.loads(get_decode_stats_json(decoder, cumulative=cumulative))
+
+
+# Decodes frames from several videos concurrently on C++ threads. `videos` are
+# either all paths or all uint8 tensors with the encoded videos, and exactly one
+# of `frame_indices` and `timestamps` has the frames to decode for each video.
+# Returns one stacked tensor for all the videos if their frames have the same
+# shape, and one stacked tensor per video otherwise.
+def get_frames_from_videos(
+    videos: List[Union[str, torch.Tensor]],
+    *,
+    frame_indices: Optional[List[List[int]]] = None,
+    timestamps: Optional[List[List[float]]] = None,
+    options: Optional[str] = None,
+    stream_options: Optional[str] = None,
+    num_threads: Optional[int] = None
+) -> Union[torch.Tensor, List[torch.Tensor]]:
+    frames_per_video = frame_indices if frame_indices is not None else timestamps
+    if frames_per_video is None or len(frames_per_video) != len(videos):
+        raise ValueError("Expected the frames to decode for each video.")
+    filenames = [video for video in videos if isinstance(video, str)]
+    video_tensors = [video for video in videos if isinstance(video, torch.Tensor)]
+    flat_frames = [frame for frames in frames_per_video for frame in frames]
+    outputs = decode_videos(
+        filenames,
+        video_tensors,
+        num_frames=[len(frames) for frames in frames_per_video],
+        frame_indices=flat_frames if frame_indices is not None else None,
+        timestamps=flat_frames if timestamps is not None else None,
+        options=options,
+        stream_options=stream_options,
+        num_threads=num_threads,
+    )
+    if len(outputs) > 0 and all(
+        output.shape[1:] == outputs[0].shape[1:] for output in outputs
+    ):
+        return torch.stack(outputs)
+    return outputs
+
+
+# Returns views of the (Y, U, V) planes of yuv420p frames, or of the (Y, UV)
+# planes of nv12 frames. `frames` is a frame, or a batch of frames, of shape
+# (..., H * 3 / 2, W) decoded with that output_format.
+def split_yuv_planes(
+    frames: torch.Tensor, output_format: str
+) -> Tuple[torch.Tensor, ...]:
+    height = frames.shape[-2] * 2 // 3
+    width = frames.shape[-1]
+    luma = frames[..., :height, :]
+    chroma = frames[..., height:, :].flatten(-2)
+    if output_format == "nv12":
+        return luma, chroma.unflatten(-1, (height // 2, width // 2, 2))
+    if output_format == "yuv420p":
+        u, v = chroma.chunk(2, dim=-1)
+        chroma_shape = (height // 2, width // 2)
+        return luma, u.unflatten(-1, chroma_shape), v.unflatten(-1, chroma_shape)
+    raise ValueError(f"Expected a yuv420p or nv12 output_format, got {output_format}")
 
 
 # ==============================
 # Abstract impl for the operators. Needed by torch.compile.
 # ==============================
 @register_fake("torchcodec_ns::create_from_file")
-def create_from_file_abstract(filename: str) -> torch.Tensor:
+def create_from_file_abstract(
+    filename: str, *, options: Optional[str] = None
+) -> torch.Tensor:
     return torch.empty([], dtype=torch.long)
 
 
 @register_fake("torchcodec_ns::create_from_tensor")
-def create_from_tensor_abstract(video_tensor: torch.Tensor) -> torch.Tensor:
+def create_from_tensor_abstract(
+    video_tensor: torch.Tensor, *, options: Optional[str] = None
+) -> torch.Tensor:
+    return torch.empty([], dtype=torch.long)
+
+
+@register_fake("torchcodec_ns::reopen_from_file")
+def reopen_from_file_abstract(decoder: torch.Tensor, filename: str) -> bool:
+    return True
+
+
+@register_fake("torchcodec_ns::reopen_from_tensor")
+def reopen_from_tensor_abstract(
+    decoder: torch.Tensor, video_tensor: torch.Tensor
+) -> bool:
+    return True
+
+
+@register_fake("torchcodec_ns::clone_decoder")
+def clone_decoder_abstract(decoder: torch.Tensor) -> torch.Tensor:
     return torch.empty([], dtype=torch.long)
 
 
@@ -53,7 +177,25 @@ def add_video_stream_abstract(
     height: Optional[int] = None,
     num_threads: Optional[int] = None,
     shape: Optional[str] = None,
-    stream_index: Optional[int] = None
+    stream_index: Optional[int] = None,
+    options: Optional[str] = None
+) -> None:
+    return
+
+
+@register_fake("torchcodec_ns::add_audio_stream")
+def add_audio_stream_abstract(
+    decoder: torch.Tensor,
+    *,
+    stream_index: Optional[int] = None,
+    options: Optional[str] = None
+) -> None:
+    return
+
+
+@register_fake("torchcodec_ns::set_video_stream_transform")
+def set_video_stream_transform_abstract(
+    decoder: torch.Tensor, *, stream_index: int, transform: str
 ) -> None:
     return
 
@@ -71,6 +213,14 @@ def get_next_frame_abstract(decoder: torch.Tensor) -> torch.Tensor:
     return torch.empty(image_size)
 
 
+@register_fake("torchcodec_ns::get_frame_at_pts_with_accuracy")
+def get_frame_at_pts_with_accuracy_abstract(
+    decoder: torch.Tensor, seconds: float, *, accuracy: str
+) -> Tuple[torch.Tensor, float]:
+    image_size = [get_ctx().new_dynamic_size() for _ in range(3)]
+    return torch.empty(image_size), 0.0
+
+
 @register_fake("torchcodec_ns::get_frame_at_pts")
 def get_frame_at_pts_abstract(decoder: torch.Tensor, seconds: float) -> torch.Tensor:
     image_size = [get_ctx().new_dynamic_size() for _ in range(3)]
@@ -96,6 +246,122 @@ def get_frames_at_indices_abstract(
     return torch.empty(image_size)
 
 
+@register_fake("torchcodec_ns::get_frames_in_range")
+def get_frames_in_range_abstract(
+    decoder: torch.Tensor,
+    *,
+    stream_index: int,
+    start: int,
+    stop: int,
+    step: Optional[int] = None
+) -> torch.Tensor:
+    image_size = [get_ctx().new_dynamic_size() for _ in range(4)]
+    return torch.empty(image_size)
+
+
+@register_fake("torchcodec_ns::get_key_frames")
+def get_key_frames_abstract(
+    decoder: torch.Tensor, *, stream_index: int, step: Optional[int] = None
+) -> torch.Tensor:
+    image_size = [get_ctx().new_dynamic_size() for _ in range(4)]
+    return torch.empty(image_size)
+
+
+@register_fake("torchcodec_ns::get_next_frame.out")
+def get_next_frame_out_abstract(
+    decoder: torch.Tensor, *, out: torch.Tensor
+) -> torch.Tensor:
+    return out
+
+
+@register_fake("torchcodec_ns::get_frame_at_index.out")
+def get_frame_at_index_out_abstract(
+    decoder: torch.Tensor,
+    *,
+    frame_index: int,
+    stream_index: Optional[int] = None,
+    out: torch.Tensor
+) -> torch.Tensor:
+    return out
+
+
+@register_fake("torchcodec_ns::get_frames_at_indices.out")
+def get_frames_at_indices_out_abstract(
+    decoder: torch.Tensor,
+    *,
+    frame_indices: List[int],
+    stream_index: Optional[int] = None,
+    out: torch.Tensor
+) -> torch.Tensor:
+    return out
+
+
+@register_fake("torchcodec_ns::get_frames_in_range.out")
+def get_frames_in_range_out_abstract(
+    decoder: torch.Tensor,
+    *,
+    stream_index: int,
+    start: int,
+    stop: int,
+    step: Optional[int] = None,
+    out: torch.Tensor
+) -> torch.Tensor:
+    return out
+
+
+@register_fake("torchcodec_ns::get_audio_samples_in_range")
+def get_audio_samples_in_range_abstract(
+    decoder: torch.Tensor,
+    *,
+    stream_index: int,
+    start_seconds: float,
+    stop_seconds: float
+) -> torch.Tensor:
+    # Samples are 2 dimensions: channels, samples.
+    samples_size = [get_ctx().new_dynamic_size() for _ in range(2)]
+    return torch.empty(samples_size)
+
+
+@register_fake("torchcodec_ns::get_audio_samples_in_range.out")
+def get_audio_samples_in_range_out_abstract(
+    decoder: torch.Tensor,
+    *,
+    stream_index: int,
+    start_seconds: float,
+    stop_seconds: float,
+    out: torch.Tensor
+) -> torch.Tensor:
+    return out
+
+
+@register_fake("torchcodec_ns::decode_videos")
+def decode_videos_abstract(
+    filenames: List[str],
+    video_tensors: List[torch.Tensor],
+    *,
+    num_frames: List[int],
+    frame_indices: Optional[List[int]] = None,
+    timestamps: Optional[List[float]] = None,
+    options: Optional[str] = None,
+    stream_options: Optional[str] = None,
+    num_threads: Optional[int] = None
+) -> List[torch.Tensor]:
+    image_size = [get_ctx().new_dynamic_size() for _ in range(3)]
+    return [torch.empty([n] + image_size) for n in num_frames]
+
+
 @register_fake("torchcodec_ns::get_json_metadata")
 def get_json_metadata_abstract(decoder: torch.Tensor) -> str:
     return torch.empty_like("")
+
+
+@register_fake("torchcodec_ns::get_decode_stats_json")
+def get_decode_stats_json_abstract(
+    decoder: torch.Tensor, *, cumulative: bool = True
+) -> str:
+    return ""
+
+
+@register_fake("torchcodec_ns::reset_decode_stats")
+def reset_decode_stats_abstract(decoder: torch.Tensor) -> None:
+    return
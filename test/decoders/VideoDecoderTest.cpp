@@ -4,7 +4,13 @@
 
 #include <gtest/gtest.h>
 #include <opencv2/opencv.hpp>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <thread>
 
 #include "tools/cxx/Resources.h"
 
@@ -21,11 +27,119 @@ std::string getResourcePath(const std::string& filename) {
   return build::getResourcePath(filename).string();
 }
 
+// Copies stream `streamIndex` of `inputPath`, without decoding it, into a new
+// file of the `formatName` container. Returns the new file's path.
+std::string remuxStream(
+    const std::string& inputPath,
+    int streamIndex,
+    const std::string& formatName) {
+  AVFormatContext* rawInput = nullptr;
+  TORCH_CHECK(
+      avformat_open_input(&rawInput, inputPath.c_str(), nullptr, nullptr) >= 0,
+      "Could not open ",
+      inputPath);
+  UniqueAVFormatContext input(rawInput);
+  TORCH_CHECK(avformat_find_stream_info(input.get(), nullptr) >= 0);
+  std::string outputPath = (std::filesystem::temp_directory_path() /
+                            ("torchcodec_remuxed_test." + formatName))
+                               .string();
+  AVFormatContext* output = nullptr;
+  TORCH_CHECK(
+      avformat_alloc_output_context2(
+          &output, nullptr, formatName.c_str(), outputPath.c_str()) >= 0);
+  AVStream* inputStream = input->streams[streamIndex];
+  AVStream* outputStream = avformat_new_stream(output, nullptr);
+  avcodec_parameters_copy(outputStream->codecpar, inputStream->codecpar);
+  outputStream->codecpar->codec_tag = 0;
+  outputStream->time_base = inputStream->time_base;
+  TORCH_CHECK(
+      avio_open(&output->pb, outputPath.c_str(), AVIO_FLAG_WRITE) >= 0 &&
+      avformat_write_header(output, nullptr) >= 0);
+  UniqueAVPacket packet(av_packet_alloc());
+  while (av_read_frame(input.get(), packet.get()) >= 0) {
+    if (packet->stream_index == streamIndex) {
+      av_packet_rescale_ts(
+          packet.get(), inputStream->time_base, outputStream->time_base);
+      packet->stream_index = 0;
+      packet->pos = -1;
+      TORCH_CHECK(av_interleaved_write_frame(output, packet.get()) >= 0);
+    }
+    av_packet_unref(packet.get());
+  }
+  TORCH_CHECK(av_write_trailer(output) >= 0);
+  avio_closep(&output->pb);
+  avformat_free_context(output);
+  return outputPath;
+}
+
+// Encodes a Matroska video of `numFrames` MPEG-4 part 2 frames, a codec that
+// can decode at a reduced resolution. Returns its path.
+std::string encodeMpeg4Video(int width, int height, int numFrames) {
+  std::string outputPath =
+      (std::filesystem::temp_directory_path() / "torchcodec_mpeg4_test.mkv")
+          .string();
+  AVFormatContext* output = nullptr;
+  TORCH_CHECK(
+      avformat_alloc_output_context2(
+          &output, nullptr, "matroska", outputPath.c_str()) >= 0);
+  const AVCodec* codec = avcodec_find_encoder_by_name("mpeg4");
+  TORCH_CHECK(codec != nullptr);
+  UniqueAVCodecContext codecContext(avcodec_alloc_context3(codec));
+  codecContext->width = width;
+  codecContext->height = height;
+  codecContext->pix_fmt = AV_PIX_FMT_YUV420P;
+  codecContext->time_base = {1, 25};
+  codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  TORCH_CHECK(avcodec_open2(codecContext.get(), codec, nullptr) >= 0);
+  AVStream* stream = avformat_new_stream(output, nullptr);
+  stream->time_base = codecContext->time_base;
+  avcodec_parameters_from_context(stream->codecpar, codecContext.get());
+  TORCH_CHECK(
+      avio_open(&output->pb, outputPath.c_str(), AVIO_FLAG_WRITE) >= 0 &&
+      avformat_write_header(output, nullptr) >= 0);
+  UniqueAVFrame frame(av_frame_alloc());
+  frame->format = AV_PIX_FMT_YUV420P;
+  frame->width = width;
+  frame->height = height;
+  TORCH_CHECK(av_frame_get_buffer(frame.get(), 0) >= 0);
+  UniqueAVPacket packet(av_packet_alloc());
+  for (int i = 0; i <= numFrames; ++i) {
+    // The last iteration flushes the encoder.
+    if (i < numFrames) {
+      TORCH_CHECK(av_frame_make_writable(frame.get()) >= 0);
+      for (int plane = 0; plane < 3; ++plane) {
+        int planeHeight = plane == 0 ? height : height / 2;
+        for (int y = 0; y < planeHeight; ++y) {
+          std::memset(
+              frame->data[plane] + y * frame->linesize[plane],
+              (y * 4 + i * 8 + plane * 64) % 256,
+              frame->linesize[plane]);
+        }
+      }
+      frame->pts = i;
+    }
+    avcodec_send_frame(
+        codecContext.get(), i < numFrames ? frame.get() : nullptr);
+    while (avcodec_receive_packet(codecContext.get(), packet.get()) >= 0) {
+      av_packet_rescale_ts(
+          packet.get(), codecContext->time_base, stream->time_base);
+      packet->stream_index = stream->index;
+      TORCH_CHECK(av_interleaved_write_frame(output, packet.get()) >= 0);
+    }
+  }
+  TORCH_CHECK(av_write_trailer(output) >= 0);
+  avio_closep(&output->pb);
+  avformat_free_context(output);
+  return outputPath;
+}
+
 class VideoDecoderTest : public testing::TestWithParam<bool> {
  protected:
   std::unique_ptr<VideoDecoder> createDecoderFromPath(
       const std::string& filepath,
-      bool useMemoryBuffer) {
+      bool useMemoryBuffer,
+      const VideoDecoder::DecoderOptions& options =
+          VideoDecoder::DecoderOptions()) {
     if (useMemoryBuffer) {
       std::ostringstream outputStringStream;
       std::ifstream input(filepath, std::ios::binary);
@@ -33,9 +147,9 @@ class VideoDecoderTest : public testing::TestWithParam<bool> {
       content_ = outputStringStream.str();
       void* buffer = content_.data();
       size_t length = outputStringStream.str().length();
-      return VideoDecoder::createFromBuffer(buffer, length);
+      return VideoDecoder::createFromBuffer(buffer, length, options);
     } else {
-      return VideoDecoder::createFromFilePath(filepath);
+      return VideoDecoder::createFromFilePath(filepath, options);
     }
   }
   std::string content_;
@@ -134,6 +248,529 @@ double computeAverageCosineSimilarity(
 //   EXPECT_EQ(options.ffmpegThreadCount, 3);
 // }
 
+TEST(DecoderOptionsTest, ConvertsFromStringToDecoderOptions) {
+  VideoDecoder::DecoderOptions options(
+      "index_cache=1,index_cache_dir=/tmp/torchcodec");
+  EXPECT_TRUE(options.useIndexCache);
+  EXPECT_EQ(options.indexCacheDirectory, "/tmp/torchcodec");
+  EXPECT_EQ(
+      VideoDecoder::DecoderOptions("frame_cache_bytes=1024")
+          .frameCacheCapacityBytes,
+      1024);
+  EXPECT_THROW(
+      VideoDecoder::DecoderOptions("index_cache=maybe"), std::runtime_error);
+  EXPECT_EQ(
+      VideoDecoder::DecoderOptions("read_ahead_packets=16").numReadAheadPackets,
+      16);
+  EXPECT_TRUE(VideoDecoder::DecoderOptions("mmap=true").useMemoryMap);
+  EXPECT_TRUE(VideoDecoder::DecoderOptions("io_uring=1").useIoUring);
+  EXPECT_THROW(
+      VideoDecoder::DecoderOptions("mmap=1,io_uring=1"), std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::DecoderOptions("frame_cache_bytes=-1"), std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::DecoderOptions("not_an_option=1"), std::runtime_error);
+}
+
+TEST(VideoStreamDecoderOptionsTest, ConvertsFromStringToStreamOptions) {
+  VideoDecoder::VideoStreamDecoderOptions options(
+      "key_frames_only=1,seek_accuracy=frames:3,decode_quality=fast");
+  EXPECT_TRUE(options.keyFramesOnly);
+  EXPECT_EQ(
+      options.seekAccuracy.mode,
+      VideoDecoder::SeekAccuracy::Mode::WITHIN_FRAMES);
+  EXPECT_EQ(options.seekAccuracy.frames, 3);
+  EXPECT_EQ(options.decodeQuality, VideoDecoder::DecodeQuality::FAST);
+  VideoDecoder::VideoStreamDecoderOptions floatOptions(
+      "dtype=bfloat16,mean=0.485:0.456:0.406,std=0.5");
+  EXPECT_EQ(floatOptions.dtype, torch::kBFloat16);
+  EXPECT_EQ(
+      floatOptions.normalizationMean,
+      std::vector<double>({0.485, 0.456, 0.406}));
+  EXPECT_EQ(floatOptions.normalizationStd, std::vector<double>({0.5}));
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("mean=0.5"), std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("dtype=float32,std=0:1:1"),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("dtype=float32,mean=0.1:0.2"),
+      std::runtime_error);
+  VideoDecoder::VideoStreamDecoderOptions transformOptions(
+      "crop=10:20:30:40,resize=min_side:64,hflip=1,interpolation=area");
+  EXPECT_EQ(transformOptions.crop->x, 10);
+  EXPECT_EQ(transformOptions.crop->y, 20);
+  EXPECT_EQ(transformOptions.crop->width, 30);
+  EXPECT_EQ(transformOptions.crop->height, 40);
+  EXPECT_EQ(
+      transformOptions.resizePolicy, VideoDecoder::ResizePolicy::MIN_SIDE);
+  EXPECT_EQ(transformOptions.resizeSide, 64);
+  EXPECT_TRUE(transformOptions.horizontalFlip);
+  EXPECT_EQ(
+      transformOptions.interpolation, VideoDecoder::Interpolation::AREA);
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("crop=0:0:10"),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("crop=0:0:0:10"),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("resize=max_side"),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("resize=max_side:64,width=32"),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("interpolation=lanczos"),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("decode_quality=low"),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::VideoStreamDecoderOptions("not_an_option=1"),
+      std::runtime_error);
+}
+
+TEST(AudioStreamDecoderOptionsTest, ConvertsFromStringToAudioOptions) {
+  VideoDecoder::AudioStreamDecoderOptions options(
+      "sample_rate=16000,num_channels=1,buffer_seconds=2.5");
+  EXPECT_EQ(options.sampleRate, 16000);
+  EXPECT_EQ(options.numChannels, 1);
+  EXPECT_EQ(options.bufferSeconds, 2.5);
+  EXPECT_FALSE(VideoDecoder::AudioStreamDecoderOptions("").sampleRate);
+  EXPECT_THROW(
+      VideoDecoder::AudioStreamDecoderOptions("sample_rate=0"),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::AudioStreamDecoderOptions("num_channels=-1"),
+      std::runtime_error);
+  EXPECT_THROW(
+      VideoDecoder::AudioStreamDecoderOptions("not_an_option=1"),
+      std::runtime_error);
+}
+
+TEST(VideoDecoderTest, LoadsScannedIndexFromCache) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::filesystem::path cacheDirectory =
+      std::filesystem::temp_directory_path() / "torchcodec_index_cache_test";
+  std::filesystem::remove_all(cacheDirectory);
+  std::filesystem::create_directories(cacheDirectory);
+  VideoDecoder::DecoderOptions options;
+  options.useIndexCache = true;
+  options.indexCacheDirectory = cacheDirectory.string();
+
+  std::unique_ptr<VideoDecoder> decoder =
+      VideoDecoder::createFromFilePath(path, options);
+  decoder->scanFileAndUpdateMetadataAndIndex();
+  EXPECT_FALSE(std::filesystem::is_empty(cacheDirectory));
+
+  // The second decoder loads its index from the cache file.
+  std::unique_ptr<VideoDecoder> cachedDecoder =
+      VideoDecoder::createFromFilePath(path, options);
+  cachedDecoder->scanFileAndUpdateMetadataAndIndex();
+  VideoDecoder::ContainerMetadata metadata =
+      cachedDecoder->getContainerMetadata();
+  const auto& videoStream = metadata.streams[3];
+  EXPECT_EQ(*videoStream.minPtsSecondsFromScan, 0);
+  EXPECT_EQ(*videoStream.maxPtsSecondsFromScan, 13.013);
+  EXPECT_EQ(*videoStream.numFramesFromScan, 390);
+  cachedDecoder->addVideoStreamDecoder(3);
+  auto output = cachedDecoder->getFramesAtIndexes(3, {0, 180});
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor2FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+  EXPECT_TRUE(torch::equal(output.frames[0], tensor1FromFFMPEG));
+  EXPECT_TRUE(torch::equal(output.frames[1], tensor2FromFFMPEG));
+
+  // A damaged frame count after a valid header is rejected before it is
+  // allocated. The key frame count of stream 3 follows its frame count, an
+  // optional int64 that is set to 390.
+  for (const auto& entry :
+       std::filesystem::directory_iterator(cacheDirectory)) {
+    std::ifstream cacheInput(entry.path(), std::ios::binary);
+    std::string contents(
+        (std::istreambuf_iterator<char>(cacheInput)),
+        std::istreambuf_iterator<char>());
+    cacheInput.close();
+    std::string numFramesField(9, '\0');
+    numFramesField[0] = 1;
+    int64_t numFrames = 390;
+    std::memcpy(&numFramesField[1], &numFrames, sizeof(numFrames));
+    size_t position = contents.find(numFramesField);
+    ASSERT_NE(position, std::string::npos);
+    uint64_t damagedCount = UINT64_MAX / 2;
+    contents.replace(
+        position + numFramesField.size(),
+        sizeof(damagedCount),
+        reinterpret_cast<const char*>(&damagedCount),
+        sizeof(damagedCount));
+    std::ofstream(entry.path(), std::ios::binary | std::ios::trunc)
+        << contents;
+  }
+  std::unique_ptr<VideoDecoder> recountedDecoder =
+      VideoDecoder::createFromFilePath(path, options);
+  recountedDecoder->scanFileAndUpdateMetadataAndIndex();
+  metadata = recountedDecoder->getContainerMetadata();
+  EXPECT_EQ(*metadata.streams[3].numFramesFromScan, 390);
+  EXPECT_EQ(*metadata.streams[3].indexSource, "packets");
+
+  // A corrupted cache file is ignored and the file is scanned again.
+  for (const auto& entry :
+       std::filesystem::directory_iterator(cacheDirectory)) {
+    std::ofstream(entry.path(), std::ios::binary | std::ios::trunc)
+        << "not an index";
+  }
+  std::unique_ptr<VideoDecoder> rescannedDecoder =
+      VideoDecoder::createFromFilePath(path, options);
+  rescannedDecoder->scanFileAndUpdateMetadataAndIndex();
+  metadata = rescannedDecoder->getContainerMetadata();
+  EXPECT_EQ(*metadata.streams[3].numFramesFromScan, 390);
+  std::filesystem::remove_all(cacheDirectory);
+}
+
+TEST(VideoDecoderTest, BuildsSameIndexFromContainerIndexAndPackets) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> packetDecoder =
+      VideoDecoder::createFromFilePath(path);
+  packetDecoder->scanFileAndUpdateMetadataAndIndex();
+  std::unique_ptr<VideoDecoder> containerIndexDecoder =
+      VideoDecoder::createFromFilePath(
+          path, VideoDecoder::DecoderOptions("scan_mode=container_index"));
+  containerIndexDecoder->scanFileAndUpdateMetadataAndIndex();
+  auto packetMetadata = packetDecoder->getContainerMetadata();
+  auto containerIndexMetadata = containerIndexDecoder->getContainerMetadata();
+  ASSERT_EQ(
+      packetMetadata.streams.size(), containerIndexMetadata.streams.size());
+  for (int i = 0; i < packetMetadata.streams.size(); ++i) {
+    EXPECT_EQ(
+        packetMetadata.streams[i].numFramesFromScan,
+        containerIndexMetadata.streams[i].numFramesFromScan);
+    EXPECT_EQ(
+        packetMetadata.streams[i].minPtsFromScan,
+        containerIndexMetadata.streams[i].minPtsFromScan);
+  }
+  // The container index has no packet durations, so the end of the last
+  // frame is estimated. It is exact for this constant frame rate stream.
+  EXPECT_EQ(
+      packetMetadata.streams[3].maxPtsFromScan,
+      containerIndexMetadata.streams[3].maxPtsFromScan);
+  // This H.264 stream has B-frames, so its packets are scanned.
+  EXPECT_EQ(containerIndexMetadata.streams[3].indexSource, "packets");
+  containerIndexDecoder->addVideoStreamDecoder(3);
+  auto output = containerIndexDecoder->getFramesAtIndexes(3, {180});
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+  EXPECT_TRUE(torch::equal(output.frames[0], tensor6FromFFMPEG));
+}
+
+TEST(VideoDecoderTest, BuildsIndexFromContainerIndexWithoutScanningPackets) {
+  // MPEG-4 part 2 without B-frames, in an MP4 file, which indexes every frame.
+  std::string path = remuxStream(encodeMpeg4Video(64, 48, 30), 0, "mp4");
+  std::unique_ptr<VideoDecoder> packetDecoder =
+      VideoDecoder::createFromFilePath(path);
+  packetDecoder->scanFileAndUpdateMetadataAndIndex();
+  std::unique_ptr<VideoDecoder> containerIndexDecoder =
+      VideoDecoder::createFromFilePath(
+          path, VideoDecoder::DecoderOptions("scan_mode=container_index"));
+  containerIndexDecoder->scanFileAndUpdateMetadataAndIndex();
+  auto packetMetadata = packetDecoder->getContainerMetadata();
+  auto containerIndexMetadata = containerIndexDecoder->getContainerMetadata();
+  ASSERT_EQ(containerIndexMetadata.streams.size(), 1);
+  // No stream fell back to a packet scan, so no packet was read.
+  EXPECT_EQ(containerIndexMetadata.streams[0].indexSource, "container_index");
+  EXPECT_EQ(packetMetadata.streams[0].indexSource, "packets");
+  EXPECT_EQ(*containerIndexMetadata.streams[0].numFramesFromScan, 30);
+  EXPECT_EQ(
+      packetMetadata.streams[0].minPtsFromScan,
+      containerIndexMetadata.streams[0].minPtsFromScan);
+  EXPECT_EQ(
+      packetMetadata.streams[0].maxPtsFromScan,
+      containerIndexMetadata.streams[0].maxPtsFromScan);
+
+  packetDecoder->addVideoStreamDecoder(0);
+  containerIndexDecoder->addVideoStreamDecoder(0);
+  auto expected = packetDecoder->getFramesAtIndexes(0, {0, 13, 29});
+  auto output = containerIndexDecoder->getFramesAtIndexes(0, {0, 13, 29});
+  EXPECT_TRUE(torch::equal(output.frames, expected.frames));
+}
+
+TEST(VideoDecoderTest, SeeksToKeyFrameBytePositionOnlyInMpegTs) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  std::unique_ptr<VideoDecoder> mpegTsDecoder =
+      VideoDecoder::createFromFilePath(remuxStream(path, 3, "mpegts"));
+  mpegTsDecoder->scanFileAndUpdateMetadataAndIndex();
+  mpegTsDecoder->addVideoStreamDecoder(0);
+  auto output = mpegTsDecoder->getFrameAtIndex(0, 180);
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+  output = mpegTsDecoder->getFrameAtIndex(0, 0);
+  EXPECT_TRUE(torch::equal(output.frame, tensor1FromFFMPEG));
+  EXPECT_GT(mpegTsDecoder->getDecodeStats().numByteSeeks, 0);
+
+  // MP4 demuxers read packets from their sample tables, so they always seek
+  // by timestamp.
+  std::unique_ptr<VideoDecoder> mp4Decoder =
+      VideoDecoder::createFromFilePath(path);
+  mp4Decoder->scanFileAndUpdateMetadataAndIndex();
+  mp4Decoder->addVideoStreamDecoder(3);
+  output = mp4Decoder->getFrameAtIndex(3, 180);
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+  EXPECT_EQ(mp4Decoder->getDecodeStats().numByteSeeks, 0);
+}
+
+TEST(VideoDecoderTest, ServesRepeatedFramesFromFrameCache) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  // Room for exactly two 480x270 RGB frames.
+  constexpr int64_t kFrameBytes = 480 * 270 * 3;
+  VideoDecoder::DecoderOptions options;
+  options.frameCacheCapacityBytes = 2 * kFrameBytes;
+  std::unique_ptr<VideoDecoder> decoder =
+      VideoDecoder::createFromFilePath(path, options);
+  decoder->scanFileAndUpdateMetadataAndIndex();
+  decoder->addVideoStreamDecoder(3);
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  auto output = decoder->getFrameAtIndex(3, 180);
+  EXPECT_EQ(decoder->getDecodeStats().numFrameCacheMisses, 1);
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+  output = decoder->getFrameAtIndex(3, 180);
+  EXPECT_EQ(decoder->getDecodeStats().numFrameCacheHits, 1);
+  EXPECT_EQ(decoder->getDecodeStats().numPacketsRead, 0);
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+  // Writing to a returned frame doesn't change the cached one.
+  output.frame.zero_();
+  output = decoder->getFrameDisplayedAtTimestamp(6.02);
+  EXPECT_EQ(decoder->getDecodeStats().numFrameCacheHits, 1);
+  EXPECT_EQ(output.ptsSeconds, 6.006);
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+  // After a hit, the cursor is on the next frame.
+  output = decoder->getNextDecodedOutput();
+  EXPECT_EQ(decoder->getDecodeStats().numFrameCacheMisses, 1);
+  EXPECT_EQ(output.pts, 181 * 1001);
+
+  // Decoding the next frame doesn't look it up in the cache. Frames 181 and
+  // 182 evict frame 180.
+  decoder->getNextDecodedOutput();
+  EXPECT_EQ(decoder->getDecodeStats().numFrameCacheMisses, 0);
+  decoder->getFrameAtIndex(3, 180);
+  EXPECT_EQ(decoder->getDecodeStats().numFrameCacheMisses, 1);
+
+  // The frames of a batch aren't cached.
+  decoder->getFramesAtIndexes(3, {90});
+  decoder->getFrameAtIndex(3, 90);
+  EXPECT_EQ(decoder->getDecodeStats().numFrameCacheMisses, 1);
+  decoder->getFrameAtIndex(3, 90);
+  EXPECT_EQ(decoder->getDecodeStats().numFrameCacheHits, 1);
+}
+
+TEST(VideoDecoderTest, SwsScaleMatchesFilterGraph) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  for (std::string sizeOptions : {"", ",width=100,height=120"}) {
+    for (std::string shape : {"NHWC", "NCHW"}) {
+      std::unique_ptr<VideoDecoder> filterGraphDecoder =
+          VideoDecoder::createFromFilePath(path);
+      filterGraphDecoder->addVideoStreamDecoder(
+          3,
+          VideoDecoder::VideoStreamDecoderOptions(
+              "color_conversion_library=filtergraph,shape=" + shape +
+              sizeOptions));
+      std::unique_ptr<VideoDecoder> swsScaleDecoder =
+          VideoDecoder::createFromFilePath(path);
+      swsScaleDecoder->addVideoStreamDecoder(
+          3,
+          VideoDecoder::VideoStreamDecoderOptions(
+              "color_conversion_library=swscale,shape=" + shape +
+              sizeOptions));
+      for (int i = 0; i < 3; ++i) {
+        torch::Tensor expected =
+            filterGraphDecoder->getNextDecodedOutput().frame;
+        torch::Tensor tensor = swsScaleDecoder->getNextDecodedOutput().frame;
+        EXPECT_EQ(tensor.sizes(), expected.sizes());
+        EXPECT_TRUE(torch::allclose(tensor, expected, 0.1, 20));
+      }
+    }
+  }
+}
+
+TEST(VideoDecoderTest, NormalizesFramesIntoFloatingPointDtypes) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::vector<double> mean = {0.485, 0.456, 0.406};
+  std::vector<double> std = {0.229, 0.224, 0.225};
+  // The odd width leaves values past the last whole vector in every row.
+  for (std::string transform : {"", ",width=201,height=101,hflip=1"}) {
+    for (std::string library : {"filtergraph", "swscale"}) {
+      for (std::string shape : {"NHWC", "NCHW"}) {
+        std::string baseOptions = "color_conversion_library=" + library +
+            ",shape=" + shape + transform;
+        std::unique_ptr<VideoDecoder> uint8Decoder =
+            VideoDecoder::createFromFilePath(path);
+        uint8Decoder->addVideoStreamDecoder(
+            3, VideoDecoder::VideoStreamDecoderOptions(baseOptions));
+        std::vector<int64_t> channelShape =
+            shape == "NHWC" ? std::vector<int64_t>{1, 1, 3}
+                            : std::vector<int64_t>{3, 1, 1};
+        torch::Tensor uint8Frame = uint8Decoder->getNextDecodedOutput().frame;
+        torch::Tensor expected = (uint8Frame.to(torch::kFloat) / 255 -
+                                  torch::tensor(mean).view(channelShape)) /
+            torch::tensor(std).view(channelShape);
+        for (std::string dtype : {"float32", "float16", "bfloat16"}) {
+          std::unique_ptr<VideoDecoder> decoder =
+              VideoDecoder::createFromFilePath(path);
+          decoder->addVideoStreamDecoder(
+              3,
+              VideoDecoder::VideoStreamDecoderOptions(
+                  baseOptions + ",dtype=" + dtype +
+                  ",mean=0.485:0.456:0.406,std=0.229:0.224:0.225"));
+          torch::Tensor frame = decoder->getNextDecodedOutput().frame;
+          EXPECT_EQ(frame.sizes(), expected.sizes());
+          EXPECT_NE(frame.scalar_type(), torch::kUInt8);
+          // bfloat16 keeps 8 bits of mantissa, i.e. ~0.02 for values up to
+          // 2.6.
+          EXPECT_TRUE(
+              torch::allclose(frame.to(torch::kFloat), expected, 0, 0.03));
+          auto batch = decoder->getFramesAtIndexes(3, {0});
+          EXPECT_EQ(batch.frames.scalar_type(), frame.scalar_type());
+          EXPECT_TRUE(torch::equal(batch.frames[0], frame));
+        }
+      }
+    }
+  }
+}
+
+TEST(VideoDecoderTest, DecodesFramesIntoYUVAndGrayOutputFormats) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  for (std::string sizeOptions : {"", ",width=240,height=136"}) {
+    int64_t height = sizeOptions.empty() ? 270 : 136;
+    int64_t width = sizeOptions.empty() ? 480 : 240;
+    for (std::string library : {"filtergraph", "swscale"}) {
+      std::map<std::string, torch::Tensor> frames;
+      for (std::string format : {"gray", "yuv420p", "nv12"}) {
+        std::unique_ptr<VideoDecoder> decoder =
+            VideoDecoder::createFromFilePath(path);
+        decoder->addVideoStreamDecoder(
+            3,
+            VideoDecoder::VideoStreamDecoderOptions(
+                "color_conversion_library=" + library +
+                ",output_format=" + format + sizeOptions));
+        frames[format] = decoder->getFrameAtIndex(3, 180).frame;
+        auto batch = decoder->getFramesAtIndexes(3, {180});
+        EXPECT_TRUE(torch::equal(batch.frames[0], frames[format]));
+      }
+      std::vector<long> yuvShape = {height * 3 / 2, width};
+      EXPECT_EQ(frames["gray"].sizes(), std::vector<long>({height, width, 1}));
+      EXPECT_EQ(frames["yuv420p"].sizes(), yuvShape);
+      EXPECT_EQ(frames["nv12"].sizes(), yuvShape);
+      // The planes are packed one after the other.
+      torch::Tensor yPlane = frames["yuv420p"].narrow(0, 0, height);
+      torch::Tensor uPlane = frames["yuv420p"]
+                                 .flatten()
+                                 .narrow(0, height * width, height * width / 4)
+                                 .view({height / 2, width / 2});
+      torch::Tensor uvPlane = frames["nv12"]
+                                  .narrow(0, height, height / 2)
+                                  .view({height / 2, width / 2, 2});
+      EXPECT_TRUE(torch::equal(yPlane, frames["gray"].select(2, 0)));
+      EXPECT_TRUE(torch::equal(frames["nv12"].narrow(0, 0, height), yPlane));
+      EXPECT_TRUE(torch::allclose(
+          uvPlane.select(2, 0).to(torch::kInt), uPlane.to(torch::kInt), 0, 1));
+    }
+  }
+}
+
+TEST(VideoDecoderTest, CropsResizesAndFlipsFrames) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  // Compares the pixels away from the edges, where the chroma upsampling of
+  // a cropped frame can't see the pixels outside the crop region.
+  auto expectInteriorsClose = [](torch::Tensor a, torch::Tensor b) {
+    ASSERT_EQ(a.sizes(), b.sizes());
+    a = a.narrow(0, 2, a.size(0) - 4).narrow(1, 2, a.size(1) - 4);
+    b = b.narrow(0, 2, b.size(0) - 4).narrow(1, 2, b.size(1) - 4);
+    EXPECT_TRUE(torch::allclose(a.to(torch::kInt), b.to(torch::kInt), 0, 2));
+  };
+  for (std::string library : {"filtergraph", "swscale"}) {
+    std::string libraryOption = "color_conversion_library=" + library;
+    std::unique_ptr<VideoDecoder> decoder =
+        VideoDecoder::createFromFilePath(path);
+    decoder->addVideoStreamDecoder(
+        3, VideoDecoder::VideoStreamDecoderOptions(libraryOption));
+    torch::Tensor fullFrame = decoder->getFrameAtIndex(3, 180).frame;
+    EXPECT_EQ(fullFrame.sizes(), std::vector<long>({270, 480, 3}));
+
+    std::unique_ptr<VideoDecoder> croppingDecoder =
+        VideoDecoder::createFromFilePath(path);
+    croppingDecoder->addVideoStreamDecoder(
+        3,
+        VideoDecoder::VideoStreamDecoderOptions(
+            libraryOption + ",crop=40:20:200:100,hflip=1"));
+    torch::Tensor croppedFrame = croppingDecoder->getFrameAtIndex(3, 180).frame;
+    torch::Tensor expectedFrame =
+        fullFrame.narrow(0, 20, 100).narrow(1, 40, 200).flip({1});
+    expectInteriorsClose(croppedFrame, expectedFrame);
+    auto batch = croppingDecoder->getFramesAtIndexes(3, {180});
+    EXPECT_TRUE(torch::equal(batch.frames[0], croppedFrame));
+
+    // The shorter side of the 480x270 frames is the height.
+    croppingDecoder->setVideoStreamTransform(3, "resize=min_side:135");
+    EXPECT_EQ(
+        croppingDecoder->getFrameAtIndex(3, 180).frame.sizes(),
+        std::vector<long>({135, 240, 3}));
+    croppingDecoder->setVideoStreamTransform(3, "resize=max_side:240");
+    batch = croppingDecoder->getFramesAtIndexes(3, {0, 180});
+    EXPECT_EQ(batch.frames.sizes(), std::vector<long>({2, 135, 240, 3}));
+    croppingDecoder->setVideoStreamTransform(3, "");
+    EXPECT_TRUE(torch::equal(
+        croppingDecoder->getFrameAtIndex(3, 180).frame, fullFrame));
+    EXPECT_THROW(
+        croppingDecoder->setVideoStreamTransform(3, "dtype=float32"),
+        std::runtime_error);
+  }
+}
+
+TEST(VideoDecoderTest, RejectsTransformsThatDontFitTheStream) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> decoder =
+      VideoDecoder::createFromFilePath(path);
+  decoder->addAudioStreamDecoder(0);
+  EXPECT_THROW(
+      decoder->setVideoStreamTransform(0, "hflip=1"), std::runtime_error);
+
+  // At half the resolution, MPEG-4 part 2 frames are decoded as 240x136.
+  std::unique_ptr<VideoDecoder> lowresDecoder =
+      VideoDecoder::createFromFilePath(encodeMpeg4Video(480, 272, 5));
+  lowresDecoder->scanFileAndUpdateMetadataAndIndex();
+  lowresDecoder->addVideoStreamDecoder(
+      0,
+      VideoDecoder::VideoStreamDecoderOptions(
+          "width=120,height=100,decode_quality=fast"));
+  for (std::string transform :
+       {"", "hflip=1", "resize=min_side:100", "width=480,height=272"}) {
+    EXPECT_THROW(
+        lowresDecoder->setVideoStreamTransform(0, transform),
+        std::invalid_argument);
+  }
+  lowresDecoder->setVideoStreamTransform(0, "width=200,height=100,hflip=1");
+  auto batch = lowresDecoder->getFramesAtIndexes(0, {0, 4});
+  EXPECT_EQ(batch.frames.sizes(), std::vector<long>({2, 100, 200, 3}));
+  EXPECT_EQ(
+      lowresDecoder->getFrameAtIndex(0, 2).frame.sizes(),
+      std::vector<long>({100, 200, 3}));
+}
+
 TEST(VideoDecoderTest, RespectsWidthAndHeightFromOptions) {
   std::string path = getResourcePath(
       "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
@@ -255,6 +892,505 @@ TEST_P(VideoDecoderTest, DecodesFramesInABatchInNCHW) {
   EXPECT_TRUE(torch::equal(tensor[1], tensor2FromFFMPEG));
 }
 
+TEST_P(VideoDecoderTest, DecodesUnsortedAndDuplicateFramesInABatch) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder =
+      createDecoderFromPath(path, GetParam());
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  int bestVideoStreamIndex =
+      *ourDecoder->getContainerMetadata().bestVideoStreamIndex;
+  ourDecoder->addVideoStreamDecoder(bestVideoStreamIndex);
+  auto output =
+      ourDecoder->getFramesAtIndexes(bestVideoStreamIndex, {180, 0, 180, 1});
+  auto tensor = output.frames;
+  EXPECT_EQ(tensor.sizes(), std::vector<long>({4, 270, 480, 3}));
+
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor2FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000002.bmp"));
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  EXPECT_TRUE(torch::equal(tensor[0], tensor6FromFFMPEG));
+  EXPECT_TRUE(torch::equal(tensor[1], tensor1FromFFMPEG));
+  EXPECT_TRUE(torch::equal(tensor[2], tensor6FromFFMPEG));
+  EXPECT_TRUE(torch::equal(tensor[3], tensor2FromFFMPEG));
+}
+
+TEST_P(VideoDecoderTest, DecodesFramesInABatchInParallel) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::vector<int64_t> frameIndexes = {0, 389, 180, 1, 100, 250, 180, 30};
+  std::unique_ptr<VideoDecoder> serialDecoder =
+      VideoDecoder::createFromFilePath(path);
+  serialDecoder->scanFileAndUpdateMetadataAndIndex();
+  serialDecoder->addVideoStreamDecoder(3);
+  auto expectedFrames = serialDecoder->getFramesAtIndexes(3, frameIndexes);
+
+  std::unique_ptr<VideoDecoder> parallelDecoder = createDecoderFromPath(
+      path,
+      GetParam(),
+      VideoDecoder::DecoderOptions("batch_decode_threads=4"));
+  parallelDecoder->scanFileAndUpdateMetadataAndIndex();
+  parallelDecoder->addVideoStreamDecoder(3);
+  // The second call reuses the worker decoders of the first one.
+  for (int i = 0; i < 2; ++i) {
+    auto output = parallelDecoder->getFramesAtIndexes(3, frameIndexes);
+    EXPECT_TRUE(torch::equal(output.frames, expectedFrames.frames));
+  }
+}
+
+TEST_P(VideoDecoderTest, DecodesFramesInRange) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder =
+      createDecoderFromPath(path, GetParam());
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  ourDecoder->addVideoStreamDecoder(3);
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor2FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000002.bmp"));
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  auto output = ourDecoder->getFramesInRange(3, 0, 2);
+  EXPECT_EQ(output.frames.sizes(), std::vector<long>({2, 270, 480, 3}));
+  EXPECT_TRUE(torch::equal(output.frames[0], tensor1FromFFMPEG));
+  EXPECT_TRUE(torch::equal(output.frames[1], tensor2FromFFMPEG));
+
+  output = ourDecoder->getFramesInRange(3, 0, 181, 90);
+  EXPECT_EQ(output.frames.sizes(), std::vector<long>({3, 270, 480, 3}));
+  EXPECT_TRUE(torch::equal(output.frames[0], tensor1FromFFMPEG));
+  EXPECT_TRUE(torch::equal(output.frames[2], tensor6FromFFMPEG));
+
+  // Frame 300 depends on the key frame at 8 seconds, so we seek there instead
+  // of decoding the 299 frames after frame 0.
+  output = ourDecoder->getFramesInRange(3, 0, 301, 300);
+  EXPECT_LT(ourDecoder->getDecodeStats().numFramesDiscarded, 299);
+  EXPECT_EQ(ourDecoder->getDecodeStats().numSeeksSkipped, 0);
+  EXPECT_TRUE(torch::equal(
+      output.frames[1], ourDecoder->getFrameAtIndex(3, 300).frame));
+
+  EXPECT_THROW(ourDecoder->getFramesInRange(3, 0, 391), std::exception);
+  EXPECT_THROW(ourDecoder->getFramesInRange(3, 0, 10, 0), std::exception);
+}
+
+TEST_P(VideoDecoderTest, DecodesKeyFramesOnly) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder =
+      createDecoderFromPath(path, GetParam());
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  ourDecoder->addVideoStreamDecoder(
+      3, VideoDecoder::VideoStreamDecoderOptions("key_frames_only=1"));
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+
+  auto keyFrames = ourDecoder->getKeyFrames(3);
+  int64_t numKeyFrames = keyFrames.frames.sizes()[0];
+  EXPECT_GT(numKeyFrames, 1);
+  EXPECT_TRUE(torch::equal(keyFrames.frames[0], tensor1FromFFMPEG));
+
+  auto everyOtherKeyFrame = ourDecoder->getKeyFrames(3, 2);
+  EXPECT_EQ(everyOtherKeyFrame.frames.sizes()[0], (numKeyFrames + 1) / 2);
+  if (numKeyFrames > 2) {
+    EXPECT_TRUE(
+        torch::equal(everyOtherKeyFrame.frames[1], keyFrames.frames[2]));
+  }
+
+  // Sequential decoding skips straight from one key frame to the next.
+  ourDecoder->setCursorPtsInSeconds(0);
+  auto output = ourDecoder->getNextDecodedOutput();
+  EXPECT_TRUE(torch::equal(output.frame, keyFrames.frames[0]));
+  output = ourDecoder->getNextDecodedOutput();
+  EXPECT_TRUE(torch::equal(output.frame, keyFrames.frames[1]));
+
+  // Frames can be requested by index only if they are key frames, since the
+  // others are never decoded.
+  output = ourDecoder->getFrameAtIndex(3, 0);
+  EXPECT_TRUE(torch::equal(output.frame, keyFrames.frames[0]));
+  EXPECT_THROW(ourDecoder->getFrameAtIndex(3, 1), std::runtime_error);
+  EXPECT_THROW(ourDecoder->getFramesAtIndexes(3, {0, 1}), std::runtime_error);
+  EXPECT_THROW(ourDecoder->getFramesInRange(3, 0, 2), std::runtime_error);
+
+  EXPECT_THROW(ourDecoder->getKeyFrames(3, 0), std::exception);
+}
+
+TEST(VideoDecoderTest, DecodesMultipleVideosConcurrently) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::ifstream input(path, std::ios::binary);
+  std::string content(
+      (std::istreambuf_iterator<char>(input)),
+      std::istreambuf_iterator<char>());
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  std::vector<VideoDecoder::VideoDecodeRequest> requests(3);
+  requests[0].videoFilePath = path;
+  requests[0].frameIndexes = {180, 0};
+  requests[1].buffer = content.data();
+  requests[1].length = content.size();
+  requests[1].frameIndexes = {0};
+  requests[2].videoFilePath = path;
+  requests[2].timestamps = {6.02, 0.0, 6.02};
+  std::vector<torch::Tensor> outputs = VideoDecoder::decodeVideos(
+      requests,
+      VideoDecoder::DecoderOptions(),
+      VideoDecoder::VideoStreamDecoderOptions(),
+      /*numThreads=*/2);
+  ASSERT_EQ(outputs.size(), 3);
+  EXPECT_EQ(outputs[0].sizes(), std::vector<long>({2, 270, 480, 3}));
+  EXPECT_TRUE(torch::equal(outputs[0][0], tensor6FromFFMPEG));
+  EXPECT_TRUE(torch::equal(outputs[0][1], tensor1FromFFMPEG));
+  EXPECT_TRUE(torch::equal(outputs[1][0], tensor1FromFFMPEG));
+  EXPECT_EQ(outputs[2].sizes(), std::vector<long>({3, 270, 480, 3}));
+  EXPECT_TRUE(torch::equal(outputs[2][0], tensor6FromFFMPEG));
+  EXPECT_TRUE(torch::equal(outputs[2][1], tensor1FromFFMPEG));
+  EXPECT_TRUE(torch::equal(outputs[2][2], tensor6FromFFMPEG));
+
+  requests[1].frameIndexes = {390};
+  EXPECT_THROW(
+      VideoDecoder::decodeVideos(
+          requests,
+          VideoDecoder::DecoderOptions(),
+          VideoDecoder::VideoStreamDecoderOptions(),
+          /*numThreads=*/2),
+      std::exception);
+}
+
+TEST_P(VideoDecoderTest, ReopensWithCompatibleStreams) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder =
+      createDecoderFromPath(path, GetParam());
+  ourDecoder->addVideoStreamDecoder(3);
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+  ourDecoder->setCursorPtsInSeconds(6.006);
+  auto output = ourDecoder->getNextDecodedOutput();
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+
+  for (int i = 0; i < 2; ++i) {
+    bool reusedAllStreams = GetParam()
+        ? ourDecoder->reopenFromBuffer(content_.data(), content_.size())
+        : ourDecoder->reopenFromFilePath(path);
+    EXPECT_TRUE(reusedAllStreams);
+    // The decoder starts over at the beginning of the new video.
+    output = ourDecoder->getNextDecodedOutput();
+    EXPECT_EQ(output.streamIndex, 3);
+    EXPECT_TRUE(torch::equal(output.frame, tensor1FromFFMPEG));
+  }
+  EXPECT_EQ(ourDecoder->getContainerMetadata().streams[3].width, 480);
+
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  output = ourDecoder->getFrameAtIndex(3, 180);
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+}
+
+TEST(VideoDecoderTest, ReopensOnlyWhenTheNewVideoCanReplaceEveryStream) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder =
+      VideoDecoder::createFromFilePath(path);
+  ourDecoder->addVideoStreamDecoder(3);
+  ourDecoder->addAudioStreamDecoder(-1);
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  // Neither a missing file nor a video without audio can replace the
+  // streams, and the decoder keeps decoding the old video.
+  EXPECT_THROW(
+      ourDecoder->reopenFromFilePath("/this/file/does/not/exist"),
+      std::invalid_argument);
+  std::string mpeg4Path = encodeMpeg4Video(64, 48, 5);
+  EXPECT_THROW(
+      ourDecoder->reopenFromFilePath(mpeg4Path), std::invalid_argument);
+  ourDecoder->setCursorPtsInSeconds(6.006);
+  auto output = ourDecoder->getNextDecodedOutput();
+  EXPECT_EQ(output.streamIndex, 3);
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+
+  // The new video has no stream 3, so its best video stream replaces it.
+  std::unique_ptr<VideoDecoder> videoOnlyDecoder =
+      VideoDecoder::createFromFilePath(path);
+  videoOnlyDecoder->addVideoStreamDecoder(3);
+  EXPECT_FALSE(videoOnlyDecoder->reopenFromFilePath(mpeg4Path));
+  output = videoOnlyDecoder->getNextDecodedOutput();
+  EXPECT_EQ(output.streamIndex, 0);
+  EXPECT_EQ(output.frame.sizes(), std::vector<long>({48, 64, 3}));
+}
+
+TEST_P(VideoDecoderTest, ClonesDecodeInParallel) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> decoder =
+      createDecoderFromPath(path, GetParam());
+  decoder->scanFileAndUpdateMetadataAndIndex();
+  decoder->addVideoStreamDecoder(
+      3, VideoDecoder::VideoStreamDecoderOptions("width=240,height=135"));
+  torch::Tensor tensor1 = decoder->getFrameAtIndex(3, 1).frame;
+  torch::Tensor tensor180 = decoder->getFrameAtIndex(3, 180).frame;
+
+  std::unique_ptr<VideoDecoder> clone = decoder->clone();
+  EXPECT_EQ(
+      clone->getContainerMetadata().streams[3].numFramesFromScan,
+      decoder->getContainerMetadata().streams[3].numFramesFromScan);
+  // Each clone has its own cursor, so they can decode different parts of the
+  // video at the same time.
+  torch::Tensor cloneTensor1;
+  torch::Tensor cloneTensor180;
+  std::thread thread(
+      [&]() { cloneTensor180 = clone->getFrameAtIndex(3, 180).frame; });
+  cloneTensor1 = decoder->clone()->getFrameAtIndex(3, 1).frame;
+  thread.join();
+  EXPECT_TRUE(torch::equal(cloneTensor1, tensor1));
+  EXPECT_TRUE(torch::equal(cloneTensor180, tensor180));
+}
+
+TEST(VideoDecoderTest, ClonesShareMemoryMappedAndAsyncInputs) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+  for (std::string options : {"mmap=1", "io_uring=1"}) {
+    std::unique_ptr<VideoDecoder> decoder = VideoDecoder::createFromFilePath(
+        path, VideoDecoder::DecoderOptions(options));
+    decoder->scanFileAndUpdateMetadataAndIndex();
+    decoder->addVideoStreamDecoder(3);
+    std::unique_ptr<VideoDecoder> clone = decoder->clone();
+    EXPECT_TRUE(
+        torch::equal(clone->getFrameAtIndex(3, 180).frame, tensor6FromFFMPEG));
+    // The clone outlives the decoder it was cloned from.
+    decoder.reset();
+    EXPECT_EQ(clone->getFramesAtIndexes(3, {0, 180}).frames.size(0), 2);
+  }
+}
+
+TEST_P(VideoDecoderTest, ResumesPacketReadAheadAfterIdling) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> decoder =
+      createDecoderFromPath(path, GetParam());
+  decoder->addVideoStreamDecoder(-1);
+  std::unique_ptr<VideoDecoder> readAheadDecoder = createDecoderFromPath(
+      path, GetParam(), VideoDecoder::DecoderOptions("read_ahead_packets=2"));
+  readAheadDecoder->addVideoStreamDecoder(-1);
+  for (int i = 0; i < 30; ++i) {
+    if (i % 10 == 0) {
+      // The reading thread fills the ring and parks until a packet is taken.
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    EXPECT_TRUE(torch::equal(
+        readAheadDecoder->getNextDecodedOutput().frame,
+        decoder->getNextDecodedOutput().frame));
+  }
+  // Destroying the decoder wakes up and stops the parked reading thread.
+  readAheadDecoder.reset();
+}
+
+TEST_P(VideoDecoderTest, DecodesFramesWithPacketReadAhead) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder = createDecoderFromPath(
+      path, GetParam(), VideoDecoder::DecoderOptions("read_ahead_packets=8"));
+  ourDecoder->addVideoStreamDecoder(-1);
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor2FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000002.bmp"));
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  auto output = ourDecoder->getNextDecodedOutput();
+  EXPECT_TRUE(torch::equal(output.frame, tensor1FromFFMPEG));
+  EXPECT_GT(ourDecoder->getDecodeStats().maxReadAheadQueueDepth, 0);
+  EXPECT_GT(ourDecoder->getDecodeStats().maxReadAheadBytesBuffered, 0);
+  output = ourDecoder->getNextDecodedOutput();
+  EXPECT_TRUE(torch::equal(output.frame, tensor2FromFFMPEG));
+
+  // Seeking drops the packets that were read ahead of the old position.
+  ourDecoder->setCursorPtsInSeconds(6.006);
+  output = ourDecoder->getNextDecodedOutput();
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+  ourDecoder->setCursorPtsInSeconds(0);
+  output = ourDecoder->getNextDecodedOutput();
+  EXPECT_TRUE(torch::equal(output.frame, tensor1FromFFMPEG));
+
+  // The read-ahead thread stops at the end of the file.
+  ourDecoder->setCursorPtsInSeconds(388'388. / 30'000);
+  output = ourDecoder->getNextDecodedOutput();
+  EXPECT_EQ(output.ptsSeconds, 388'388. / 30'000);
+  output = ourDecoder->getNextDecodedOutput();
+  EXPECT_EQ(output.ptsSeconds, 389'389. / 30'000);
+  EXPECT_THROW(ourDecoder->getNextDecodedOutput(), std::exception);
+}
+
+TEST(VideoDecoderTest, DecodesFramesFromMemoryMappedFile) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder = VideoDecoder::createFromFilePath(
+      path, VideoDecoder::DecoderOptions("mmap=1"));
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  ourDecoder->addVideoStreamDecoder(3);
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  auto output = ourDecoder->getNextDecodedOutput();
+  EXPECT_TRUE(torch::equal(output.frame, tensor1FromFFMPEG));
+  auto batch = ourDecoder->getFramesAtIndexes(3, {180, 0});
+  EXPECT_TRUE(torch::equal(batch.frames[0], tensor6FromFFMPEG));
+  EXPECT_TRUE(torch::equal(batch.frames[1], tensor1FromFFMPEG));
+
+  // The new mapping replaces the old one once the old input is closed.
+  EXPECT_TRUE(ourDecoder->reopenFromFilePath(path));
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  output = ourDecoder->getFrameAtIndex(3, 180);
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+
+  EXPECT_THROW(
+      VideoDecoder::createFromFilePath(
+          path + ".does_not_exist", VideoDecoder::DecoderOptions("mmap=1")),
+      std::invalid_argument);
+}
+
+TEST(VideoDecoderTest, DecodesFramesWithAsyncFileReader) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder = VideoDecoder::createFromFilePath(
+      path, VideoDecoder::DecoderOptions("io_uring=1"));
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  ourDecoder->addVideoStreamDecoder(3);
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  auto batch = ourDecoder->getFramesAtIndexes(3, {180, 0, 180});
+  EXPECT_TRUE(torch::equal(batch.frames[0], tensor6FromFFMPEG));
+  EXPECT_TRUE(torch::equal(batch.frames[1], tensor1FromFFMPEG));
+  EXPECT_TRUE(torch::equal(batch.frames[2], tensor6FromFFMPEG));
+
+  std::optional<AsyncFileReader::Stats> stats = ourDecoder->getAsyncReadStats();
+  ASSERT_TRUE(stats.has_value());
+  EXPECT_GT(stats->bytesRead, 0);
+  EXPECT_GT(stats->numBlockHits + stats->numBlockWaits, 0);
+  if (stats->usesIoUring) {
+    EXPECT_GT(stats->numSubmitCalls, 0);
+    // Prefetches submit several reads per call.
+    EXPECT_GE(stats->numReadsSubmitted, stats->numSubmitCalls);
+    EXPECT_LE(stats->numReadsCompleted, stats->numReadsSubmitted);
+  }
+  EXPECT_FALSE(VideoDecoder::createFromFilePath(path)
+                   ->getAsyncReadStats()
+                   .has_value());
+}
+
+TEST(VideoDecoderTest, ReadsFileConcurrentlyWithAsyncFileReader) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::ifstream input(path, std::ios::binary);
+  std::string content(
+      (std::istreambuf_iterator<char>(input)),
+      std::istreambuf_iterator<char>());
+  // Small blocks and a small cache make the threads wait for, and evict, each
+  // other's blocks.
+  AsyncFileReader reader(path, /*blockSize=*/4096, /*maxNumBlocks=*/4);
+  ASSERT_EQ(reader.size(), static_cast<int64_t>(content.size()));
+
+  std::vector<int> numMismatches(8, 0);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < numMismatches.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      std::vector<uint8_t> buffer(3000);
+      int64_t stride = 7919 * static_cast<int64_t>(i + 1);
+      for (int j = 0; j < 200; ++j) {
+        int64_t offset = (j * stride) % reader.size();
+        int64_t numBytes = reader.read(offset, buffer.data(), buffer.size());
+        if (numBytes <= 0 ||
+            std::memcmp(buffer.data(), content.data() + offset, numBytes) !=
+                0) {
+          numMismatches[i]++;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int numThreadMismatches : numMismatches) {
+    EXPECT_EQ(numThreadMismatches, 0);
+  }
+}
+
+TEST_P(VideoDecoderTest, DecodesFramesWithReducedQuality) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> fullQualityDecoder =
+      createDecoderFromPath(path, GetParam());
+  fullQualityDecoder->addVideoStreamDecoder(
+      -1, VideoDecoder::VideoStreamDecoderOptions("width=240,height=135"));
+  torch::Tensor fullQualityFrame =
+      fullQualityDecoder->getNextDecodedOutput().frame.to(torch::kFloat);
+  for (std::string quality : {"fast", "fastest"}) {
+    std::unique_ptr<VideoDecoder> ourDecoder =
+        createDecoderFromPath(path, GetParam());
+    ourDecoder->addVideoStreamDecoder(
+        -1,
+        VideoDecoder::VideoStreamDecoderOptions(
+            "width=240,height=135,decode_quality=" + quality));
+    auto metadata = ourDecoder->getContainerMetadata();
+    EXPECT_EQ(metadata.streams[3].width, 480);
+    EXPECT_EQ(metadata.streams[3].height, 270);
+    torch::Tensor frame = ourDecoder->getNextDecodedOutput().frame;
+    EXPECT_EQ(frame.sizes(), std::vector<long>({135, 240, 3}));
+    // The first frame is a key frame, so at most its loop filter is skipped.
+    torch::Tensor error = (frame.to(torch::kFloat) - fullQualityFrame).abs();
+    EXPECT_LT(error.mean().item<double>(), 10);
+  }
+}
+
+TEST_P(VideoDecoderTest, DecodesFramesIntoPreAllocatedOutputTensor) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder =
+      createDecoderFromPath(path, GetParam());
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  ourDecoder->addVideoStreamDecoder(3);
+  torch::Tensor tensor1FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.frame000001.bmp"));
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  torch::Tensor frames = torch::empty({3, 270, 480, 3}, {torch::kUInt8});
+  // The same buffer is reused by the second call.
+  for (int i = 0; i < 2; ++i) {
+    auto output = ourDecoder->getFramesAtIndexes(3, {180, 0, 180}, frames);
+    EXPECT_EQ(output.frames.data_ptr(), frames.data_ptr());
+    EXPECT_TRUE(torch::equal(frames[0], tensor6FromFFMPEG));
+    EXPECT_TRUE(torch::equal(frames[1], tensor1FromFFMPEG));
+    EXPECT_TRUE(torch::equal(frames[2], tensor6FromFFMPEG));
+  }
+
+  torch::Tensor frame = torch::empty({270, 480, 3}, {torch::kUInt8});
+  auto output = ourDecoder->getFrameAtIndex(3, 0, frame);
+  EXPECT_EQ(output.frame.data_ptr(), frame.data_ptr());
+  EXPECT_TRUE(torch::equal(frame, tensor1FromFFMPEG));
+
+  torch::Tensor wrongShape = torch::empty({2, 270, 480, 3}, {torch::kUInt8});
+  EXPECT_THROW(
+      ourDecoder->getFramesAtIndexes(3, {0, 1, 2}, wrongShape), std::exception);
+}
+
 TEST_P(VideoDecoderTest, SeeksCloseToEof) {
   std::string path = getResourcePath(
       "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
@@ -301,6 +1437,82 @@ TEST_P(VideoDecoderTest, GetsFrameDisplayedAtTimestamp) {
   EXPECT_EQ(output.ptsSeconds, kPtsOfLastFrameInVideoStream);
 }
 
+TEST_P(VideoDecoderTest, GetsFrameDisplayedAtTimestampFromScannedIndex) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  for (std::string scanMode : {"packets", "container_index"}) {
+    std::unique_ptr<VideoDecoder> ourDecoder = createDecoderFromPath(
+        path,
+        GetParam(),
+        VideoDecoder::DecoderOptions("scan_mode=" + scanMode));
+    ourDecoder->scanFileAndUpdateMetadataAndIndex();
+    ourDecoder->addVideoStreamDecoder(3);
+    const double kNextFramePts = 6.039366666666667;
+    auto output =
+        ourDecoder->getFrameDisplayedAtTimestamp(kNextFramePts - 1e-6);
+    EXPECT_EQ(output.ptsSeconds, 6.006);
+    torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+        "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+    EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+    output = ourDecoder->getFrameDisplayedAtTimestamp(kNextFramePts);
+    EXPECT_EQ(output.ptsSeconds, kNextFramePts);
+    // Going back to the previous frame needs a seek.
+    output = ourDecoder->getFrameDisplayedAtTimestamp(6.02);
+    EXPECT_EQ(output.ptsSeconds, 6.006);
+    EXPECT_EQ(ourDecoder->getDecodeStats().numSeeksSkipped, 0);
+
+    constexpr double kPtsOfLastFrameInVideoStream = 389'389. / 30'000;
+    constexpr double kPtsPlusDurationOfLastFrame = 390'390. / 30'000;
+    output = ourDecoder->getFrameDisplayedAtTimestamp(
+        kPtsPlusDurationOfLastFrame - 1e-6);
+    EXPECT_EQ(output.ptsSeconds, kPtsOfLastFrameInVideoStream);
+  }
+}
+
+TEST_P(VideoDecoderTest, GetsFrameDisplayedAtTimestampWithSeekAccuracy) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder =
+      createDecoderFromPath(path, GetParam());
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  ourDecoder->addVideoStreamDecoder(3);
+  torch::Tensor tensor6FromFFMPEG = readTensorFromBMP(getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.time6.000000.bmp"));
+
+  auto output = ourDecoder->getFrameDisplayedAtTimestamp(
+      6.02, VideoDecoder::SeekAccuracy("frames:0"));
+  EXPECT_EQ(output.ptsSeconds, 6.006);
+  EXPECT_TRUE(torch::equal(output.frame, tensor6FromFFMPEG));
+
+  auto keyFrameOutput = ourDecoder->getFrameDisplayedAtTimestamp(
+      6.02, VideoDecoder::SeekAccuracy("key_frame"));
+  auto keyFrames = ourDecoder->getKeyFrames(3);
+  bool isKeyFrame = false;
+  for (int64_t i = 0; i < keyFrames.frames.sizes()[0]; ++i) {
+    isKeyFrame |= torch::equal(keyFrameOutput.frame, keyFrames.frames[i]);
+  }
+  EXPECT_TRUE(isKeyFrame);
+
+  // With a tolerance that covers the whole video, the nearest key frame is the
+  // cheapest frame.
+  output = ourDecoder->getFrameDisplayedAtTimestamp(
+      6.02, VideoDecoder::SeekAccuracy("seconds:100"));
+  EXPECT_EQ(output.ptsSeconds, keyFrameOutput.ptsSeconds);
+
+  output = ourDecoder->getFrameDisplayedAtTimestamp(
+      6.02, VideoDecoder::SeekAccuracy("frames:2"));
+  EXPECT_LE(std::abs(output.ptsSeconds - 6.006), 2 * 1001. / 30'000 + 1e-9);
+
+  double seconds = ourDecoder->seekToTimestamp(
+      6.02, VideoDecoder::SeekAccuracy("key_frame"));
+  EXPECT_EQ(seconds, keyFrameOutput.ptsSeconds);
+  output = ourDecoder->getNextDecodedOutput();
+  EXPECT_EQ(output.ptsSeconds, keyFrameOutput.ptsSeconds);
+
+  EXPECT_THROW(VideoDecoder::SeekAccuracy("frames:-1"), std::exception);
+  EXPECT_THROW(VideoDecoder::SeekAccuracy("nearest"), std::exception);
+}
+
 TEST_P(VideoDecoderTest, SeeksToFrameWithSpecificPts) {
   std::string path = getResourcePath(
       "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
@@ -401,6 +1613,43 @@ TEST_P(VideoDecoderTest, SeeksToFrameWithSpecificPts) {
   }
 }
 
+TEST_P(VideoDecoderTest, AccumulatesDecodeStats) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> ourDecoder = createDecoderFromPath(
+      path, GetParam(), VideoDecoder::DecoderOptions("batch_decode_threads=2"));
+  ourDecoder->scanFileAndUpdateMetadataAndIndex();
+  ourDecoder->addVideoStreamDecoder(3);
+  // Frames 0 to 4 are decoded on the way to frame 5 and dropped.
+  ourDecoder->getFrameAtIndex(3, 5);
+  VideoDecoder::DecodeStats stats = ourDecoder->getDecodeStats();
+  EXPECT_EQ(stats.numFramesDiscarded, 5);
+  EXPECT_GT(stats.sendPacketMicros + stats.receiveFrameMicros, 0);
+  EXPECT_GT(stats.conversionMicros + stats.tensorMicros, 0);
+
+  ourDecoder->getFrameAtIndex(3, 6);
+  EXPECT_EQ(ourDecoder->getDecodeStats().numFramesDiscarded, 0);
+  VideoDecoder::DecodeStats cumulativeStats =
+      ourDecoder->getCumulativeDecodeStats();
+  EXPECT_EQ(cumulativeStats.numFramesDiscarded, 5);
+  EXPECT_EQ(
+      cumulativeStats.numFramesReceivedByDecoder,
+      stats.numFramesReceivedByDecoder +
+          ourDecoder->getDecodeStats().numFramesReceivedByDecoder);
+  EXPECT_GE(cumulativeStats.receiveFrameMicros, stats.receiveFrameMicros);
+
+  // The stats of a batch cover all its frames: frames 1, 2, 4, 5, 7 and 8
+  // are decoded on the way to frames 0, 3, 6 and 9.
+  ourDecoder->getFramesInRange(3, 0, 10, 3);
+  EXPECT_EQ(ourDecoder->getDecodeStats().numFramesDiscarded, 6);
+
+  // The frames decoded by the parallel batch workers are counted too.
+  ourDecoder->resetDecodeStats();
+  EXPECT_EQ(ourDecoder->getCumulativeDecodeStats().numPacketsRead, 0);
+  ourDecoder->getFramesAtIndexes(3, {0, 300});
+  EXPECT_GT(ourDecoder->getCumulativeDecodeStats().numFramesDiscarded, 0);
+}
+
 TEST_P(VideoDecoderTest, GetAudioMetadata) {
   std::string path = getResourcePath(
       "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.audio.mp3");
@@ -416,6 +1665,203 @@ TEST_P(VideoDecoderTest, GetAudioMetadata) {
   EXPECT_NEAR(*audioStream.durationSeconds, 13.25, 1e-1);
 }
 
+TEST_P(VideoDecoderTest, DecodesAudioSamplesInRange) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.audio.mp3");
+  std::unique_ptr<VideoDecoder> decoder =
+      createDecoderFromPath(path, GetParam());
+  decoder->addAudioStreamDecoder(
+      -1,
+      VideoDecoder::AudioStreamDecoderOptions(
+          "sample_rate=16000,num_channels=1"));
+  torch::Tensor samples = decoder->getAudioSamplesInRange(0, 1.0, 2.0);
+  EXPECT_EQ(samples.sizes(), std::vector<long>({1, 16000}));
+  EXPECT_GT(samples.abs().max().item<float>(), 0);
+
+  // The second read is served from the decoded samples.
+  torch::Tensor preAllocated = torch::empty({1, 16000}, {torch::kFloat32});
+  decoder->getAudioSamplesInRange(0, 1.0, 2.0, preAllocated);
+  EXPECT_TRUE(torch::equal(preAllocated, samples));
+  EXPECT_THROW(
+      decoder->getAudioSamplesInRange(0, 1.0, 2.0, torch::empty({1, 10})),
+      std::runtime_error);
+}
+
+TEST(VideoDecoderTest, DecodesAudioRangeEndingAtEndOfStream) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4.audio.mp3");
+  std::unique_ptr<VideoDecoder> nativeRateDecoder =
+      VideoDecoder::createFromFilePath(path);
+  nativeRateDecoder->addAudioStreamDecoder(0);
+  std::unique_ptr<VideoDecoder> decoder =
+      VideoDecoder::createFromFilePath(path);
+  decoder->addAudioStreamDecoder(
+      0, VideoDecoder::AudioStreamDecoderOptions("sample_rate=16000"));
+  double endSeconds =
+      *decoder->getContainerMetadata().streams[0].durationSeconds;
+
+  // The resampler delays the last samples until it is flushed at the end of
+  // the stream. Without the flush, the resampled samples would end early and
+  // be followed by zeros.
+  auto getLastSampleSeconds = [endSeconds](const torch::Tensor& samples) {
+    // The range extends past the end of the stream.
+    double startSeconds = endSeconds - 1;
+    torch::Tensor contiguousSamples = samples.contiguous();
+    const float* data = contiguousSamples.data_ptr<float>();
+    int64_t numSamples = samples.size(1);
+    for (int64_t i = numSamples - 1; i >= 0; --i) {
+      for (int64_t channel = 0; channel < samples.size(0); ++channel) {
+        if (data[channel * numSamples + i] != 0) {
+          return startSeconds + 2.0 * (i + 1) / numSamples;
+        }
+      }
+    }
+    return startSeconds;
+  };
+  torch::Tensor nativeRateSamples = nativeRateDecoder->getAudioSamplesInRange(
+      0, endSeconds - 1, endSeconds + 1);
+  torch::Tensor samples =
+      decoder->getAudioSamplesInRange(0, endSeconds - 1, endSeconds + 1);
+  EXPECT_EQ(samples.size(1), 32000);
+  // swresample delays about 16 input samples, over 0.3 ms at 48 kHz.
+  EXPECT_NEAR(
+      getLastSampleSeconds(samples),
+      getLastSampleSeconds(nativeRateSamples),
+      0.15e-3);
+}
+
+TEST(VideoDecoderTest, KeepsPendingVideoSeekWhenDecodingAudio) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> videoDecoder =
+      VideoDecoder::createFromFilePath(path);
+  videoDecoder->addVideoStreamDecoder(3);
+  videoDecoder->setCursorPtsInSeconds(6.0);
+  auto expectedOutput = videoDecoder->getNextDecodedOutput();
+
+  std::unique_ptr<VideoDecoder> decoder =
+      VideoDecoder::createFromFilePath(path);
+  decoder->addVideoStreamDecoder(3);
+  decoder->addAudioStreamDecoder(-1);
+  int audioStreamIndex = *decoder->getContainerMetadata().bestAudioStreamIndex;
+  decoder->setCursorPtsInSeconds(6.0);
+  torch::Tensor samples =
+      decoder->getAudioSamplesInRange(audioStreamIndex, 1.0, 2.0);
+  EXPECT_GT(samples.abs().max().item<float>(), 0);
+  auto output = decoder->getNextDecodedOutput();
+  EXPECT_EQ(output.pts, expectedOutput.pts);
+  EXPECT_TRUE(torch::equal(output.frame, expectedOutput.frame));
+}
+
+TEST(VideoDecoderTest, KeepsVideoCursorWhenDecodingAudio) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> videoDecoder =
+      VideoDecoder::createFromFilePath(path);
+  videoDecoder->addVideoStreamDecoder(3);
+  videoDecoder->getNextDecodedOutput();
+  auto expectedOutput = videoDecoder->getNextDecodedOutput();
+
+  // The audio read decodes the video frames around 3 seconds, but the next
+  // video frame is still the second one.
+  std::unique_ptr<VideoDecoder> decoder =
+      VideoDecoder::createFromFilePath(path);
+  decoder->addVideoStreamDecoder(3);
+  decoder->addAudioStreamDecoder(-1);
+  int audioStreamIndex = *decoder->getContainerMetadata().bestAudioStreamIndex;
+  EXPECT_EQ(decoder->getNextDecodedOutput().pts, 0);
+  torch::Tensor samples =
+      decoder->getAudioSamplesInRange(audioStreamIndex, 3.0, 4.0);
+  EXPECT_GT(samples.abs().max().item<float>(), 0);
+  auto output = decoder->getNextDecodedOutput();
+  EXPECT_EQ(output.pts, 1001);
+  EXPECT_EQ(output.pts, expectedOutput.pts);
+  EXPECT_TRUE(torch::equal(output.frame, expectedOutput.frame));
+}
+
+TEST(VideoDecoderTest, CountsDiscardedFramesOfTheRequestedStreamOnly) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> decoder =
+      VideoDecoder::createFromFilePath(path);
+  decoder->scanFileAndUpdateMetadataAndIndex();
+  decoder->addVideoStreamDecoder(3);
+  decoder->addAudioStreamDecoder(-1);
+  int audioStreamIndex = *decoder->getContainerMetadata().bestAudioStreamIndex;
+  // The audio frames decoded on the way to frame 5 are buffered.
+  decoder->getFrameAtIndex(3, 5);
+  EXPECT_EQ(decoder->getDecodeStats().numFramesDiscarded, 5);
+  // The video frames decoded along with the audio aren't counted.
+  decoder->getAudioSamplesInRange(audioStreamIndex, 3.0, 4.0);
+  EXPECT_GT(decoder->getDecodeStats().numFramesReceivedByDecoder, 0);
+  EXPECT_EQ(decoder->getDecodeStats().numFramesDiscarded, 0);
+}
+
+TEST(VideoDecoderTest, DecodesAudioAndVideoInOnePass) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> audioDecoder =
+      VideoDecoder::createFromFilePath(path);
+  audioDecoder->addAudioStreamDecoder(-1);
+  int audioStreamIndex =
+      *audioDecoder->getContainerMetadata().bestAudioStreamIndex;
+  torch::Tensor expectedSamples =
+      audioDecoder->getAudioSamplesInRange(audioStreamIndex, 0.5, 1.5);
+
+  // The audio packets demuxed while decoding the video frames are kept, so
+  // reading the audio afterwards doesn't decode the file a second time.
+  std::unique_ptr<VideoDecoder> decoder =
+      VideoDecoder::createFromFilePath(path);
+  decoder->addVideoStreamDecoder(3);
+  decoder->addAudioStreamDecoder(audioStreamIndex);
+  decoder->getFramesInRange(3, 0, 60, 1);
+  torch::Tensor samples =
+      decoder->getAudioSamplesInRange(audioStreamIndex, 0.5, 1.5);
+  EXPECT_TRUE(torch::allclose(samples, expectedSamples, 0, 1e-4));
+  EXPECT_EQ(
+      decoder->getFrameAtIndex(3, 60).frame.sizes(),
+      std::vector<long>({270, 480, 3}));
+}
+
+TEST(VideoDecoderTest, ReturnsOnlyVideoFramesWithAudioStreamActive) {
+  std::string path = getResourcePath(
+      "pytorch/torchcodec/test/decoders/resources/nasa_13013.mp4");
+  std::unique_ptr<VideoDecoder> videoDecoder =
+      VideoDecoder::createFromFilePath(path);
+  videoDecoder->addVideoStreamDecoder(3);
+  std::unique_ptr<VideoDecoder> decoder =
+      VideoDecoder::createFromFilePath(path);
+  decoder->addVideoStreamDecoder(3);
+  decoder->addAudioStreamDecoder(-1);
+
+  // Unsorted indexes with a duplicate, so that frames are decoded out of order
+  // and copied to several output positions.
+  std::vector<int64_t> frameIndexes = {180, 2, 95, 2, 40, 389};
+  torch::Tensor expectedFrames =
+      videoDecoder->getFramesAtIndexes(3, frameIndexes).frames;
+  torch::Tensor frames = decoder->getFramesAtIndexes(3, frameIndexes).frames;
+  EXPECT_TRUE(torch::equal(frames, expectedFrames));
+
+  for (double seconds : {6.0, 1.0, 12.5}) {
+    videoDecoder->setCursorPtsInSeconds(seconds);
+    decoder->setCursorPtsInSeconds(seconds);
+    for (int i = 0; i < 3; ++i) {
+      auto expectedOutput = videoDecoder->getNextDecodedOutput();
+      auto output = decoder->getNextDecodedOutput();
+      EXPECT_EQ(output.streamType, AVMEDIA_TYPE_VIDEO);
+      EXPECT_EQ(output.streamIndex, 3);
+      EXPECT_EQ(output.pts, expectedOutput.pts);
+      EXPECT_TRUE(torch::equal(output.frame, expectedOutput.frame));
+    }
+  }
+  EXPECT_TRUE(torch::equal(
+      decoder->getFrameAtIndex(3, 100).frame,
+      videoDecoder->getFrameAtIndex(3, 100).frame));
+  int audioStreamIndex = *decoder->getContainerMetadata().bestAudioStreamIndex;
+  EXPECT_THROW(
+      decoder->getFramesAtIndexes(audioStreamIndex, {0}), std::runtime_error);
+}
+
 INSTANTIATE_TEST_SUITE_P(FromFileAndMemory, VideoDecoderTest, testing::Bool());
 
 } // namespace facebook::torchcodec
@@ -14,16 +14,31 @@ import torchvision.transforms as transforms
 from PIL import Image
 
 from torchcodec.decoders.core import (
+    add_audio_stream,
     add_video_stream,
+    clone_decoder,
     create_from_bytes,
     create_from_file,
     create_from_tensor,
+    get_audio_samples_in_range,
+    get_audio_samples_in_range_out,
+    get_decode_stats,
     get_frame_at_index,
     get_frame_at_pts,
+    get_frame_at_pts_with_accuracy,
     get_frames_at_indices,
+    get_frames_at_indices_out,
+    get_frames_from_videos,
+    get_frames_in_range,
     get_json_metadata,
+    get_key_frames,
     get_next_frame,
+    reopen_from_file,
+    reopen_from_tensor,
+    reset_decode_stats,
     seek_to_pts,
+    set_video_stream_transform,
+    split_yuv_planes,
 )
 
 torch._dynamo.config.capture_dynamic_output_shape_ops = True
@@ -111,6 +126,25 @@ class TestOps:
         with pytest.raises(AssertionError):
             assert_equal(next_frame, reference_frame6)
 
+    def test_get_frame_at_pts_with_accuracy(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder)
+        frame6, pts = get_frame_at_pts_with_accuracy(decoder, 6.02, accuracy="frames:0")
+        reference_frame6 = get_image_as_tensor("nasa_13013.mp4.time6.000000.bmp")
+        assert_equal(frame6, reference_frame6)
+        assert pts == pytest.approx(6.006)
+
+        key_frame, key_frame_pts = get_frame_at_pts_with_accuracy(
+            decoder, 6.02, accuracy="key_frame"
+        )
+        key_frames = get_key_frames(decoder, stream_index=3)
+        assert any(torch.equal(key_frame, frame) for frame in key_frames)
+
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder, options="seek_accuracy=key_frame")
+        seek_to_pts(decoder, 6.02)
+        assert_equal(get_next_frame(decoder), key_frame)
+
     def test_get_frame_at_index(self):
         decoder = create_from_file(str(get_reference_video_path()))
         add_video_stream(decoder)
@@ -133,6 +167,146 @@ class TestOps:
         assert_equal(frames1and6[0], reference_frame1)
         assert_equal(frames1and6[1], reference_frame6)
 
+    def test_get_frames_at_indices_unsorted_and_duplicates(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder)
+        frames = get_frames_at_indices(
+            decoder, frame_indices=[180, 0, 180, 1], stream_index=3
+        )
+        reference_frame1 = get_image_as_tensor("nasa_13013.mp4.frame000001.bmp")
+        reference_frame2 = get_image_as_tensor("nasa_13013.mp4.frame000002.bmp")
+        reference_frame6 = get_image_as_tensor("nasa_13013.mp4.time6.000000.bmp")
+        assert_equal(frames[0], reference_frame6)
+        assert_equal(frames[1], reference_frame1)
+        assert_equal(frames[2], reference_frame6)
+        assert_equal(frames[3], reference_frame2)
+
+    def test_get_frames_in_range(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder)
+        frames0and1 = get_frames_in_range(decoder, stream_index=3, start=0, stop=2)
+        reference_frame1 = get_image_as_tensor("nasa_13013.mp4.frame000001.bmp")
+        reference_frame2 = get_image_as_tensor("nasa_13013.mp4.frame000002.bmp")
+        assert_equal(frames0and1[0], reference_frame1)
+        assert_equal(frames0and1[1], reference_frame2)
+
+        frames = get_frames_in_range(
+            decoder, stream_index=3, start=0, stop=181, step=90
+        )
+        assert frames.shape[0] == 3
+        reference_frame6 = get_image_as_tensor("nasa_13013.mp4.time6.000000.bmp")
+        assert_equal(frames[2], reference_frame6)
+
+    def test_get_key_frames(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder, options="key_frames_only=1")
+        key_frames = get_key_frames(decoder, stream_index=3)
+        assert key_frames.shape[0] > 1
+        reference_frame1 = get_image_as_tensor("nasa_13013.mp4.frame000001.bmp")
+        assert_equal(key_frames[0], reference_frame1)
+
+        every_other_key_frame = get_key_frames(decoder, stream_index=3, step=2)
+        assert every_other_key_frame.shape[0] == (key_frames.shape[0] + 1) // 2
+
+        seek_to_pts(decoder, 0.0)
+        assert_equal(get_next_frame(decoder), key_frames[0])
+        assert_equal(get_next_frame(decoder), key_frames[1])
+
+    @pytest.mark.parametrize("dtype", ("float32", "float16", "bfloat16"))
+    def test_normalized_output_dtype(self, dtype):
+        decoder = create_from_file(str(get_reference_video_path()))
+        normalization = "mean=0.485:0.456:0.406,std=0.229:0.224:0.225"
+        add_video_stream(decoder, options=f"dtype={dtype},{normalization}")
+        frame = get_next_frame(decoder)
+        assert frame.dtype == getattr(torch, dtype)
+        reference_frame1 = get_image_as_tensor("nasa_13013.mp4.frame000001.bmp")
+        mean = torch.tensor([0.485, 0.456, 0.406])
+        std = torch.tensor([0.229, 0.224, 0.225])
+        expected = (reference_frame1.float() / 255 - mean) / std
+        torch.testing.assert_close(frame.float(), expected, rtol=0, atol=0.03)
+
+    def test_yuv_and_gray_output_formats(self):
+        frames = {}
+        for output_format in ("gray", "yuv420p", "nv12"):
+            decoder = create_from_file(str(get_reference_video_path()))
+            add_video_stream(decoder, options=f"output_format={output_format}")
+            frames[output_format] = get_frame_at_index(
+                decoder, frame_index=180, stream_index=3
+            )
+        assert frames["gray"].shape == (270, 480, 1)
+        assert frames["yuv420p"].shape == (405, 480)
+        assert frames["nv12"].shape == (405, 480)
+
+        y, u, v = split_yuv_planes(frames["yuv420p"], "yuv420p")
+        assert u.shape == v.shape == (135, 240)
+        assert_equal(y, frames["gray"][..., 0])
+        nv12_y, uv = split_yuv_planes(frames["nv12"], "nv12")
+        assert_equal(nv12_y, y)
+        assert_equal(uv[..., 0], u)
+        assert_equal(uv[..., 1], v)
+
+    def test_video_stream_transform(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder, options="crop=40:20:200:100,resize=min_side:50")
+        frame = get_frame_at_index(decoder, frame_index=180, stream_index=3)
+        assert frame.shape == (50, 100, 3)
+
+        set_video_stream_transform(decoder, stream_index=3, transform="hflip=1")
+        flipped_frame = get_frame_at_index(decoder, frame_index=180, stream_index=3)
+        set_video_stream_transform(decoder, stream_index=3, transform="")
+        frames = get_frames_at_indices(decoder, frame_indices=[180], stream_index=3)
+        assert_equal(flipped_frame, frames[0].flip(1))
+
+        with pytest.raises(RuntimeError, match="Invalid transform option"):
+            set_video_stream_transform(decoder, stream_index=3, transform="shape=NCHW")
+
+    def test_get_audio_samples_in_range(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        metadata = json.loads(get_json_metadata(decoder))
+        stream_index = int(metadata["bestAudioStreamIndex"])
+        num_channels = int(metadata["audioNumChannels"])
+        add_video_stream(decoder)
+        add_audio_stream(decoder, options="sample_rate=16000")
+        samples = get_audio_samples_in_range(
+            decoder, stream_index=stream_index, start_seconds=1.0, stop_seconds=1.5
+        )
+        assert samples.shape == (num_channels, 8000)
+        assert samples.dtype == torch.float32
+        assert samples.abs().max() > 0
+
+        out = torch.empty((num_channels, 8000))
+        get_audio_samples_in_range_out(
+            decoder,
+            stream_index=stream_index,
+            start_seconds=1.0,
+            stop_seconds=1.5,
+            out=out,
+        )
+        assert_equal(out, samples)
+
+        with pytest.raises(RuntimeError, match="Invalid audio stream index"):
+            get_audio_samples_in_range(
+                decoder, stream_index=3, start_seconds=0.0, stop_seconds=1.0
+            )
+
+    def test_get_frames_at_indices_out(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder)
+        out = torch.empty((2, 270, 480, 3), dtype=torch.uint8)
+        frames = get_frames_at_indices_out(
+            decoder, frame_indices=[0, 180], stream_index=3, out=out
+        )
+        assert frames.data_ptr() == out.data_ptr()
+        reference_frame1 = get_image_as_tensor("nasa_13013.mp4.frame000001.bmp")
+        reference_frame6 = get_image_as_tensor("nasa_13013.mp4.time6.000000.bmp")
+        assert_equal(out[0], reference_frame1)
+        assert_equal(out[1], reference_frame6)
+
+        with pytest.raises(RuntimeError, match="Expected an output tensor"):
+            get_frames_at_indices_out(
+                decoder, frame_indices=[0], stream_index=3, out=out
+            )
+
     def test_throws_exception_at_eof(self):
         decoder = create_from_file(str(get_reference_video_path()))
         add_video_stream(decoder)
@@ -190,11 +364,15 @@ class TestOps:
         assert_equal(frame1, reference_frame1)
         assert_equal(frame_time6, reference_frame_time6)
 
-    @pytest.mark.parametrize("create_from", ("file", "tensor", "bytes"))
+    @pytest.mark.parametrize(
+        "create_from", ("file", "mmap", "io_uring", "tensor", "bytes")
+    )
     def test_create_decoder(self, create_from):
         path = str(get_reference_video_path())
         if create_from == "file":
             decoder = create_from_file(path)
+        elif create_from in ("mmap", "io_uring"):
+            decoder = create_from_file(path, options=f"{create_from}=1")
         elif create_from == "tensor":
             arr = np.fromfile(path, dtype=np.uint8)
             video_tensor = torch.from_numpy(arr)
@@ -216,6 +394,114 @@ class TestOps:
         reference_frame_time6 = get_image_as_tensor("nasa_13013.mp4.time6.000000.bmp")
         assert_equal(frame_time6, reference_frame_time6)
 
+    @pytest.mark.parametrize("reopen_from", ("file", "tensor"))
+    def test_reopen_decoder(self, reopen_from):
+        path = str(get_reference_video_path())
+        decoder = create_from_file(path)
+        add_video_stream(decoder)
+        seek_to_pts(decoder, 6.0)
+        get_next_frame(decoder)
+
+        if reopen_from == "file":
+            reused_all_streams = reopen_from_file(decoder, path)
+        else:
+            video_tensor = torch.from_numpy(np.fromfile(path, dtype=np.uint8))
+            reused_all_streams = reopen_from_tensor(decoder, video_tensor)
+        assert reused_all_streams
+        reference_frame1 = get_image_as_tensor("nasa_13013.mp4.frame000001.bmp")
+        assert_equal(get_next_frame(decoder), reference_frame1)
+        frame6 = get_frame_at_index(decoder, frame_index=180, stream_index=3)
+        reference_frame6 = get_image_as_tensor("nasa_13013.mp4.time6.000000.bmp")
+        assert_equal(frame6, reference_frame6)
+
+    def test_clone_decoder(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder)
+        seek_to_pts(decoder, 6.0)
+        clone = clone_decoder(decoder)
+        # The clone starts at the beginning of the video, with its own cursor.
+        reference_frame1 = get_image_as_tensor("nasa_13013.mp4.frame000001.bmp")
+        reference_frame6 = get_image_as_tensor("nasa_13013.mp4.time6.000000.bmp")
+        assert_equal(get_next_frame(clone), reference_frame1)
+        assert_equal(get_next_frame(decoder), reference_frame6)
+        assert_equal(
+            get_frame_at_index(clone, frame_index=180, stream_index=3),
+            reference_frame6,
+        )
+        assert json.loads(get_json_metadata(clone)) == json.loads(
+            get_json_metadata(decoder)
+        )
+
+    def test_get_decode_stats(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder)
+        get_frame_at_index(decoder, frame_index=5, stream_index=3)
+        stats = get_decode_stats(decoder, cumulative=False)
+        assert stats["numFramesDiscarded"] == 5
+        assert stats["sendPacketMicros"] + stats["receiveFrameMicros"] > 0
+
+        get_frame_at_index(decoder, frame_index=6, stream_index=3)
+        cumulative_stats = get_decode_stats(decoder)
+        assert cumulative_stats["numFramesDiscarded"] == 5
+        assert cumulative_stats["numPacketsRead"] >= stats["numPacketsRead"]
+
+        # The stats of a batch cover all its frames, not only the last one.
+        get_frames_at_indices(decoder, frame_indices=[0, 3], stream_index=3)
+        assert get_decode_stats(decoder, cumulative=False)["numFramesDiscarded"] == 2
+
+        reset_decode_stats(decoder)
+        assert all(value == 0 for value in get_decode_stats(decoder).values())
+
+    def test_profiler_scopes(self):
+        decoder = create_from_file(str(get_reference_video_path()))
+        add_video_stream(decoder)
+        with torch.profiler.profile(record_shapes=True) as profiler:
+            get_frames_at_indices(decoder, frame_indices=[0, 180], stream_index=3)
+        event_names = {event.name for event in profiler.events()}
+        assert {
+            "torchcodec::decode",
+            "torchcodec::decode_segment",
+            "torchcodec::convert",
+        } <= event_names
+
+    def test_get_frames_from_videos(self):
+        path = str(get_reference_video_path())
+        video_tensor = torch.from_numpy(np.fromfile(path, dtype=np.uint8))
+        reference_frame1 = get_image_as_tensor("nasa_13013.mp4.frame000001.bmp")
+        reference_frame6 = get_image_as_tensor("nasa_13013.mp4.time6.000000.bmp")
+
+        frames = get_frames_from_videos(
+            [path, path], frame_indices=[[0, 180], [180, 0]], num_threads=2
+        )
+        assert frames.shape == (2, 2, 270, 480, 3)
+        assert_equal(frames[0, 0], reference_frame1)
+        assert_equal(frames[0, 1], reference_frame6)
+        assert_equal(frames[1, 0], reference_frame6)
+        assert_equal(frames[1, 1], reference_frame1)
+
+        frames = get_frames_from_videos(
+            [video_tensor, video_tensor], timestamps=[[6.02], [0.0, 6.02]]
+        )
+        assert isinstance(frames, list)
+        assert_equal(frames[0][0], reference_frame6)
+        assert_equal(frames[1][0], reference_frame1)
+        assert_equal(frames[1][1], reference_frame6)
+
+    def test_create_from_file_with_index_cache(self, tmp_path):
+        options = f"index_cache=1,index_cache_dir={tmp_path}"
+        decoder = create_from_file(str(get_reference_video_path()), options=options)
+        assert len(list(tmp_path.iterdir())) == 1
+
+        # The second decoder reads its index from the cache file.
+        decoder = create_from_file(str(get_reference_video_path()), options=options)
+        add_video_stream(decoder)
+        metadata_dict = json.loads(get_json_metadata(decoder))
+        assert metadata_dict["numFrames"] == 390
+        assert metadata_dict["maxPtsSecondsFromScan"] == 13.013
+        frame6 = get_frame_at_index(decoder, frame_index=180, stream_index=3)
+        reference_frame6 = get_image_as_tensor("nasa_13013.mp4.time6.000000.bmp")
+        assert_equal(frame6, reference_frame6)
+
     def test_video_get_json_metadata(self):
         decoder = create_from_file(str(get_reference_video_path()))
         metadata = get_json_metadata(decoder)